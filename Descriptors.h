@@ -42,7 +42,60 @@
 		#include <LUFA/Drivers/USB/USB.h>
 
 	/* Macros: */
-#ifdef DEBUG_CONSOLE
+#if defined(JTAGICE_USB)
+		/** Endpoint address of the JTAGICE mkII host-to-device bulk OUT endpoint. */
+		#define JTAG_RX_EPADDR                 (ENDPOINT_DIR_OUT | 2)
+
+		/** Endpoint address of the JTAGICE mkII device-to-host bulk IN endpoint.  The real
+		 *  unit uses 0x82, but endpoint numbers on the USB AVRs have a single direction, so
+		 *  hosts must take this address from the descriptor.
+		 */
+		#define JTAG_TX_EPADDR                 (ENDPOINT_DIR_IN  | 3)
+
+		/** Size in bytes of the JTAGICE mkII bulk IN and OUT endpoints. */
+		#define JTAG_TXRX_EPSIZE               64
+
+	/* Type Defines: */
+		/** Type define for the device configuration descriptor structure. This must be defined in the
+		 *  application code, as the configuration descriptor contains several sub-descriptors which
+		 *  vary between devices, and which describe the device's usage to the host.
+		 */
+		typedef struct
+		{
+			USB_Descriptor_Configuration_Header_t    Config;
+
+			// Vendor-specific JTAGICE mkII Interface
+			USB_Descriptor_Interface_t               JTAG_Interface;
+			USB_Descriptor_Endpoint_t                JTAG_DataInEndpoint;
+			USB_Descriptor_Endpoint_t                JTAG_DataOutEndpoint;
+		} USB_Descriptor_Configuration_t;
+
+		/** Enum for the device interface descriptor IDs within the device. Each interface descriptor
+		 *  should have a unique ID index associated with it, which can be used to refer to the
+		 *  interface from other descriptors.
+		 */
+		enum InterfaceDescriptors_t
+		{
+			INTERFACE_ID_JTAG = 0, /**< JTAGICE mkII interface descriptor ID */
+		};
+
+		/** Enum for the device string descriptor IDs within the device. Each string descriptor should
+		 *  have a unique ID index associated with it, which can be used to refer to the string from
+		 *  other descriptors.
+		 */
+		enum StringDescriptors_t
+		{
+			STRING_ID_Language     = 0, /**< Supported Languages string descriptor ID (must be zero) */
+			STRING_ID_Manufacturer = 1, /**< Manufacturer string ID */
+			STRING_ID_Product      = 2, /**< Product string ID */
+		};
+
+	/* Function Prototypes: */
+		uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
+		                                    const uint16_t wIndex,
+		                                    const void** const DescriptorAddress)
+		                                    ATTR_WARN_UNUSED_RESULT ATTR_NON_NULL_PTR_ARG(3);
+#elif defined(DEBUG_CONSOLE)
 		/** Endpoint address of the first CDC interface's device-to-host data IN endpoint. */
 		#define CDC1_TX_EPADDR                 (ENDPOINT_DIR_IN  | 1)
 
@@ -65,7 +118,7 @@
 		#define CDC_NOTIFICATION_EPSIZE        8
 
 		/** Size in bytes of the CDC data IN and OUT endpoints. */
-		#define CDC_TXRX_EPSIZE                16
+		#define CDC_TXRX_EPSIZE                64
 
 	/* Type Defines: */
 		/** Type define for the device configuration descriptor structure. This must be defined in the
@@ -145,7 +198,7 @@
 		#define CDC_NOTIFICATION_EPSIZE        8
 
 		/** Size in bytes of the CDC data IN and OUT endpoints. */
-		#define CDC_TXRX_EPSIZE                16
+		#define CDC_TXRX_EPSIZE                64
 
 	/* Type Defines: */
 		/** Type define for the device configuration descriptor structure. This must be defined in the
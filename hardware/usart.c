@@ -19,6 +19,7 @@
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <util/delay.h>
 #include "hardware/usart.h"
 #include "util/debug.h"
 
@@ -144,6 +145,7 @@ int8_t usart_init(uint32_t baud, uint16_t mode) {
 	/* Set up IO pins */
 	DDRD &= ~(1 << 2);	/* PD2 == RX; input */
 	DDRD |= (1 << 3);	/* PD3 == TX; output */
+	PORTD |= (1 << 3);	/* Idle high while the transmitter is off */
 
 	UCSR1C	= (((mode >> 14) & 0x03) << UMSEL10)	/* USART mode */
 		| (((mode >> 5) & 0x03) << UPM10)	/* Parity mode */
@@ -162,6 +164,30 @@ int8_t usart_init(uint32_t baud, uint16_t mode) {
 	return 0;
 }
 
+/*!
+ * Send a break
+ */
+void usart_break(uint16_t us) {
+	uint8_t ucsr1b;
+
+	/* Let anything still queued go out first */
+	while ((fifo_peek_one(&usart_fifo_tx) >= 0)
+			|| ((usart_duplex & DUPLEX_STATE_MASK)
+				== DUPLEX_STATE_TX))
+		;
+
+	/* Take TX off the pin and drive it low ourselves */
+	ucsr1b = UCSR1B;
+	UCSR1B &= ~(1 << TXEN1);
+	PORTD &= ~(1 << 3);
+	while (us >= 10) {
+		_delay_us(10);
+		us -= 10;
+	}
+	PORTD |= (1 << 3);
+	UCSR1B = ucsr1b;
+}
+
 static void usart_send_next() {
 	/* Ready to send next byte */
 	int16_t byte = fifo_read_one(&usart_fifo_tx);
@@ -45,6 +45,12 @@
  */
 int8_t usart_init(uint32_t baud, uint16_t mode);
 
+/*!
+ * Hold the line low for `us` microseconds (a break).  This blocks, first
+ * until anything queued has been sent; call it with interrupts enabled.
+ */
+void usart_break(uint16_t us);
+
 /*! FIFO buffer for USART receive data */
 extern struct fifo_t usart_fifo_rx;
 
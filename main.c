@@ -24,12 +24,32 @@
 #include "util/fifo.h"
 #include "hardware/led.h"
 #include "hardware/usart.h"
+#include "protocol/interface.h"
+#include "protocol/delimiter.h"
+
+#if defined(JTAGICE_USB)
+#ifdef DEBUG_CONSOLE
+#error "DEBUG_CONSOLE needs the CDC descriptor layout; it cannot be used with JTAGICE_USB"
+#endif
+/*
+ * Host data endpoints: the vendor-specific JTAGICE mkII bulk pipes, which
+ * are configured in EVENT_USB_Device_ConfigurationChanged.
+ */
+#define HOST_RX_EPADDR	JTAG_RX_EPADDR
+#define HOST_TX_EPADDR	JTAG_TX_EPADDR
+#define HOST_EPSIZE	JTAG_TXRX_EPSIZE
+#elif !defined(DEBUG_CONSOLE)
+#define HOST_RX_EPADDR	CDC_RX_EPADDR
+#define HOST_TX_EPADDR	CDC_TX_EPADDR
+#define HOST_EPSIZE	CDC_TXRX_EPSIZE
 
-#ifndef DEBUG_CONSOLE
 /*!
  * LUFA CDC Class driver interface configuration and state information. This structure is
  * passed to all CDC Class driver functions, so that multiple instances of the same class
  * within a device can be differentiated from one another.
+ *
+ * The data endpoints are double-banked so that one bank can be on the bus while the
+ * firmware fills or drains the other.
  */
 USB_ClassInfo_CDC_Device_t VirtualSerial_CDC_Interface =
 	{
@@ -40,13 +60,13 @@ USB_ClassInfo_CDC_Device_t VirtualSerial_CDC_Interface =
 					{
 						.Address          = CDC_TX_EPADDR,
 						.Size             = CDC_TXRX_EPSIZE,
-						.Banks            = 1,
+						.Banks            = 2,
 					},
 				.DataOUTEndpoint =
 					{
 						.Address          = CDC_RX_EPADDR,
 						.Size             = CDC_TXRX_EPSIZE,
-						.Banks            = 1,
+						.Banks            = 2,
 					},
 				.NotificationEndpoint =
 					{
@@ -57,6 +77,10 @@ USB_ClassInfo_CDC_Device_t VirtualSerial_CDC_Interface =
 			},
 	};
 #else
+#define HOST_RX_EPADDR	CDC1_RX_EPADDR
+#define HOST_TX_EPADDR	CDC1_TX_EPADDR
+#define HOST_EPSIZE	CDC_TXRX_EPSIZE
+
 USB_ClassInfo_CDC_Device_t VirtualSerial_CDC_Interface =
 	{
 		.Config =
@@ -66,13 +90,13 @@ USB_ClassInfo_CDC_Device_t VirtualSerial_CDC_Interface =
 					{
 						.Address          = CDC1_TX_EPADDR,
 						.Size             = CDC_TXRX_EPSIZE,
-						.Banks            = 1,
+						.Banks            = 2,
 					},
 				.DataOUTEndpoint =
 					{
 						.Address          = CDC1_RX_EPADDR,
 						.Size             = CDC_TXRX_EPSIZE,
-						.Banks            = 1,
+						.Banks            = 2,
 					},
 				.NotificationEndpoint =
 					{
@@ -128,29 +152,323 @@ const uint8_t usart_led_delay = 50;
 /*
  * FIFO buffers for target communications.
  */
-static struct fifo_t target_fifo_rx __attribute__((nocommon));
-static uint8_t target_fifo_rx_buffer[128];
+FIFO_DEFINE(target_fifo_rx, 128);
 extern struct fifo_t usart_fifo_rx __attribute__((alias ("target_fifo_rx")));
 extern struct fifo_t proto_target_uart_rx __attribute__((alias ("target_fifo_rx")));
 
-static struct fifo_t target_fifo_tx __attribute__((nocommon));
-static uint8_t target_fifo_tx_buffer[128];
+FIFO_DEFINE(target_fifo_tx, 128);
 extern struct fifo_t usart_fifo_tx __attribute__((alias ("target_fifo_tx")));
 extern struct fifo_t proto_target_uart_tx __attribute__((alias ("target_fifo_tx")));
 
+#ifdef PASSTHROUGH
 /*
- * FIFO buffers for host communications.
+ * Transparent mode: the USB endpoints feed and drain the target FIFOs
+ * directly, and the protocol layer is left out.
  */
-static struct fifo_t host_fifo_rx __attribute__((nocommon));
-static uint8_t host_fifo_rx_buffer[128];
-extern struct fifo_t proto_host_uart_rx __attribute__((alias ("host_fifo_rx")));
-static struct fifo_t host_fifo_tx __attribute__((nocommon));
-static uint8_t host_fifo_tx_buffer[128];
-extern struct fifo_t proto_host_uart_tx __attribute__((alias ("host_fifo_tx")));
+#define HOST_RX_FIFO	target_fifo_tx
+#define HOST_RX_T	struct fifo_t
+#define HOST_RX_FN(name)	fifo_##name
+#define HOST_TX_FIFO	target_fifo_rx
+#define HOST_TX_FN(name)	fifo_##name
+#else
+/*
+ * FIFO buffers for host communications.  The receive side must hold a
+ * whole JTAGICE mkII frame, as its CRC is checked in place: with the 10
+ * bytes of framing, SET_DEVICE_DESCRIPTOR is 309 bytes and a flash page
+ * write 148 bytes for a 128-byte page.  Sizes are powers of two, so 512
+ * is the smallest that fits; the receive FIFO is the single largest user
+ * of SRAM (2.5 KiB on the ATmega32U4), so check `make size` after
+ * changing it.
+ */
+FIFO16_DEFINE(host_fifo_rx, 512);
+extern struct fifo16_t proto_host_uart_rx __attribute__((alias ("host_fifo_rx")));
+FIFO16_DEFINE(host_fifo_tx, 256);
+extern struct fifo16_t proto_host_uart_tx __attribute__((alias ("host_fifo_tx")));
+
+#define HOST_RX_FIFO	host_fifo_rx
+#define HOST_RX_T	struct fifo16_t
+#define HOST_RX_FN(name)	fifo16_##name
+#define HOST_TX_FIFO	host_fifo_tx
+#define HOST_TX_FN(name)	fifo16_##name
+#endif
 
 /* Timer demo */
 struct timer_t demo_timer;
 
+/*!
+ * Set if the last packet sent to the host was a full one, in which case
+ * a zero-length packet is needed to end the transfer once we run dry.
+ */
+static uint8_t host_tx_zlp = 0;
+
+/*!
+ * Set while the host OUT endpoint is left NAKing for lack of room in
+ * HOST_RX_FIFO.  Cleared by that FIFO's low-water (or empty) event,
+ * which may be raised from the USART ISR in PASSTHROUGH builds, or by
+ * host_rx_room.
+ */
+static volatile uint8_t host_rx_wait = 0;
+
+#if defined(JTAGICE_USB) && !defined(PASSTHROUGH)
+/*!
+ * Number of bytes of the current frame still to be sent to the host.
+ * Zero between frames.
+ */
+static uint32_t host_tx_frame = 0;
+#endif
+
+/*!
+ * Test whether the host end of the interface is ready for data.
+ */
+static uint8_t host_ready(void) {
+#ifdef JTAGICE_USB
+	return (USB_DeviceState == DEVICE_STATE_Configured);
+#else
+	return (USB_DeviceState == DEVICE_STATE_Configured)
+		&& VirtualSerial_CDC_Interface.State.LineEncoding.BaudRateBPS;
+#endif
+}
+
+/*!
+ * HOST_RX_FIFO producer event handler: there is room for another
+ * packet, so resume reading the OUT endpoint.
+ */
+static void host_rx_evth(HOST_RX_T* const fifo, uint8_t events) {
+	host_rx_wait = 0;
+}
+
+/*!
+ * Return non-zero if the host OUT endpoint is to be read: it is not held
+ * off, or there is room for some of the bank again.  The low-water event
+ * is not enough by itself: a frame nearly the size of the FIFO leaves it
+ * above the mark when the frame before it is released, and the parser then
+ * waits for bytes still in the bank.
+ */
+static uint8_t host_rx_room(void) {
+	if (host_rx_wait && (HOST_RX_FN(stored)(&HOST_RX_FIFO)
+				< HOST_RX_FIFO.total_sz))
+		host_rx_wait = 0;
+	return !host_rx_wait;
+}
+
+/*!
+ * Drain the host OUT endpoint into HOST_RX_FIFO, a whole bank at a time.
+ * Bytes that do not fit are left in the bank, which NAKs the host, and
+ * the endpoint is not looked at again until the FIFO has room.
+ */
+static void host_receive(void) {
+	Endpoint_SelectEndpoint(HOST_RX_EPADDR);
+
+	while (Endpoint_IsOUTReceived()) {
+		uint16_t avail = Endpoint_BytesInEndpoint();
+
+		while (avail) {
+			uint8_t* span;
+			uint16_t sz = HOST_RX_FN(write_reserve)(&HOST_RX_FIFO,
+					&span);
+			if (!sz)
+				break;
+			if (sz > avail)
+				sz = avail;
+
+			for (uint16_t i = 0; i < sz; i++)
+				span[i] = Endpoint_Read_8();
+			HOST_RX_FN(write_commit)(&HOST_RX_FIFO, sz);
+			avail -= sz;
+		}
+
+		if (avail) {
+			/* No room left; leave the rest for later. */
+			host_rx_wait = 1;
+			FIFO_BARRIER();
+			if (HOST_RX_FN(stored)(&HOST_RX_FIFO)
+					<= HOST_RX_FIFO.lowat)
+				/* Drained while we were filling it */
+				host_rx_wait = 0;
+			return;
+		}
+
+		/* Indicate received data from host */
+		led_pulse(&led1_g, LED_ACT_OFF, 50, LED_ACT_ON, 0);
+		Endpoint_ClearOUT();
+	}
+}
+
+/*!
+ * Copy up to `max` bytes from HOST_TX_FIFO into the selected IN endpoint
+ * bank.  Returns the number of bytes copied.
+ */
+static uint16_t host_write(uint16_t max) {
+	uint16_t count = 0;
+
+	while (count < max) {
+		uint8_t* span;
+		uint16_t sz = HOST_TX_FN(read_reserve)(&HOST_TX_FIFO, &span);
+		if (!sz)
+			break;
+		if (sz > (max - count))
+			sz = max - count;
+
+		for (uint16_t i = 0; i < sz; i++)
+			Endpoint_Write_8(span[i]);
+		HOST_TX_FN(read_commit)(&HOST_TX_FIFO, sz);
+		count += sz;
+	}
+	return count;
+}
+
+#if defined(JTAGICE_USB) && !defined(PASSTHROUGH)
+/*!
+ * Return the total size of the frame at the head of host_fifo_tx, or 0
+ * if its header has not all arrived yet.  Data that does not start with
+ * a frame delimiter is treated as a single run of whatever is stored.
+ */
+static uint32_t host_frame_sz(void) {
+	/* Start, sequence (2), size (4), token */
+	uint8_t hdr[8];
+	uint16_t sz = fifo16_peek(&host_fifo_tx, hdr, sizeof(hdr));
+
+	if (!sz)
+		return 0;
+	if (hdr[0] != PROTO_DELIM_START)
+		return fifo16_stored(&host_fifo_tx);
+	if (sz < sizeof(hdr))
+		return 0;
+
+	/* Header, body and CRC */
+	return sizeof(hdr) + 2
+		+ ((uint32_t)hdr[3])
+		+ ((uint32_t)hdr[4] << 8)
+		+ ((uint32_t)hdr[5] << 16)
+		+ ((uint32_t)hdr[6] << 24);
+}
+
+/*!
+ * Fill the host IN endpoint from host_fifo_tx, one frame per transfer.
+ * Host tools read a JTAGICE mkII frame as a single bulk transfer ended
+ * by a short (or zero-length) packet, so a frame never shares a packet
+ * with the next one, and a partly-filled bank is held back until the
+ * rest of its frame arrives.
+ */
+static void host_send(void) {
+	Endpoint_SelectEndpoint(HOST_TX_EPADDR);
+
+	while (Endpoint_IsINReady()) {
+		uint16_t room = HOST_EPSIZE - Endpoint_BytesInEndpoint();
+
+		if (!host_tx_frame) {
+			if (host_tx_zlp) {
+				/* Last frame filled its final packet */
+				Endpoint_ClearIN();
+				host_tx_zlp = 0;
+				continue;
+			}
+
+			host_tx_frame = host_frame_sz();
+			if (!host_tx_frame)
+				return;
+		}
+
+		uint16_t sz = host_write((host_tx_frame < room)
+				? host_tx_frame : room);
+		room -= sz;
+		host_tx_frame -= sz;
+
+		if (host_tx_frame && room)
+			/* Wait for the rest of the frame */
+			return;
+
+		/* Indicate sent data to host */
+		led_pulse(&led1_r, LED_ACT_OFF, 50, LED_ACT_ON, 0);
+		Endpoint_ClearIN();
+		host_tx_zlp = !host_tx_frame && !room;
+	}
+}
+#else
+/*!
+ * Fill the host IN endpoint from HOST_TX_FIFO.  Full banks are sent as
+ * they fill; a partial bank is sent once the FIFO runs dry.
+ */
+static void host_send(void) {
+	Endpoint_SelectEndpoint(HOST_TX_EPADDR);
+
+	while (Endpoint_IsINReady()) {
+		uint16_t room = HOST_EPSIZE - Endpoint_BytesInEndpoint();
+
+		room -= host_write(room);
+		if (room == HOST_EPSIZE) {
+			/* Nothing to send, end the transfer if needed */
+			if (host_tx_zlp) {
+				Endpoint_ClearIN();
+				host_tx_zlp = 0;
+			}
+			return;
+		}
+
+		/* Indicate sent data to host */
+		led_pulse(&led1_r, LED_ACT_OFF, 50, LED_ACT_ON, 0);
+		Endpoint_ClearIN();
+		host_tx_zlp = !room;
+		if (room)
+			/* Short packet: FIFO has run dry */
+			return;
+	}
+}
+#endif
+
+#if defined(DEBUG_CONSOLE) && defined(FIFO_STATS)
+/*!
+ * Print one FIFO's statistics to the debug console.
+ */
+static void debug_fifo_report(const char* name,
+		const struct fifo_stats_t* const stats) {
+	fprintf(&debug_stream,
+			"%s: peak=%u over=%u under=%u in=%lu out=%lu\r\n",
+			name, stats->peak, stats->overruns, stats->underruns,
+			stats->bytes_in, stats->bytes_out);
+}
+
+/*!
+ * Print statistics for all FIFOs, zeroing them if `reset` is set.
+ */
+static void debug_fifo_stats(uint8_t reset) {
+	struct fifo_stats_t stats;
+
+#ifndef PASSTHROUGH
+	fifo16_stats(&host_fifo_rx, &stats, reset);
+	debug_fifo_report("host_rx", &stats);
+	fifo16_stats(&host_fifo_tx, &stats, reset);
+	debug_fifo_report("host_tx", &stats);
+#endif
+	fifo_stats(&target_fifo_rx, &stats, reset);
+	debug_fifo_report("target_rx", &stats);
+	fifo_stats(&target_fifo_tx, &stats, reset);
+	debug_fifo_report("target_tx", &stats);
+}
+#endif
+
+#if defined(DEBUG_CONSOLE) && defined(PROTO_STATS) && !defined(PASSTHROUGH)
+/*!
+ * Print the protocol statistics, zeroing them if `reset` is set.
+ */
+static void debug_proto_stats(uint8_t reset) {
+	struct proto_stats_t stats;
+
+	proto_stats(&stats, reset);
+	fprintf(&debug_stream,
+			"mem: hit=%lu miss=%lu pc: hit=%lu miss=%lu "
+			"ahead: hit=%lu drop=%lu "
+			"pages: skip=%lu erase=%lu write=%lu "
+			"bp: write=%lu avoid=%lu step: range=%lu\r\n",
+			stats.mem_hits, stats.mem_misses,
+			stats.pc_hits, stats.pc_misses,
+			stats.ahead_hits, stats.ahead_drops,
+			stats.pages_skipped, stats.pages_erased,
+			stats.pages_written, stats.bp_pages,
+			stats.bp_avoided, stats.range_steps);
+}
+#endif
+
 /*!
  * Main program entry point. This routine contains the overall
  * program flow, including initial setup of all components and the
@@ -166,14 +484,32 @@ int main(void)
 
 	led_set_state(&led2_b, LED_ACT_ON);
 
-	fifo_init(&target_fifo_rx,
-		target_fifo_rx_buffer, sizeof(target_fifo_rx_buffer));
-	fifo_init(&target_fifo_tx,
-		target_fifo_tx_buffer, sizeof(target_fifo_tx_buffer));
-	fifo_init(&host_fifo_rx,
-		host_fifo_rx_buffer, sizeof(host_fifo_rx_buffer));
-	fifo_init(&host_fifo_tx,
-		host_fifo_tx_buffer, sizeof(host_fifo_tx_buffer));
+	FIFO_INIT(target_fifo_rx);
+	FIFO_INIT(target_fifo_tx);
+#ifndef PASSTHROUGH
+	FIFO16_INIT(host_fifo_rx);
+	FIFO16_INIT(host_fifo_tx);
+#endif
+
+	/*
+	 * Batch the events on the receive paths; these are delivered from
+	 * the main loop rather than once per byte (from the ISR, in the case
+	 * of the target).  The protocol layer also waits on host_fifo_tx
+	 * draining, which is batched so it does not re-enter host_send.
+	 */
+	target_fifo_rx.config |= FIFO_CFG_COALESCE;
+#ifndef PASSTHROUGH
+	host_fifo_rx.config |= FIFO_CFG_COALESCE;
+	host_fifo_tx.config |= FIFO_CFG_COALESCE;
+#endif
+
+	/*
+	 * Flow control: stop taking data from the host when its receive
+	 * FIFO fills, and resume once a whole packet fits again.
+	 */
+	HOST_RX_FIFO.lowat = HOST_RX_FIFO.total_sz - HOST_EPSIZE;
+	HOST_RX_FIFO.producer_evth = host_rx_evth;
+	HOST_RX_FIFO.producer_evtm = FIFO_EVT_LOWAT | FIFO_EVT_EMPTY;
 
 	timer_start(&demo_timer, 100);
 	usart_init(9600, USART_MODE_ASYNC | USART_MODE_RXEN
@@ -181,7 +517,9 @@ int main(void)
 			| USART_MODE_NPAR | USART_MODE_HDUPLEX);
 
 	SetupHardware();
+#ifndef PASSTHROUGH
 	proto_init();
+#endif
 #ifdef DEBUG_CONSOLE
 	CDC_Device_CreateBlockingStream(&debug_console_cdc, &debug_stream);
 #endif
@@ -190,36 +528,45 @@ int main(void)
 
 	for (;;)
 	{
-		int16_t in = CDC_Device_ReceiveByte(&VirtualSerial_CDC_Interface);
-		if (in >= 0) {
-			/* Indicate received data from host, push to FIFO */
-			led_pulse(&led1_g, LED_ACT_OFF, 50, LED_ACT_ON, 0);
-			fifo_write_one(&host_fifo_rx, in);
-		}
+		if (host_ready() && host_rx_room())
+			host_receive();
 #ifdef DEBUG_CONSOLE
-		/* Read and echo back */
-		in = CDC_Device_ReceiveByte(&debug_console_cdc);
-		if ((in >= 0) && debug_console_ready)
-			CDC_Device_SendByte(&debug_console_cdc, in);
+		/*
+		 * Read and echo back.  With FIFO_STATS, 's' prints the FIFO
+		 * statistics and 'z' prints then zeroes them; with PROTO_STATS,
+		 * 'c' and 'x' do the same for the protocol (cache) statistics.
+		 */
+		int16_t in = CDC_Device_ReceiveByte(&debug_console_cdc);
+		if ((in >= 0) && debug_console_ready) {
+#ifdef FIFO_STATS
+			if ((in == 's') || (in == 'z'))
+				debug_fifo_stats(in == 'z');
+			else
 #endif
-
-		in = fifo_read_one(&host_fifo_rx);
-		if (in >= 0) {
-			fifo_write_one(&target_fifo_tx, in);
+#if defined(PROTO_STATS) && !defined(PASSTHROUGH)
+			if ((in == 'c') || (in == 'x'))
+				debug_proto_stats(in == 'x');
+			else
+#endif
+				CDC_Device_SendByte(&debug_console_cdc, in);
 		}
+#endif
 
-		in = fifo_read_one(&target_fifo_rx);
-		if (in >= 0) {
-			fifo_write_one(&host_fifo_tx, in);
-		}
+		/* Deliver batched receive events */
+		fifo_dispatch(&target_fifo_rx);
+#ifndef PASSTHROUGH
+		fifo16_dispatch(&host_fifo_rx);
+		proto_task();
+#endif
 
-		in = fifo_read_one(&host_fifo_tx);
-		if (in >= 0) {
-			/* Indicate sent data to host, push to host */
-			led_pulse(&led1_r, LED_ACT_OFF, 50, LED_ACT_ON, 0);
-			CDC_Device_SendByte(&VirtualSerial_CDC_Interface, in);
-		}
+		if (host_ready())
+			host_send();
+#ifndef PASSTHROUGH
+		fifo16_dispatch(&host_fifo_tx);
+#endif
+#ifndef JTAGICE_USB
 		CDC_Device_USBTask(&VirtualSerial_CDC_Interface);
+#endif
 #ifdef DEBUG_CONSOLE
 		CDC_Device_USBTask(&debug_console_cdc);
 #endif
@@ -281,13 +628,25 @@ void proto_target_baud(uint32_t rate) {
 		| USART_MODE_8DBIT | USART_MODE_NPAR | USART_MODE_HDUPLEX);
 }
 
+void proto_target_break(uint16_t us) {
+	usart_break(us);
+}
+
 /** Event handler for the library USB Connection event. */
 void EVENT_USB_Device_Connect(void)
 {
 	fifo_empty(&target_fifo_tx);
 	fifo_empty(&target_fifo_rx);
-	fifo_empty(&host_fifo_tx);
-	fifo_empty(&host_fifo_rx);
+#ifndef PASSTHROUGH
+	fifo16_empty(&host_fifo_tx);
+	fifo16_empty(&host_fifo_rx);
+	proto_reset();
+#endif
+#if defined(JTAGICE_USB) && !defined(PASSTHROUGH)
+	host_tx_frame = 0;
+#endif
+	host_tx_zlp = 0;
+	host_rx_wait = 0;
 }
 
 /** Event handler for the library USB Disconnection event. */
@@ -295,14 +654,30 @@ void EVENT_USB_Device_Disconnect(void)
 {
 	fifo_empty(&target_fifo_tx);
 	fifo_empty(&target_fifo_rx);
-	fifo_empty(&host_fifo_tx);
-	fifo_empty(&host_fifo_rx);
+#ifndef PASSTHROUGH
+	fifo16_empty(&host_fifo_tx);
+	fifo16_empty(&host_fifo_rx);
+	proto_reset();
+#endif
+#if defined(JTAGICE_USB) && !defined(PASSTHROUGH)
+	host_tx_frame = 0;
+#endif
+	host_tx_zlp = 0;
+	host_rx_wait = 0;
 }
 
 /** Event handler for the library USB Configuration Changed event. */
 void EVENT_USB_Device_ConfigurationChanged(void)
 {
+#ifdef JTAGICE_USB
+	/* Double-banked, as with the CDC data endpoints */
+	Endpoint_ConfigureEndpoint(HOST_TX_EPADDR, EP_TYPE_BULK,
+			HOST_EPSIZE, 2);
+	Endpoint_ConfigureEndpoint(HOST_RX_EPADDR, EP_TYPE_BULK,
+			HOST_EPSIZE, 2);
+#else
 	CDC_Device_ConfigureEndpoints(&VirtualSerial_CDC_Interface);
+#endif
 #ifdef DEBUG_CONSOLE
 	CDC_Device_ConfigureEndpoints(&debug_console_cdc);
 #endif
@@ -311,12 +686,15 @@ void EVENT_USB_Device_ConfigurationChanged(void)
 /** Event handler for the library USB Control Request reception event. */
 void EVENT_USB_Device_ControlRequest(void)
 {
+#ifndef JTAGICE_USB
 	CDC_Device_ProcessControlRequest(&VirtualSerial_CDC_Interface);
+#endif
 #ifdef DEBUG_CONSOLE
 	CDC_Device_ProcessControlRequest(&debug_console_cdc);
 #endif
 }
 
+#ifndef JTAGICE_USB
 /** CDC class driver callback function the processing of changes to the virtual
  *  control lines sent from the host..
  *
@@ -337,6 +715,7 @@ void EVENT_CDC_Device_ControLineStateChanged(USB_ClassInfo_CDC_Device_t *const C
 	}
 #endif
 }
+#endif
 
 ISR(TIMER1_OVF_vect) {
 	/* Tick the LEDs: TODO: put in timer interrupt */
@@ -347,4 +726,7 @@ ISR(TIMER1_OVF_vect) {
 	led_tick(&led2_b);
 
 	timer_tick(&demo_timer);
+#ifndef PASSTHROUGH
+	proto_tick();
+#endif
 }
@@ -0,0 +1,389 @@
+#ifndef _PROTOCOL_BREAKPOINT_H
+#define _PROTOCOL_BREAKPOINT_H
+
+/*!
+ * Breakpoints set by the host.
+ *
+ * debugWIRE has one hardware breakpoint; any other breakpoint is a BREAK
+ * instruction in flash, which costs a page erase and write to put in and
+ * again to take out.  So requests are only recorded as they arrive.  When
+ * the target is next set running, the hardware breakpoint goes to the
+ * breakpoint hit most often (the most recently set of those hit equally
+ * often) and the flash is brought in line with the rest.  Requests that
+ * cancel out never reach the flash, and breakpoints in the same page
+ * share one write.  The BREAK instructions stay in flash while the target
+ * is stopped; reads of flash see the instructions they replace.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PROTO_BP_MAX		(8)	/*!< Breakpoints that can be kept */
+#define PROTO_BP_NONE		(0xffff)	/*!< No address (as DW_BP_NONE) */
+#define PROTO_BP_BREAK		(0x9598)	/*!< The BREAK instruction */
+
+/* Breakpoint types (CMND_SET_BREAK) */
+#define PROTO_BP_TYPE_PROGRAM	(0x01)	/*!< Program memory */
+
+#define PROTO_BP_FL_WANTED	(1 << 0)	/*!< Set by the host */
+#define PROTO_BP_FL_FLASH	(1 << 1)	/*!< BREAK is in flash */
+#define PROTO_BP_FL_INSN	(1 << 2)	/*!< Instruction replaced known */
+#define PROTO_BP_FL_PLACE	(1 << 3)	/*!< BREAK to be in flash */
+
+/*!
+ * A breakpoint.  The entry is free when none of its flags are set; one
+ * cleared by the host stays until its BREAK has been taken out again.
+ */
+struct proto_bp_t {
+	uint16_t addr;		/*!< Address (words) */
+	uint16_t insn;		/*!< Instruction the BREAK replaces */
+	uint16_t age;		/*!< When it was set (proto_bp_table_t.age) */
+	uint8_t hits;		/*!< Times the target stopped on it */
+	uint8_t num;		/*!< Number the host set it as */
+	uint8_t flags;		/*!< PROTO_BP_FL_* */
+};
+
+/*!
+ * The breakpoints.
+ */
+struct proto_bp_table_t {
+	struct proto_bp_t bp[PROTO_BP_MAX];
+	uint16_t hw;		/*!< Given the hardware breakpoint */
+	uint16_t age;		/*!< Count of breakpoints set */
+	uint16_t changes;	/*!< Requests that changed the plan */
+};
+
+/*!
+ * Return the entry for the breakpoint at `addr`, or NULL.
+ */
+static struct proto_bp_t* proto_bp_find(struct proto_bp_table_t* const bps,
+		uint16_t addr) {
+	uint8_t i;
+
+	for (i = 0; i < PROTO_BP_MAX; i++)
+		if (bps->bp[i].flags && (bps->bp[i].addr == addr))
+			return &bps->bp[i];
+	return NULL;
+}
+
+/*!
+ * Forget all breakpoints, as after the flash has been replaced wholesale.
+ */
+static void proto_bp_reset(struct proto_bp_table_t* const bps) {
+	memset(bps, 0, sizeof(*bps));
+	bps->hw = PROTO_BP_NONE;
+}
+
+/*!
+ * Record breakpoint `num` at `addr`.  Returns 0 if there is no room.
+ */
+static uint8_t proto_bp_set(struct proto_bp_table_t* const bps,
+		uint8_t num, uint16_t addr) {
+	struct proto_bp_t* bp = proto_bp_find(bps, addr);
+	uint8_t i;
+
+	for (i = 0; !bp && (i < PROTO_BP_MAX); i++) {
+		if (!bps->bp[i].flags) {
+			bp = &bps->bp[i];
+			bp->addr = addr;
+			bp->hits = 0;
+		}
+	}
+	if (!bp)
+		return 0;
+
+	if (!(bp->flags & PROTO_BP_FL_WANTED))
+		bps->changes++;
+	bp->flags |= PROTO_BP_FL_WANTED;
+	bp->num = num;
+	bp->age = ++bps->age;
+	return 1;
+}
+
+/*!
+ * Remove breakpoint `num` at `addr`.  Returns 0 if there was none.
+ */
+static uint8_t proto_bp_clear(struct proto_bp_table_t* const bps,
+		uint8_t num, uint16_t addr) {
+	struct proto_bp_t* const bp = proto_bp_find(bps, addr);
+
+	if (!bp || !(bp->flags & PROTO_BP_FL_WANTED) || (bp->num != num))
+		return 0;
+	bp->flags &= ~PROTO_BP_FL_WANTED;
+	if (!(bp->flags & PROTO_BP_FL_FLASH))
+		bp->flags = 0;
+	bps->changes++;
+	return 1;
+}
+
+/*!
+ * Remove all breakpoints the host has set.
+ */
+static void proto_bp_clear_all(struct proto_bp_table_t* const bps) {
+	uint8_t i;
+
+	for (i = 0; i < PROTO_BP_MAX; i++)
+		if (bps->bp[i].flags & PROTO_BP_FL_WANTED)
+			proto_bp_clear(bps, bps->bp[i].num, bps->bp[i].addr);
+}
+
+/*!
+ * Return the breakpoint the host set as `num`, or NULL.
+ */
+static struct proto_bp_t* proto_bp_get(struct proto_bp_table_t* const bps,
+		uint8_t num) {
+	uint8_t i;
+
+	for (i = 0; i < PROTO_BP_MAX; i++)
+		if ((bps->bp[i].flags & PROTO_BP_FL_WANTED)
+				&& (bps->bp[i].num == num))
+			return &bps->bp[i];
+	return NULL;
+}
+
+/*!
+ * Return the breakpoint hit most often (the most recently set of those
+ * hit equally often), or NULL if there are none.
+ */
+static struct proto_bp_t* proto_bp_favourite(
+		struct proto_bp_table_t* const bps) {
+	uint8_t i, j;
+
+	for (i = 0; i < PROTO_BP_MAX; i++) {
+		struct proto_bp_t* const bp = &bps->bp[i];
+
+		if (!(bp->flags & PROTO_BP_FL_WANTED))
+			continue;
+		for (j = 0; j < PROTO_BP_MAX; j++) {
+			const struct proto_bp_t* const other = &bps->bp[j];
+			if ((other->flags & PROTO_BP_FL_WANTED)
+					&& ((other->hits > bp->hits)
+						|| ((other->hits == bp->hits)
+						&& ((int16_t)(other->age
+							- bp->age) > 0))))
+				break;
+		}
+		if (j == PROTO_BP_MAX)
+			return bp;
+	}
+	return NULL;
+}
+
+/*!
+ * Decide where each breakpoint goes for a run starting at `pc`, which is
+ * to stop at `to` as well unless that is PROTO_BP_NONE.  A breakpoint at
+ * `pc` itself must not be a BREAK (the target would not get past it), so
+ * it gets the hardware breakpoint; otherwise that goes to `to`, or to the
+ * favourite.  The rest are marked to be placed in flash.
+ */
+static void proto_bp_plan(struct proto_bp_table_t* const bps, uint16_t pc,
+		uint16_t to) {
+	struct proto_bp_t* hw = proto_bp_find(bps, pc);
+	uint8_t i;
+
+	if (hw && !(hw->flags & PROTO_BP_FL_WANTED))
+		hw = NULL;
+	if (!hw && (to == PROTO_BP_NONE))
+		hw = proto_bp_favourite(bps);
+	bps->hw = hw ? hw->addr : to;
+
+	for (i = 0; i < PROTO_BP_MAX; i++) {
+		struct proto_bp_t* const bp = &bps->bp[i];
+		if ((bp->flags & PROTO_BP_FL_WANTED) && (bp->addr != bps->hw))
+			bp->flags |= PROTO_BP_FL_PLACE;
+		else
+			bp->flags &= ~PROTO_BP_FL_PLACE;
+	}
+}
+
+/*!
+ * Return the first breakpoint whose place in flash is to change, or NULL
+ * once the flash matches the plan.
+ */
+static struct proto_bp_t* proto_bp_pending(
+		struct proto_bp_table_t* const bps) {
+	uint8_t i;
+
+	for (i = 0; i < PROTO_BP_MAX; i++) {
+		struct proto_bp_t* const bp = &bps->bp[i];
+		if (bp->flags && !(bp->flags & PROTO_BP_FL_PLACE)
+				!= !(bp->flags & PROTO_BP_FL_FLASH))
+			return bp;
+	}
+	return NULL;
+}
+
+/*!
+ * Return a breakpoint to be placed in flash whose instruction is not known
+ * yet, or NULL.
+ */
+static struct proto_bp_t* proto_bp_unread(
+		struct proto_bp_table_t* const bps) {
+	uint8_t i;
+
+	for (i = 0; i < PROTO_BP_MAX; i++) {
+		struct proto_bp_t* const bp = &bps->bp[i];
+		if ((bp->flags & (PROTO_BP_FL_PLACE | PROTO_BP_FL_INSN))
+				== PROTO_BP_FL_PLACE)
+			return bp;
+	}
+	return NULL;
+}
+
+/*!
+ * Bring the `sz` bytes of flash page data from byte address `addr` in
+ * line with the plan: a BREAK for each breakpoint to be placed, and the
+ * instruction back for each to be taken out.  The bytes changed are
+ * marked in `valid`; the breakpoints are taken to be in flash as planned
+ * from here on.
+ */
+static void proto_bp_patch(struct proto_bp_table_t* const bps,
+		uint16_t addr, uint8_t* data, uint8_t* valid, uint16_t sz) {
+	uint8_t i;
+
+	for (i = 0; i < PROTO_BP_MAX; i++) {
+		struct proto_bp_t* const bp = &bps->bp[i];
+		uint16_t at = bp->addr * 2 - addr;
+		uint16_t word;
+
+		if (!bp->flags || (at >= sz))
+			continue;
+		if (bp->flags & PROTO_BP_FL_PLACE)
+			word = PROTO_BP_BREAK;
+		else if (bp->flags & PROTO_BP_FL_FLASH)
+			word = bp->insn;
+		else
+			continue;
+
+		data[at] = word;
+		data[at + 1] = word >> 8;
+		valid[at / 8] |= 3 << (at % 8);
+		if (bp->flags & PROTO_BP_FL_PLACE)
+			bp->flags |= PROTO_BP_FL_FLASH;
+		else if (bp->flags & PROTO_BP_FL_WANTED)
+			bp->flags &= ~PROTO_BP_FL_FLASH;
+		else
+			bp->flags = 0;
+	}
+}
+
+/*!
+ * Note that the target has stopped at `pc` after a run.  A BREAK stops it
+ * with the PC at or just after the breakpoint; returns the PC to report.
+ */
+static uint16_t proto_bp_hit(struct proto_bp_table_t* const bps,
+		uint16_t pc) {
+	uint8_t i;
+
+	for (i = 0; i < PROTO_BP_MAX; i++) {
+		struct proto_bp_t* const bp = &bps->bp[i];
+		if (!(bp->flags & PROTO_BP_FL_WANTED))
+			continue;
+		if ((bp->addr == pc) || ((bp->flags & PROTO_BP_FL_FLASH)
+					&& (bp->addr + 1 == pc))) {
+			if (bp->hits < 0xff)
+				bp->hits++;
+			return bp->addr;
+		}
+	}
+	return pc;
+}
+
+/*!
+ * Put back the instructions replaced by BREAKs in `sz` bytes of flash
+ * read from byte address `addr`.
+ */
+static void proto_bp_unpatch(const struct proto_bp_table_t* const bps,
+		uint16_t addr, uint8_t* data, uint16_t sz) {
+	uint8_t i;
+
+	for (i = 0; i < PROTO_BP_MAX; i++) {
+		const struct proto_bp_t* const bp = &bps->bp[i];
+		uint16_t at = bp->addr * 2;
+
+		if ((bp->flags & (PROTO_BP_FL_FLASH | PROTO_BP_FL_INSN))
+				!= (PROTO_BP_FL_FLASH | PROTO_BP_FL_INSN))
+			continue;
+		if ((uint16_t)(at - addr) < sz)
+			data[at - addr] = bp->insn;
+		if ((uint16_t)(at + 1 - addr) < sz)
+			data[at + 1 - addr] = bp->insn >> 8;
+	}
+}
+
+/*!
+ * Take the instructions under the BREAKs in flash into the words of page
+ * data `data`, from byte address `addr`, that the host wrote only half
+ * of, as marked in `valid`.  The rest of the page is read from the
+ * target, which holds half a BREAK there.
+ */
+static void proto_bp_complete(const struct proto_bp_table_t* const bps,
+		uint16_t addr, uint8_t* data, uint8_t* valid, uint16_t sz) {
+	uint8_t i;
+
+	for (i = 0; i < PROTO_BP_MAX; i++) {
+		const struct proto_bp_t* const bp = &bps->bp[i];
+		uint16_t at = bp->addr * 2 - addr;
+		uint8_t held;
+
+		if (((bp->flags & (PROTO_BP_FL_FLASH | PROTO_BP_FL_INSN))
+				!= (PROTO_BP_FL_FLASH | PROTO_BP_FL_INSN)) || (at >= sz))
+			continue;
+		held = (valid[at / 8] >> (at % 8)) & 3;
+		if (held == 1)
+			data[at + 1] = bp->insn >> 8;
+		else if (held == 2)
+			data[at] = bp->insn;
+		else
+			continue;
+		valid[at / 8] |= 3 << (at % 8);
+	}
+}
+
+/*!
+ * Note that the `sz` bytes of flash from byte address `addr` are being
+ * replaced with `data`, or erased if `data` is NULL.  Any BREAK there is
+ * gone, and the new contents are what it would replace; the half of an
+ * instruction not replaced stays as it was.
+ */
+static void proto_bp_replaced(struct proto_bp_table_t* const bps,
+		uint16_t addr, const uint8_t* data, uint16_t sz) {
+	uint8_t i;
+
+	for (i = 0; i < PROTO_BP_MAX; i++) {
+		struct proto_bp_t* const bp = &bps->bp[i];
+		uint16_t at = bp->addr * 2;
+		uint16_t low = at - addr, high = at + 1 - addr;
+
+		if (!bp->flags || ((low >= sz) && (high >= sz)))
+			continue;
+		if (low < sz)
+			bp->insn = (bp->insn & 0xff00) | (data ? data[low] : 0xff);
+		if (high < sz)
+			bp->insn = (bp->insn & 0x00ff)
+					| ((data ? data[high] : 0xff) << 8);
+		if ((low < sz) && (high < sz))
+			bp->flags |= PROTO_BP_FL_INSN;
+		bp->flags &= ~PROTO_BP_FL_FLASH;
+		if (!(bp->flags & PROTO_BP_FL_WANTED))
+			bp->flags = 0;
+	}
+}
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef _PROTOCOL_CACHE_H
+#define _PROTOCOL_CACHE_H
+
+/*!
+ * Cache of the target's registers and SRAM, valid while it is stopped.
+ *
+ * The register file and PC are taken whenever the target stops.  Other
+ * data space reads fill a few small lines, and writes update whatever is
+ * cached as they go through to the target.  I/O registers are not cached
+ * (reading some has side effects, and timers may be running) except for
+ * SP and SREG.  The whole lot is dropped as soon as the target runs.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROTO_CACHE_LINE_SZ	(16)	/*!< Bytes per line */
+#define PROTO_CACHE_LINES	(8)	/*!< Number of lines */
+
+/*! Longest read that fills the cache; longer ones would only thrash it */
+#define PROTO_CACHE_FILL_MAX	(PROTO_CACHE_LINE_SZ * PROTO_CACHE_LINES)
+
+#define PROTO_CACHE_REGS	(32)	/*!< Size of the register file */
+#define PROTO_CACHE_SP		(0x5d)	/*!< SPL, SPH (data space) */
+#define PROTO_CACHE_SREG	(0x5f)	/*!< SREG (data space) */
+
+#define PROTO_CACHE_FL_REGS	(1 << 0)	/*!< Register file valid */
+#define PROTO_CACHE_FL_PC	(1 << 1)	/*!< PC valid */
+
+/*!
+ * A line of cached data space.
+ */
+struct proto_cache_line_t {
+	uint16_t tag;		/*!< Address / PROTO_CACHE_LINE_SZ */
+	uint16_t valid;		/*!< Valid bytes: bit n for byte n */
+	uint8_t data[PROTO_CACHE_LINE_SZ];
+};
+
+/*!
+ * The cache.
+ */
+struct proto_cache_t {
+	uint8_t regs[PROTO_CACHE_REGS];	/*!< r0..r31 */
+	uint16_t pc;		/*!< PC (words) */
+	uint16_t sram_start;	/*!< Start of SRAM, 0 if not known */
+	uint8_t flags;		/*!< PROTO_CACHE_FL_* */
+	uint8_t victim;		/*!< Next line to replace */
+	struct proto_cache_line_t line[PROTO_CACHE_LINES];
+};
+
+/*!
+ * Forget everything cached.
+ */
+static void proto_cache_flush(struct proto_cache_t* const cache) {
+	uint8_t i;
+
+	cache->flags = 0;
+	for (i = 0; i < PROTO_CACHE_LINES; i++)
+		cache->line[i].valid = 0;
+}
+
+/*!
+ * Return non-zero if data space byte `addr` may be cached in a line.
+ */
+static uint8_t proto_cache_cacheable(const struct proto_cache_t* const cache,
+		uint16_t addr) {
+	if ((addr >= PROTO_CACHE_SP) && (addr <= PROTO_CACHE_SREG))
+		return 1;
+	return cache->sram_start && (addr >= cache->sram_start);
+}
+
+/*!
+ * Find the line holding `addr`, replacing one for it if `alloc` is set.
+ */
+static struct proto_cache_line_t* proto_cache_line(
+		struct proto_cache_t* const cache,
+		uint16_t addr, uint8_t alloc) {
+	uint16_t tag = addr / PROTO_CACHE_LINE_SZ;
+	struct proto_cache_line_t* line;
+	uint8_t i;
+
+	for (i = 0; i < PROTO_CACHE_LINES; i++) {
+		line = &cache->line[i];
+		if (line->valid && (line->tag == tag))
+			return line;
+	}
+	if (!alloc)
+		return NULL;
+
+	line = &cache->line[cache->victim];
+	cache->victim = (cache->victim + 1) % PROTO_CACHE_LINES;
+	line->tag = tag;
+	line->valid = 0;
+	return line;
+}
+
+/*!
+ * Look up data space byte `addr`.  Returns non-zero, with the byte in
+ * `*byte`, if it is cached.
+ */
+static uint8_t proto_cache_get(struct proto_cache_t* const cache,
+		uint16_t addr, uint8_t* byte) {
+	struct proto_cache_line_t* line;
+	uint8_t pos = addr % PROTO_CACHE_LINE_SZ;
+
+	if (addr < PROTO_CACHE_REGS) {
+		if (!(cache->flags & PROTO_CACHE_FL_REGS))
+			return 0;
+		*byte = cache->regs[addr];
+		return 1;
+	}
+	if (!proto_cache_cacheable(cache, addr))
+		return 0;
+
+	line = proto_cache_line(cache, addr, 0);
+	if (!line || !(line->valid & ((uint16_t)1 << pos)))
+		return 0;
+	*byte = line->data[pos];
+	return 1;
+}
+
+/*!
+ * Record data space byte `addr` as read from or written to the target.
+ * Bytes not already in a line are only added if `alloc` is set.
+ */
+static void proto_cache_put(struct proto_cache_t* const cache,
+		uint16_t addr, uint8_t byte, uint8_t alloc) {
+	struct proto_cache_line_t* line;
+	uint8_t pos = addr % PROTO_CACHE_LINE_SZ;
+
+	if (addr < PROTO_CACHE_REGS) {
+		if (cache->flags & PROTO_CACHE_FL_REGS)
+			cache->regs[addr] = byte;
+		return;
+	}
+	if (!proto_cache_cacheable(cache, addr))
+		return;
+
+	line = proto_cache_line(cache, addr, alloc);
+	if (!line)
+		return;
+	line->data[pos] = byte;
+	line->valid |= (uint16_t)1 << pos;
+}
+
+#endif
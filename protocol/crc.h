@@ -0,0 +1,69 @@
+#ifndef _PROTOCOL_CRC_H
+#define _PROTOCOL_CRC_H
+
+/*!
+ * JTAGICE mkII frame CRC.
+ *
+ * Frames end in a CRC-CCITT (reflected, polynomial 0x8408, initial value
+ * 0xffff) of everything before it, sent little-endian.  The CRC is folded
+ * in as bytes are received or emitted rather than over a buffered frame.
+ *
+ * By default this uses avr-libc's _crc_ccitt_update (no table, roughly
+ * 17 cycles per byte).  Building with PROTO_CRC_TABLE uses a 512-byte
+ * PROGMEM table instead, trading that flash for a few cycles per byte.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <stdint.h>
+
+#define PROTO_CRC_INIT	(0xffff)	/*!< Initial CRC value */
+
+#ifdef PROTO_CRC_TABLE
+#include <avr/pgmspace.h>
+
+/*! CRC lookup table, see protocol/crc.c */
+extern const uint16_t proto_crc_table[256] PROGMEM;
+
+/*!
+ * Fold one byte into the CRC.
+ */
+static uint16_t proto_crc_update(uint16_t crc, uint8_t byte) {
+	return (crc >> 8) ^ pgm_read_word(
+			&proto_crc_table[(uint8_t)(crc ^ byte)]);
+}
+#else
+#include <util/crc16.h>
+
+/*!
+ * Fold one byte into the CRC.
+ */
+static uint16_t proto_crc_update(uint16_t crc, uint8_t byte) {
+	return _crc_ccitt_update(crc, byte);
+}
+#endif
+
+/*!
+ * Fold `sz` bytes into the CRC.
+ */
+static uint16_t proto_crc_span(uint16_t crc, const uint8_t* data,
+		uint16_t sz) {
+	while (sz--)
+		crc = proto_crc_update(crc, *(data++));
+	return crc;
+}
+
+#endif
@@ -0,0 +1,777 @@
+/*!
+ * debugWIRE link to the target.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <string.h>
+#include <util/atomic.h>
+
+#include "protocol/interface.h"
+#include "protocol/debugwire.h"
+#include "util/timer.h"
+
+/* The protocol layer is not used in transparent (PASSTHROUGH) builds */
+#ifndef PASSTHROUGH
+
+/*! Steps of a transfer */
+#define DW_STEP_IDLE		(0)	/*!< Nothing in progress */
+#define DW_STEP_REGS		(1)	/*!< Register file part next */
+#define DW_STEP_SET_Z		(2)	/*!< Load Z next */
+#define DW_STEP_DATA		(3)	/*!< Memory via Z */
+#define DW_STEP_PROG		(4)	/*!< Programming flash */
+
+#define DW_FL_ZL		(1 << 0)	/*!< Low byte of z known */
+#define DW_FL_ZH		(1 << 1)	/*!< High byte of z known */
+#define DW_FL_Z_KNOWN		(DW_FL_ZL | DW_FL_ZH)
+#define DW_FL_Z_SET		(1 << 2)	/*!< Z moved: restore at end */
+#define DW_FL_WRITE		(1 << 3)	/*!< Transfer is a write */
+#define DW_FL_PC		(1 << 4)	/*!< PC has arrived */
+#define DW_FL_RUNNING		(1 << 5)	/*!< Target is running */
+#define DW_FL_STOPPED		(1 << 6)	/*!< Target has just stopped */
+#define DW_FL_SAVED		(1 << 7)	/*!< r0 to r2 known */
+#define DW_FL_SAVE_SET		(1 << 8)	/*!< r0 to r2 used: restore */
+#define DW_FL_SPM		(1 << 9)	/*!< Erase or write under way */
+#define DW_FL_SPM_SENT		(1 << 10)	/*!< ...and has left the FIFO */
+
+/*! Values captured from replies */
+#define DW_CAP_Z		(0)	/*!< Z (r30, r31) */
+#define DW_CAP_PC		(1)	/*!< PC (high byte first) */
+#define DW_CAP_SAVE		(2)	/*!< r0 to r2 */
+
+/*! Registers used for programming: r1:r0 data, r2 the SPM operation */
+#define DW_SAVE_REGS		(3)
+
+/* Instructions executed for programming */
+#define DW_OP_IN(reg, io)	(0xb000 | (((io) & 0x30) << 5) \
+					| ((reg) << 4) | ((io) & 0x0f))
+#define DW_OP_OUT(io, reg)	(0xb800 | (((io) & 0x30) << 5) \
+					| ((reg) << 4) | ((io) & 0x0f))
+#define DW_OP_SPM		(0x95e8)
+#define DW_OP_ADIW_Z_2		(0x9632)	/*!< adiw r30, 2 */
+
+/*! Offset of I/O space in data space */
+#define DW_IO_BASE		(0x20)
+
+/*! Bytes sent by dw_prog_load and dw_prog_spm */
+#define DW_PROG_LOAD_SZ		(18)
+#define DW_PROG_SPM_SZ		(11)
+
+/*! Shortest memory read worth a request, unless that is all there is */
+#define DW_CHUNK_MIN		(32)
+
+/*! Longest single memory write (PC runs to twice this) */
+#define DW_WRITE_MAX		(0x4000)
+
+/*! Z pointer: r31:r30 */
+#define DW_REG_Z		(30)
+
+/*! Size of the register file */
+#define DW_REGS			(32)
+
+/*!
+ * Length of a break: two characters' worth at the debugWIRE bit rate
+ * (a 128th of the target clock), in microseconds.
+ */
+#define DW_BREAK_US		((uint16_t)((20UL * 128UL * 1000000UL) \
+					/ DW_TARGET_F_CPU))
+
+static struct dw_state_t {
+	uint16_t addr;		/*!< Next address to request or send */
+	uint16_t left;		/*!< Bytes still to request or send */
+	uint16_t seg;		/*!< Bytes left in the write being sent */
+	uint16_t rd;		/*!< Address of the next byte consumed */
+	uint16_t z;		/*!< Target's Z pointer (DW_FL_ZL, DW_FL_ZH) */
+	uint16_t pc;		/*!< PC read from the target */
+	uint16_t boot;		/*!< PC from which SPM may be executed */
+	uint16_t flags;		/*!< DW_FL_* */
+	uint8_t save[DW_SAVE_REGS];	/*!< r0 to r2 (DW_FL_SAVED) */
+	uint8_t spmcsr;		/*!< SPMCSR (I/O space) */
+	uint8_t dwdr;		/*!< DWDR (I/O space) */
+	uint8_t cap[3];		/*!< Value being captured */
+	uint8_t cap_sz;		/*!< Size of it */
+	uint8_t capture;	/*!< Bytes of it still to come */
+	uint8_t cap_what;	/*!< DW_CAP_* */
+	uint8_t due;		/*!< Bytes requested and not yet consumed */
+	uint8_t seen;		/*!< Bytes received at the last look */
+	uint8_t space;		/*!< DW_SPACE_* */
+	uint8_t step;		/*!< DW_STEP_* */
+	struct timer_t timer;	/*!< Time-out timer */
+} dw;
+
+/*! Set up the link */
+void dw_init() {
+	proto_target_baud(DW_TARGET_F_CPU / 128);
+	dw_reset();
+}
+
+/*! Abandon whatever was in progress */
+void dw_reset() {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		timer_stop(&dw.timer);
+		timer_ack(&dw.timer);
+		/* Drop any reply still arriving */
+		fifo_empty(&proto_target_uart_rx);
+	}
+	dw.left = 0;
+	dw.seg = 0;
+	dw.due = 0;
+	dw.seen = 0;
+	dw.capture = 0;
+	dw.step = DW_STEP_IDLE;
+	dw.flags = 0;
+}
+
+/*! Handle the internal tick counter */
+void dw_tick() {
+	timer_tick(&dw.timer);
+}
+
+/*!
+ * Queue `sz` bytes for the target, if they all fit.
+ */
+static uint8_t dw_send(const uint8_t* cmd, uint8_t sz) {
+	struct fifo_t* const tx = &proto_target_uart_tx;
+	if ((uint8_t)(tx->total_sz - fifo_stored(tx)) < sz)
+		return 0;
+	fifo_write(tx, cmd, sz);
+	return 1;
+}
+
+/*!
+ * Queue a transfer in `mode` with PC running from `start` to `end`.
+ */
+static uint8_t dw_xfer(uint8_t mode, uint16_t start, uint16_t end) {
+	const uint8_t cmd[] = {
+		DW_CMD_CTX_RW,
+		DW_CMD_SET_PC, start >> 8, start,
+		DW_CMD_SET_BP, end >> 8, end,
+		DW_CMD_SET_RW, mode,
+		DW_CMD_RW
+	};
+	return dw_send(cmd, sizeof(cmd));
+}
+
+/*!
+ * Queue a write of `value` to Z.
+ */
+static uint8_t dw_write_z(uint16_t value) {
+	const uint8_t cmd[] = {
+		DW_CMD_CTX_RW,
+		DW_CMD_SET_PC, 0, DW_REG_Z,
+		DW_CMD_SET_BP, 0, DW_REG_Z + 2,
+		DW_CMD_SET_RW, DW_RW_REG_WRITE,
+		DW_CMD_RW,
+		value, value >> 8
+	};
+	return dw_send(cmd, sizeof(cmd));
+}
+
+/*!
+ * Account for `sz` more reply bytes being requested.
+ */
+static void dw_expect(uint8_t sz) {
+	dw.due += sz;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		timer_start(&dw.timer, DW_TIMEOUT_TICKS);
+	}
+}
+
+/*!
+ * Expect a `sz`-byte value in reply.
+ */
+static void dw_capture(uint8_t what, uint8_t sz) {
+	dw.cap_what = what;
+	dw.cap_sz = sz;
+	dw.capture = sz;
+	dw_expect(sz);
+}
+
+/*!
+ * Note register `reg` (as read or written) if it is part of Z, or one of
+ * those saved for programming.
+ */
+static void dw_note_reg(uint16_t reg, uint8_t value) {
+	if (reg < DW_SAVE_REGS) {
+		dw.save[reg] = value;
+	} else if (reg == DW_REG_Z) {
+		dw.z = (dw.z & 0xff00) | value;
+		dw.flags |= DW_FL_ZL;
+	} else if (reg == DW_REG_Z + 1) {
+		dw.z = (dw.z & 0x00ff) | ((uint16_t)value << 8);
+		dw.flags |= DW_FL_ZH;
+	}
+}
+
+/*!
+ * Take in the replies meant for this layer: captured values, and the
+ * sync byte the target sends as it stops.  Anything else is left for
+ * the transfer in progress.
+ */
+static void dw_collect(void) {
+	struct fifo_t* const rx = &proto_target_uart_rx;
+	uint8_t stored = fifo_stored(rx);
+
+	if ((dw.flags & (DW_FL_SPM | DW_FL_SPM_SENT)) == DW_FL_SPM) {
+		/* Time the erase or write from when the target has it */
+		if (!fifo_stored(&proto_target_uart_tx)) {
+			dw.flags |= DW_FL_SPM_SENT;
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				timer_start(&dw.timer, DW_SPM_TICKS);
+			}
+		}
+	} else if ((dw.flags & DW_FL_SPM)
+			&& (dw.timer.flags & TIMER_FLAG_EXPIRED)) {
+		/* The erase or write has had its time */
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			timer_ack(&dw.timer);
+		}
+		dw.flags &= ~(DW_FL_SPM | DW_FL_SPM_SENT);
+	}
+
+	if (stored != dw.seen) {
+		/* Progress: restart the time-out */
+		dw.seen = stored;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			timer_start(&dw.timer, DW_TIMEOUT_TICKS);
+		}
+	}
+
+	while (stored && (dw.capture || (dw.flags & DW_FL_RUNNING))) {
+		uint8_t byte = fifo_read_one(rx);
+		dw.seen--;
+		stored--;
+
+		if (dw.capture) {
+			dw.cap[dw.cap_sz - dw.capture] = byte;
+			dw.due--;
+			if (--dw.capture)
+				continue;
+			if (dw.cap_what == DW_CAP_Z) {
+				dw.z = dw.cap[0] | ((uint16_t)dw.cap[1] << 8);
+				dw.flags |= DW_FL_Z_KNOWN;
+			} else if (dw.cap_what == DW_CAP_SAVE) {
+				memcpy(dw.save, dw.cap, sizeof(dw.save));
+				dw.flags |= DW_FL_SAVED;
+			} else {
+				/* Reads back one past where it stopped */
+				dw.pc = ((dw.cap[0] << 8) | dw.cap[1]) - 1;
+				dw.flags |= DW_FL_PC;
+			}
+		} else if (byte == DW_SYNC) {
+			/* Anything before it is the break */
+			dw.flags &= ~DW_FL_RUNNING;
+			dw.flags |= DW_FL_STOPPED;
+			if (dw.due)
+				dw.due--;
+		}
+	}
+}
+
+/*!
+ * Return non-zero if a new request cannot be started.
+ */
+static uint8_t dw_busy(void) {
+	/* An erase or write may have had its time by now */
+	dw_collect();
+	return dw.due || (dw.step != DW_STEP_IDLE)
+		|| (dw.flags & (DW_FL_RUNNING | DW_FL_SPM));
+}
+
+/*!
+ * Start a transfer.  Z is read first if the transfer goes beyond the
+ * register file and its value is not already known.
+ */
+static uint8_t dw_begin(uint8_t space, uint16_t addr, uint16_t sz,
+		uint8_t flags) {
+	if (dw_busy())
+		return 0;
+
+	if (((space == DW_SPACE_FLASH) || ((uint32_t)addr + sz > DW_REGS))
+			&& ((dw.flags & DW_FL_Z_KNOWN) != DW_FL_Z_KNOWN)) {
+		if (!dw_xfer(DW_RW_REG_READ, DW_REG_Z, DW_REG_Z + 2))
+			return 0;
+		dw_capture(DW_CAP_Z, 2);
+	}
+
+	dw.space = space;
+	dw.addr = addr;
+	dw.rd = addr;
+	dw.left = sz;
+	dw.seg = 0;
+	dw.flags = (dw.flags & ~(DW_FL_Z_SET | DW_FL_WRITE)) | flags;
+	dw.step = DW_STEP_REGS;
+	return 1;
+}
+
+/*!
+ * Send the next request of a read, if the link is idle and the reply
+ * will fit in the receive FIFO.
+ */
+static void dw_next_read(void) {
+	uint8_t room = proto_target_uart_rx.total_sz - dw.due;
+	uint16_t sz;
+
+	if (dw.capture || (fifo_stored(&proto_target_uart_rx) != dw.due))
+		/* Reply still arriving */
+		return;
+
+	switch (dw.step) {
+	case DW_STEP_REGS:
+		if ((dw.space == DW_SPACE_SRAM) && (dw.addr < DW_REGS)) {
+			/* The register file is read directly, not via Z */
+			sz = DW_REGS - dw.addr;
+			if (sz > dw.left)
+				sz = dw.left;
+			if (sz > room)
+				return;
+			if (!dw_xfer(DW_RW_REG_READ, dw.addr, dw.addr + sz))
+				return;
+			dw.addr += sz;
+			dw.left -= sz;
+			dw.step = DW_STEP_SET_Z;
+			dw_expect(sz);
+			return;
+		}
+		dw.step = DW_STEP_SET_Z;
+		/* Fall through */
+	case DW_STEP_SET_Z:
+		if (!dw.left)
+			return;
+		if (!dw_write_z(dw.addr))
+			return;
+		dw.flags |= DW_FL_Z_SET;
+		dw.step = DW_STEP_DATA;
+		/* Fall through */
+	case DW_STEP_DATA:
+		if (!dw.left)
+			return;
+		sz = dw.left;
+		if (sz > room) {
+			if (room < DW_CHUNK_MIN)
+				/* Wait for the consumer to catch up */
+				return;
+			sz = room;
+		}
+		if (!dw_xfer((dw.space == DW_SPACE_FLASH)
+					? DW_RW_FLASH_READ : DW_RW_SRAM_READ,
+					0, sz * 2))
+			return;
+		dw.addr += sz;
+		dw.left -= sz;
+		dw_expect(sz);
+		return;
+	}
+}
+
+/*! Start reading `sz` bytes at `addr` in `space` */
+uint8_t dw_read_begin(uint8_t space, uint16_t addr, uint16_t sz) {
+	return dw_begin(space, addr, sz, 0);
+}
+
+/*! Return the bytes of the read that have arrived */
+uint8_t dw_read(uint8_t** span) {
+	dw_collect();
+	if (dw.capture)
+		return 0;
+
+	dw_next_read();
+	return fifo_read_reserve(&proto_target_uart_rx, span);
+}
+
+/*! Consume `sz` bytes returned by dw_read */
+void dw_read_commit(uint8_t sz) {
+	struct fifo_t* const rx = &proto_target_uart_rx;
+
+	if (dw.space == DW_SPACE_SRAM) {
+		/* Pick up Z and the saved registers if they pass by */
+		uint8_t i;
+		for (i = 0; (i < sz) && (dw.rd + i < DW_REGS); i++) {
+			uint8_t* span;
+			if ((dw.rd + i >= DW_SAVE_REGS)
+					&& (dw.rd + i < DW_REG_Z))
+				continue;
+			fifo_peek_reserve(rx, i, &span);
+			dw_note_reg(dw.rd + i, *span);
+		}
+	}
+
+	fifo_read_commit(rx, sz);
+	dw.rd += sz;
+	dw.due -= sz;
+	dw.seen -= sz;
+}
+
+/*!
+ * Send the header of the next part of a write.  Returns 0 if that cannot
+ * be done yet (or there is nothing left).
+ */
+static uint8_t dw_next_write(void) {
+	uint16_t sz;
+
+	if (dw.capture)
+		/* Still waiting for Z */
+		return 0;
+
+	switch (dw.step) {
+	case DW_STEP_REGS:
+		if (dw.addr < DW_REGS) {
+			sz = DW_REGS - dw.addr;
+			if (sz > dw.left)
+				sz = dw.left;
+			if (!dw_xfer(DW_RW_REG_WRITE, dw.addr, dw.addr + sz))
+				return 0;
+			dw.seg = sz;
+			dw.step = DW_STEP_SET_Z;
+			return 1;
+		}
+		dw.step = DW_STEP_SET_Z;
+		/* Fall through */
+	case DW_STEP_SET_Z:
+		if (!dw.left)
+			return 0;
+		if (!dw_write_z(dw.addr))
+			return 0;
+		dw.flags |= DW_FL_Z_SET;
+		dw.step = DW_STEP_DATA;
+		/* Fall through */
+	case DW_STEP_DATA:
+		if (!dw.left)
+			return 0;
+		sz = dw.left;
+		if (sz > DW_WRITE_MAX)
+			sz = DW_WRITE_MAX;
+		if (!dw_xfer(DW_RW_SRAM_WRITE, 1, sz * 2 + 1))
+			return 0;
+		dw.seg = sz;
+		return 1;
+	}
+	return 0;
+}
+
+/*! Start writing `sz` bytes at `addr` in SRAM */
+uint8_t dw_write_begin(uint16_t addr, uint16_t sz) {
+	return dw_begin(DW_SPACE_SRAM, addr, sz, DW_FL_WRITE);
+}
+
+/*! Send up to `sz` bytes of the write */
+uint16_t dw_write(const uint8_t* data, uint16_t sz) {
+	struct fifo_t* const tx = &proto_target_uart_tx;
+	uint16_t done = 0;
+
+	dw_collect();
+	while (sz) {
+		uint16_t run, i;
+
+		if (!dw.seg && !dw_next_write())
+			break;
+
+		run = (uint8_t)(tx->total_sz - fifo_stored(tx));
+		if (run > dw.seg)
+			run = dw.seg;
+		if (run > sz)
+			run = sz;
+		if (!run)
+			break;
+
+		/* A write to Z (or r0 to r2) changes what is put back */
+		for (i = 0; (i < run) && (dw.addr + i < DW_REGS); i++)
+			dw_note_reg(dw.addr + i, data[i]);
+
+		fifo_write(tx, data, run);
+		dw.addr += run;
+		dw.left -= run;
+		dw.seg -= run;
+		data += run;
+		sz -= run;
+		done += run;
+	}
+	return done;
+}
+
+/*! Finish a read, write or programming */
+uint8_t dw_end() {
+	dw_collect();
+	if (dw.flags & DW_FL_SPM)
+		/* The registers cannot be put back until it is done */
+		return 0;
+	if (dw.flags & DW_FL_SAVE_SET) {
+		uint8_t cmd[10 + DW_SAVE_REGS] = {
+			DW_CMD_CTX_RW,
+			DW_CMD_SET_PC, 0, 0,
+			DW_CMD_SET_BP, 0, DW_SAVE_REGS,
+			DW_CMD_SET_RW, DW_RW_REG_WRITE,
+			DW_CMD_RW
+		};
+		memcpy(&cmd[10], dw.save, sizeof(dw.save));
+		if (!dw_send(cmd, sizeof(cmd)))
+			return 0;
+		dw.flags &= ~DW_FL_SAVE_SET;
+	}
+	if ((dw.flags & DW_FL_Z_SET) && !dw_write_z(dw.z))
+		return 0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		timer_stop(&dw.timer);
+	}
+	dw.flags &= ~(DW_FL_Z_SET | DW_FL_WRITE);
+	dw.step = DW_STEP_IDLE;
+	return 1;
+}
+
+/*! Set the addresses used for programming */
+void dw_prog_setup(uint8_t spmcsr, uint8_t dwdr, uint16_t boot) {
+	dw.spmcsr = spmcsr - DW_IO_BASE;
+	dw.dwdr = dwdr - DW_IO_BASE;
+	dw.boot = boot;
+}
+
+/*! Start programming flash */
+uint8_t dw_prog_begin() {
+	if (dw_busy())
+		return 0;
+	dw.flags &= ~(DW_FL_Z_SET | DW_FL_WRITE);
+	dw.step = DW_STEP_PROG;
+	return 1;
+}
+
+/*!
+ * Make sure the registers programming uses are known, so they can be put
+ * back, and that any erase or write has finished.  Returns 0 until then.
+ */
+static uint8_t dw_prog_ready(void) {
+	dw_collect();
+	if (dw.capture || (dw.flags & DW_FL_SPM)
+			|| (dw.step != DW_STEP_PROG))
+		return 0;
+
+	if (!(dw.flags & DW_FL_SAVED)) {
+		if (dw_xfer(DW_RW_REG_READ, 0, DW_SAVE_REGS))
+			dw_capture(DW_CAP_SAVE, DW_SAVE_REGS);
+		return 0;
+	}
+	if ((dw.flags & DW_FL_Z_KNOWN) != DW_FL_Z_KNOWN) {
+		if (dw_xfer(DW_RW_REG_READ, DW_REG_Z, DW_REG_Z + 2))
+			dw_capture(DW_CAP_Z, 2);
+		return 0;
+	}
+	return 1;
+}
+
+/*!
+ * Queue loading Z with `addr` and r2 with `op`, leaving the target ready
+ * to execute instructions.  Returns 0 if there is not room.
+ */
+static uint8_t dw_prog_load(uint16_t addr, uint8_t op) {
+	const uint16_t in_r2 = DW_OP_IN(2, dw.dwdr);
+	const uint8_t cmd[] = {
+		DW_CMD_CTX_RW,
+		DW_CMD_SET_PC, 0, DW_REG_Z,
+		DW_CMD_SET_BP, 0, DW_REG_Z + 2,
+		DW_CMD_SET_RW, DW_RW_REG_WRITE,
+		DW_CMD_RW,
+		addr, addr >> 8,
+		DW_CMD_CTX_EXEC,
+		DW_CMD_SET_IR, in_r2 >> 8, in_r2, DW_CMD_EXEC, op
+	};
+
+	if (!dw_send(cmd, sizeof(cmd)))
+		return 0;
+	dw.flags |= DW_FL_Z_SET | DW_FL_SAVE_SET;
+	return 1;
+}
+
+/*!
+ * Queue executing SPM (with the operation in r2) from the boot section.
+ * Returns 0 if there is not room.
+ */
+static uint8_t dw_prog_spm(void) {
+	const uint16_t out = DW_OP_OUT(dw.spmcsr, 2);
+	const uint8_t cmd[] = {
+		DW_CMD_SET_PC, dw.boot >> 8, dw.boot,
+		DW_CMD_SET_IR, out >> 8, out, DW_CMD_EXEC,
+		DW_CMD_SET_IR, DW_OP_SPM >> 8, DW_OP_SPM & 0xff, DW_CMD_EXEC
+	};
+	return dw_send(cmd, sizeof(cmd));
+}
+
+/*! Perform an SPM operation on a page */
+uint8_t dw_spm(uint16_t addr, uint8_t op) {
+	struct fifo_t* const tx = &proto_target_uart_tx;
+
+	if (!dw_prog_ready())
+		return 0;
+	/* Both parts or neither */
+	if ((uint8_t)(tx->total_sz - fifo_stored(tx))
+			< (DW_PROG_LOAD_SZ + DW_PROG_SPM_SZ))
+		return 0;
+
+	dw_prog_load(addr, op);
+	dw_prog_spm();
+	if ((op == DW_SPM_ERASE) || (op == DW_SPM_WRITE)) {
+		/* Nothing else is accepted until it is done; dw_collect()
+		 * starts the time once the bytes have gone out */
+		dw.flags |= DW_FL_SPM;
+		dw.flags &= ~DW_FL_SPM_SENT;
+	}
+	return 1;
+}
+
+/*! Start filling the page buffer */
+uint8_t dw_fill_begin(uint16_t addr) {
+	if (!dw_prog_ready())
+		return 0;
+	return dw_prog_load(addr, DW_SPM_FILL);
+}
+
+/*! Load whole words into the page buffer */
+uint16_t dw_fill(const uint8_t* data, uint16_t sz) {
+	struct fifo_t* const tx = &proto_target_uart_tx;
+	const uint16_t in_r0 = DW_OP_IN(0, dw.dwdr);
+	const uint16_t in_r1 = DW_OP_IN(1, dw.dwdr);
+	uint16_t done = 0;
+
+	while ((sz - done) >= 2) {
+		const uint8_t word[] = {
+			DW_CMD_SET_IR, in_r0 >> 8, in_r0, DW_CMD_EXEC,
+			data[done],
+			DW_CMD_SET_IR, in_r1 >> 8, in_r1, DW_CMD_EXEC,
+			data[done + 1]
+		};
+		const uint8_t next[] = {
+			DW_CMD_SET_IR, DW_OP_ADIW_Z_2 >> 8,
+			DW_OP_ADIW_Z_2 & 0xff, DW_CMD_EXEC
+		};
+
+		if ((uint8_t)(tx->total_sz - fifo_stored(tx))
+				< (sizeof(word) + DW_PROG_SPM_SZ
+					+ sizeof(next)))
+			break;
+		dw_send(word, sizeof(word));
+		dw_prog_spm();
+		dw_send(next, sizeof(next));
+		done += 2;
+	}
+	return done;
+}
+
+/*! Ask the target for its PC */
+uint8_t dw_pc_begin() {
+	const uint8_t cmd[] = { DW_CMD_GET_PC };
+
+	if (dw_busy() || !dw_send(cmd, sizeof(cmd)))
+		return 0;
+	dw.flags &= ~DW_FL_PC;
+	dw_capture(DW_CAP_PC, 2);
+	return 1;
+}
+
+/*! Fetch the PC asked for with dw_pc_begin */
+uint8_t dw_pc(uint16_t* pc) {
+	dw_collect();
+	if (!(dw.flags & DW_FL_PC))
+		return 0;
+	dw.flags &= ~DW_FL_PC;
+	*pc = dw.pc;
+	return 1;
+}
+
+/*!
+ * Note that the target has been set running: its registers will change.
+ */
+static void dw_resumed(void) {
+	dw.flags &= ~(DW_FL_Z_KNOWN | DW_FL_SAVED | DW_FL_STOPPED);
+	dw.flags |= DW_FL_RUNNING;
+}
+
+/*!
+ * Run the target from `pc` with the given command.
+ */
+static uint8_t dw_run(uint16_t pc, uint8_t timers, uint16_t bp,
+		uint8_t run) {
+	const uint8_t cmd[] = {
+		DW_CMD_SET_BP, bp >> 8, bp,
+		DW_CMD_SET_PC, pc >> 8, pc,
+		DW_CMD_CTX_GO | (timers ? DW_CTX_TIMERS : 0)
+			| ((bp != DW_BP_NONE) ? DW_CTX_BP : 0),
+		run
+	};
+
+	if (dw_busy() || !dw_send(cmd, sizeof(cmd)))
+		return 0;
+	dw_resumed();
+	return 1;
+}
+
+/*! Run the target from `pc` */
+uint8_t dw_go(uint16_t pc, uint8_t timers, uint16_t bp) {
+	return dw_run(pc, timers, bp, DW_CMD_GO);
+}
+
+/*! Execute one instruction at `pc` */
+uint8_t dw_step(uint16_t pc, uint8_t timers) {
+	if (!dw_run(pc, timers, DW_BP_NONE, DW_CMD_STEP))
+		return 0;
+	/* It stops again straight away */
+	dw_expect(1);
+	return 1;
+}
+
+/*! Reset the target */
+uint8_t dw_target_reset() {
+	const uint8_t cmd[] = { DW_CMD_RESET };
+
+	if (dw_busy() || !dw_send(cmd, sizeof(cmd)))
+		return 0;
+	dw_resumed();
+	dw_expect(1);
+	return 1;
+}
+
+/*! Stop the target by sending a break */
+void dw_break() {
+	proto_target_break(DW_BREAK_US);
+	dw_resumed();
+	if (!dw.due)
+		dw_expect(1);
+}
+
+/*! Return non-zero (once) when the running target has stopped */
+uint8_t dw_stopped() {
+	dw_collect();
+	if (!(dw.flags & DW_FL_STOPPED))
+		return 0;
+	dw.flags &= ~DW_FL_STOPPED;
+	return 1;
+}
+
+/*! Return non-zero if the target is running */
+uint8_t dw_running() {
+	return dw.flags & DW_FL_RUNNING;
+}
+
+/*! Return non-zero if a step, break or reset is yet to complete */
+uint8_t dw_stopping() {
+	return (dw.flags & DW_FL_RUNNING) && dw.due;
+}
+
+/*! Return non-zero if the target has stopped answering */
+uint8_t dw_timed_out() {
+	dw_collect();
+	return (dw.timer.flags & TIMER_FLAG_EXPIRED)
+		&& (fifo_stored(&proto_target_uart_rx) < dw.due);
+}
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef _PROTOCOL_DEBUGWIRE_H
+#define _PROTOCOL_DEBUGWIRE_H
+
+/*!
+ * debugWIRE link to the target.
+ *
+ * Commands are queued to proto_target_uart_tx and replies collected from
+ * proto_target_uart_rx; nothing here waits on the target.  A memory read
+ * is requested in chunks no larger than the space free in the receive
+ * FIFO, so the reply can never overrun it however slowly the host
+ * drains the data.  The link is half-duplex: a request that draws a
+ * reply is the last thing sent until that reply is in.
+ *
+ * Memory is accessed through the target's Z pointer (r31:r30), which is
+ * read (unless already known) before it is moved and put back after.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <stdint.h>
+
+/*
+ * debugWIRE commands.  Memory and register file transfers are set up with
+ * SET_PC (start) and SET_BP (end), selecting the direction with SET_RW,
+ * then started with RW.  Addresses follow these high byte first.
+ */
+#define DW_CMD_RESET		(0x07)	/*!< Reset the target, which stops */
+#define DW_CMD_RW		(0x20)	/*!< Start the transfer */
+#define DW_CMD_EXEC		(0x23)	/*!< Execute the loaded instruction */
+#define DW_CMD_GO		(0x30)	/*!< Run from PC */
+#define DW_CMD_STEP		(0x31)	/*!< Execute one instruction at PC */
+#define DW_CMD_CTX_GO		(0x40)	/*!< Enter the run context */
+#define DW_CMD_CTX_EXEC		(0x64)	/*!< Enter the instruction context */
+#define DW_CMD_CTX_RW		(0x66)	/*!< Enter the transfer context */
+#define DW_CMD_SET_RW		(0xc2)	/*!< Set transfer mode (DW_RW_*) */
+#define DW_CMD_SET_PC		(0xd0)	/*!< Set PC (2) */
+#define DW_CMD_SET_BP		(0xd1)	/*!< Set breakpoint (2) */
+#define DW_CMD_SET_IR		(0xd2)	/*!< Load an instruction (2) */
+#define DW_CMD_GET_PC		(0xf0)	/*!< Read PC (2, high first) */
+
+#define DW_CTX_TIMERS		(0x20)	/*!< Run context: timers run too */
+#define DW_CTX_BP		(0x01)	/*!< Run context: stop at SET_BP */
+
+#define DW_BP_NONE		(0xffff)	/*!< No hardware breakpoint */
+
+#define DW_RW_SRAM_READ		(0x00)	/*!< Read SRAM at Z (PC += 2) */
+#define DW_RW_REG_READ		(0x01)	/*!< Read registers PC..BP-1 */
+#define DW_RW_FLASH_READ	(0x02)	/*!< Read flash at Z (PC += 2) */
+#define DW_RW_SRAM_WRITE	(0x04)	/*!< Write SRAM at Z (PC += 2) */
+#define DW_RW_REG_WRITE		(0x05)	/*!< Write registers PC..BP-1 */
+
+/*! Sent by the target (after a break) whenever it stops */
+#define DW_SYNC			(0x55)
+
+/* SPM operations for dw_spm: the value written to SPMCSR */
+#define DW_SPM_FILL		(0x01)	/*!< SPMEN: fill the page buffer */
+#define DW_SPM_ERASE		(0x03)	/*!< PGERS | SPMEN */
+#define DW_SPM_WRITE		(0x05)	/*!< PGWRT | SPMEN */
+#define DW_SPM_RWW		(0x11)	/*!< RWWSRE | SPMEN */
+
+/*! Address spaces for dw_read_begin and dw_write_begin */
+#define DW_SPACE_SRAM		(0)	/*!< Data space (from r0) */
+#define DW_SPACE_FLASH		(1)	/*!< Program memory (bytes) */
+
+/*!
+ * Target clock.  debugWIRE runs at a 128th of this; the link speed is
+ * not detected, so override this (-DDW_TARGET_F_CPU=...) to suit.
+ */
+#ifndef DW_TARGET_F_CPU
+#define DW_TARGET_F_CPU		(16000000UL)
+#endif
+
+/*! Number of ticks without progress before the target is given up on */
+#define DW_TIMEOUT_TICKS	(10)
+
+/*!
+ * Period of proto_tick() in microseconds.  Timer 1 runs 9-bit phase
+ * correct PWM from clk_io/64, so it overflows every 2 * 511 * 64 clocks
+ * (about 4.09 ms at 16 MHz).
+ */
+#define DW_TICK_US		(2UL * 511 * 64 * 1000 / (F_CPU / 1000))
+
+/*! Longest time the target takes to erase or write a page, in microseconds */
+#define DW_SPM_US		(4500)
+
+/*!
+ * Number of ticks allowed for a page erase or write.  The target does not
+ * say when it is done, and the first tick may come at once, so one tick
+ * more than the erase or write needs is allowed.
+ */
+#define DW_SPM_TICKS		((DW_SPM_US + DW_TICK_US - 1) / DW_TICK_US + 1)
+
+/*! Set up the link */
+void dw_init();
+
+/*! Abandon whatever was in progress, discarding any reply */
+void dw_reset();
+
+/*! Handle the internal tick counter */
+void dw_tick();
+
+/*!
+ * Start reading `sz` bytes at `addr` in `space`.  Returns 0 (and does
+ * nothing) if the link is busy or there is not yet room for the
+ * commands.
+ */
+uint8_t dw_read_begin(uint8_t space, uint16_t addr, uint16_t sz);
+
+/*!
+ * Return the number of bytes of the read that have arrived and may be
+ * taken from `*span` (contiguous), requesting more from the target as
+ * room allows.
+ */
+uint8_t dw_read(uint8_t** span);
+
+/*! Consume `sz` bytes returned by dw_read */
+void dw_read_commit(uint8_t sz);
+
+/*!
+ * Start writing `sz` bytes at `addr` in SRAM (data space).  Returns 0
+ * (and does nothing) if the link is busy.
+ */
+uint8_t dw_write_begin(uint16_t addr, uint16_t sz);
+
+/*!
+ * Send up to `sz` bytes of the write, returning how many were taken.
+ */
+uint16_t dw_write(const uint8_t* data, uint16_t sz);
+
+/*!
+ * Finish a read, write or programming once all bytes have been consumed
+ * or sent.  Returns 0 if there is not yet room to restore the target's
+ * registers.
+ */
+uint8_t dw_end();
+
+/*!
+ * Set the data space addresses of SPMCSR and DWDR, and a PC (words) in
+ * the boot section, from which SPM may be executed.
+ */
+void dw_prog_setup(uint8_t spmcsr, uint8_t dwdr, uint16_t boot);
+
+/*!
+ * Start programming flash.  r0 to r2 and Z are used, and put back by
+ * dw_end.  Returns 0 if the link is busy.
+ */
+uint8_t dw_prog_begin();
+
+/*!
+ * Perform SPM operation `op` (DW_SPM_*) on the page at byte address
+ * `addr`.  Returns 0 if it cannot be sent yet, including while an erase
+ * or write is still in progress.
+ */
+uint8_t dw_spm(uint16_t addr, uint8_t op);
+
+/*!
+ * Start filling the page buffer from byte address `addr`.  Returns 0 if
+ * this cannot be sent yet.
+ */
+uint8_t dw_fill_begin(uint16_t addr);
+
+/*!
+ * Load up to `sz` bytes (whole words) into the page buffer, returning
+ * how many were taken.
+ */
+uint16_t dw_fill(const uint8_t* data, uint16_t sz);
+
+/*! Ask the target for its PC.  Returns 0 if the link is busy. */
+uint8_t dw_pc_begin();
+
+/*!
+ * Fetch the PC (words) asked for with dw_pc_begin.  Returns 0 if it has
+ * not arrived yet.
+ */
+uint8_t dw_pc(uint16_t* pc);
+
+/*!
+ * Run the target from `pc` (words), with its timers if `timers` is set,
+ * stopping it at the hardware breakpoint `bp` (words) unless that is
+ * DW_BP_NONE.  Returns 0 if the link is busy.
+ */
+uint8_t dw_go(uint16_t pc, uint8_t timers, uint16_t bp);
+
+/*! Execute one instruction at `pc`.  Returns 0 if the link is busy. */
+uint8_t dw_step(uint16_t pc, uint8_t timers);
+
+/*! Reset the target.  Returns 0 if the link is busy. */
+uint8_t dw_target_reset();
+
+/*! Stop the running target by sending a break */
+void dw_break();
+
+/*! Return non-zero (once) when the running target has stopped */
+uint8_t dw_stopped();
+
+/*! Return non-zero if the target is running */
+uint8_t dw_running();
+
+/*! Return non-zero if the target is running but due to stop shortly */
+uint8_t dw_stopping();
+
+/*!
+ * Return non-zero if the target has stopped answering part way through
+ * a request; it is then to be abandoned with dw_reset.
+ */
+uint8_t dw_timed_out();
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _PROTOCOL_DEVICE_H
+#define _PROTOCOL_DEVICE_H
+
+/*!
+ * JTAGICE mkII device descriptor (SET_DEVICE_DESCRIPTOR).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <stdint.h>
+
+/*
+ * Offsets of the fields we use within the descriptor, which follows the
+ * command byte.  Multi-byte fields are little-endian.
+ */
+#define PROTO_DEV_SPMCR_ADDR		(241)	/*!< SPMCR address */
+#define PROTO_DEV_FLASH_PAGE_SZ		(247)	/*!< Flash page size (2) */
+#define PROTO_DEV_EEPROM_PAGE_SZ	(249)	/*!< EEPROM page size (1) */
+#define PROTO_DEV_FLASH_SZ		(252)	/*!< Flash size (4) */
+#define PROTO_DEV_DWDR_ADDR		(283)	/*!< DWDR address */
+#define PROTO_DEV_SRAM_START		(290)	/*!< SRAM start (2) */
+#define PROTO_DEV_SZ			(298)	/*!< Descriptor size */
+
+/*!
+ * Target device parameters, from the descriptor sent by the host.
+ */
+struct proto_device_t {
+	uint32_t flash_sz;		/*!< Flash size in bytes */
+	uint16_t flash_page_sz;		/*!< Flash page size in bytes */
+	uint16_t sram_start;		/*!< Start of SRAM */
+	uint8_t eeprom_page_sz;		/*!< EEPROM page size in bytes */
+	uint8_t spmcr_addr;		/*!< SPMCR address */
+	uint8_t dwdr_addr;		/*!< DWDR address */
+};
+
+#endif
@@ -24,7 +24,7 @@
 #include "util/fifo.h"
 
 /* External FIFO to host UART */
-extern struct fifo_t proto_host_uart_rx, proto_host_uart_tx;
+extern struct fifo16_t proto_host_uart_rx, proto_host_uart_tx;
 
 /*! External FIFO to target UART */
 extern struct fifo_t proto_target_uart_rx, proto_target_uart_tx;
@@ -32,9 +32,41 @@ extern struct fifo_t proto_target_uart_rx, proto_target_uart_tx;
 /*! Initialise the protocol handler */
 void proto_init();
 
+/*! Discard protocol state after the host FIFOs have been emptied */
+void proto_reset();
+
 /*! Handle the internal tick counter */
 void proto_tick();
 
+/*! Run any time-outs due; call from the main loop */
+void proto_task();
+
+#ifdef PROTO_STATS
+/*!
+ * Protocol statistics, maintained when built with PROTO_STATS defined.
+ */
+struct proto_stats_t {
+	uint32_t mem_hits;	/*!< SRAM reads answered from the cache */
+	uint32_t mem_misses;	/*!< SRAM reads sent to the target */
+	uint32_t pc_hits;	/*!< PC reads answered from the cache */
+	uint32_t pc_misses;	/*!< PC reads sent to the target */
+	uint32_t ahead_hits;	/*!< Reads answered from read-ahead */
+	uint32_t ahead_drops;	/*!< Read-aheads thrown away */
+	uint32_t pages_skipped;	/*!< Flash pages already up to date */
+	uint32_t pages_erased;	/*!< Flash page erases */
+	uint32_t pages_written;	/*!< Flash page writes */
+	uint32_t bp_pages;	/*!< Flash pages rewritten for breakpoints */
+	uint32_t bp_avoided;	/*!< Breakpoint changes needing no page */
+	uint32_t range_steps;	/*!< Single steps taken without the host */
+};
+
+/*!
+ * Copy the protocol statistics to `stats`, zeroing them if `reset` is
+ * set.
+ */
+void proto_stats(struct proto_stats_t* const stats, uint8_t reset);
+#endif
+
 /*!
  * Set the target baud rate: this needs to be implemented by the
  * application.
@@ -45,4 +77,10 @@ void proto_tick();
  */
 extern void proto_target_baud(uint32_t rate);
 
+/*!
+ * Send a break (hold the line low) to the target for `us` microseconds:
+ * this needs to be implemented by the application.
+ */
+extern void proto_target_break(uint16_t us);
+
 #endif
@@ -0,0 +1,38 @@
+#ifndef _PROTOCOL_MEMORY_H
+#define _PROTOCOL_MEMORY_H
+
+/*!
+ * JTAGICE mkII memory types (READ_MEMORY/WRITE_MEMORY).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* AVR067 Section 5.3.4 */
+
+#define PROTO_MEM_IO_SHADOW		(0x30)
+#define PROTO_MEM_SRAM			(0x20)
+#define PROTO_MEM_EEPROM		(0x22)
+#define PROTO_MEM_EVENT			(0x60)
+#define PROTO_MEM_SPM			(0xa0)
+#define PROTO_MEM_FLASH_PAGE		(0xb0)
+#define PROTO_MEM_EEPROM_PAGE		(0xb1)
+#define PROTO_MEM_FUSE_BITS		(0xb2)
+#define PROTO_MEM_LOCK_BITS		(0xb3)
+#define PROTO_MEM_SIGN_JTAG		(0xb4)
+#define PROTO_MEM_OSCCAL_BYTE		(0xb5)
+#define PROTO_MEM_CAN			(0xb6)
+
+#endif
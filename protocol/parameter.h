@@ -0,0 +1,67 @@
+#ifndef _PROTOCOL_PARAMETER_H
+#define _PROTOCOL_PARAMETER_H
+
+/*!
+ * JTAGICE mkII Protocol parameters (SET_PARAMETER/GET_PARAMETER).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/* AVR067 parameter IDs */
+
+#define PROTO_PAR_HW_VERSION			(0x01)
+#define PROTO_PAR_FW_VERSION			(0x02)
+#define PROTO_PAR_EMULATOR_MODE			(0x03)
+#define PROTO_PAR_IREG				(0x04)
+#define PROTO_PAR_BAUD_RATE			(0x05)
+#define PROTO_PAR_OCD_VTARGET			(0x06)
+#define PROTO_PAR_OCD_JTAG_CLK			(0x07)
+#define PROTO_PAR_OCD_BREAK_CAUSE		(0x08)
+#define PROTO_PAR_TIMERS_RUNNING		(0x09)
+#define PROTO_PAR_BREAK_ON_CHANGE_FLOW		(0x0a)
+#define PROTO_PAR_BREAK_ADDR1			(0x0b)
+#define PROTO_PAR_BREAK_ADDR2			(0x0c)
+#define PROTO_PAR_COMBBREAKCTRL			(0x0d)
+#define PROTO_PAR_JTAGID			(0x0e)
+#define PROTO_PAR_UNITS_BEFORE			(0x0f)
+#define PROTO_PAR_UNITS_AFTER			(0x10)
+#define PROTO_PAR_BIT_BEFORE			(0x11)
+#define PROTO_PAR_BIT_AFTER			(0x12)
+#define PROTO_PAR_EXTERNAL_RESET		(0x13)
+#define PROTO_PAR_FLASH_PAGE_SIZE		(0x14)
+#define PROTO_PAR_EEPROM_PAGE_SIZE		(0x15)
+#define PROTO_PAR_PSB0				(0x17)
+#define PROTO_PAR_PSB1				(0x18)
+#define PROTO_PAR_PROTOCOL_DEBUG_EVENT		(0x19)
+#define PROTO_PAR_MCU_STATE			(0x1a)
+#define PROTO_PAR_DAISY_CHAIN_INFO		(0x1b)
+#define PROTO_PAR_BOOT_ADDRESS			(0x1c)
+#define PROTO_PAR_TARGET_SIGNATURE		(0x1d)
+#define PROTO_PAR_DEBUGWIRE_BAUDRATE		(0x1e)
+#define PROTO_PAR_PROGRAM_ENTRY_POINT		(0x1f)
+
+/* PROTO_PAR_EMULATOR_MODE values */
+#define PROTO_EMULATOR_MODE_DEBUGWIRE		(0x00)
+#define PROTO_EMULATOR_MODE_JTAG		(0x01)
+#define PROTO_EMULATOR_MODE_HV			(0x02)
+#define PROTO_EMULATOR_MODE_SPI			(0x03)
+
+/* PROTO_PAR_MCU_STATE values */
+#define PROTO_MCU_STATE_STOPPED			(0x00)
+#define PROTO_MCU_STATE_RUNNING			(0x01)
+#define PROTO_MCU_STATE_PROGRAMMING		(0x02)
+
+#endif
@@ -1,10 +1,50 @@
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
 #include "protocol/interface.h"
+#include "protocol/crc.h"
 #include "protocol/state.h"
 #include "protocol/delimiter.h"
+#include "protocol/response.h"
+#include "protocol/command.h"
+#include "protocol/parameter.h"
+#include "protocol/device.h"
+#include "protocol/memory.h"
+#include "protocol/event.h"
+#include "protocol/cache.h"
+#include "protocol/breakpoint.h"
+#include "protocol/debugwire.h"
+
+/* The protocol layer is not used in transparent (PASSTHROUGH) builds */
+#ifndef PASSTHROUGH
 
 static struct proto_state_t state;
 
-static void host_rx_evth(struct fifo_t* const fifo, uint8_t events);
+/*! Target device parameters */
+static struct proto_device_t device;
+
+/*! Target state (PROTO_MCU_STATE_*) */
+static uint8_t mcu_state = PROTO_MCU_STATE_STOPPED;
+
+/*! Emulator settings */
+static uint8_t emulator_mode = PROTO_EMULATOR_MODE_DEBUGWIRE;
+static uint8_t timers_running = 0;
+
+/*! Target registers, PC and SRAM, kept while it is stopped */
+static struct proto_cache_t cache;
+
+/*! Breakpoints set by the host */
+static struct proto_bp_table_t bps;
+
+#ifdef PROTO_STATS
+static struct proto_stats_t counters;
+#define PROTO_STAT_INC(counter)	(counters.counter++)
+#else
+#define PROTO_STAT_INC(counter)
+#endif
+
+static void host_rx_evth(struct fifo16_t* const fifo, uint8_t events);
+static void host_tx_evth(struct fifo16_t* const fifo, uint8_t events);
 static void target_rx_evth(struct fifo_t* const fifo, uint8_t events);
 
 /*! Initialise the protocol handler */
@@ -12,17 +52,2284 @@ void proto_init() {
 	state.state = PROTO_STATE_START;
 	proto_host_uart_rx.consumer_evth = host_rx_evth;
 	proto_host_uart_rx.consumer_evtm = FIFO_EVT_NEW;
+	proto_host_uart_tx.producer_evth = host_tx_evth;
+	proto_host_uart_tx.producer_evtm = FIFO_EVT_EMPTY;
 	proto_target_uart_rx.consumer_evth = target_rx_evth;
 	proto_target_uart_rx.consumer_evtm = FIFO_EVT_NEW;
+	proto_bp_reset(&bps);
+	dw_init();
 }
 
 /*! Handle the internal tick counter */
 void proto_tick() {
 	timer_tick(&state.timer);
+	dw_tick();
+}
+
+/*! Frame header size: start, sequence (2), size (4), token */
+#define PROTO_HDR_SZ		(8)
+
+/*! Frame overhead: header and CRC (2 bytes) */
+#define PROTO_FRAME_OVERHEAD	(PROTO_HDR_SZ + 2)
+
+/*!
+ * Response size to pass to proto_rsp_begin when it is not known up
+ * front.  The header is then reserved and filled in by proto_rsp_end.
+ */
+#define PROTO_RSP_SZ_DEFER	(0xffff)
+
+/*!
+ * Largest response a non-streaming handler may send.  The dispatcher
+ * waits for this much room before calling the handler, so such handlers
+ * never have to back out part way.
+ */
+#define PROTO_RSP_MAX_SZ	(32)
+
+/*!
+ * Response being built.  There is only ever one, since responses go to
+ * the host in order.
+ */
+static struct proto_rsp_t {
+	uint16_t seq;		/*!< Sequence number */
+	uint16_t sz;		/*!< Message size or PROTO_RSP_SZ_DEFER */
+	uint16_t done;		/*!< Message bytes written so far */
+	uint16_t crc;		/*!< CRC so far (size known up front) */
+	uint8_t op;		/*!< Command being answered */
+} response;
+
+/*!
+ * Last response sent, if it was short.  A host that loses a response
+ * sends the command again with the same sequence number; it is answered
+ * from here rather than run twice.  The command byte must match too, so
+ * that a new command which happens to reuse the number is still run.
+ */
+static struct proto_last_t {
+	uint16_t seq;		/*!< Sequence number, or PROTO_SEQ_EVENT */
+	uint8_t op;		/*!< Command answered */
+	uint8_t sz;		/*!< Message size */
+	uint8_t body[PROTO_RSP_MAX_SZ];	/*!< Message */
+} last;
+
+/*! Stages of a memory read */
+#define PROTO_READ_IDLE		(0)	/*!< No read in progress */
+#define PROTO_READ_WAIT		(1)	/*!< Waiting for the first byte */
+#define PROTO_READ_DATA		(2)	/*!< Forwarding data */
+#define PROTO_READ_PAD		(3)	/*!< Target lost: padding */
+#define PROTO_READ_DONE		(4)	/*!< All data forwarded */
+#define PROTO_READ_END		(5)	/*!< Ending the response */
+
+/*!
+ * Memory read being forwarded from the target (READ_MEMORY).
+ */
+static struct proto_read_t {
+	uint16_t count;		/*!< Bytes asked for */
+	uint16_t left;		/*!< Bytes still to forward */
+	uint16_t addr;		/*!< Address of the next byte */
+	uint8_t space;		/*!< DW_SPACE_* */
+	uint8_t fill;		/*!< Allocate cache lines for the data */
+	uint8_t stage;		/*!< PROTO_READ_* */
+} mem_read;
+
+/*!
+ * Largest read repeated ahead of the host.  Bigger reads already spread
+ * the cost of setting up the transfer.
+ */
+#define PROTO_AHEAD_SZ		(64)
+
+/*! Stages of a read-ahead */
+#define PROTO_AHEAD_IDLE	(0)	/*!< Nothing read ahead */
+#define PROTO_AHEAD_FILL	(1)	/*!< Reading from the target */
+#define PROTO_AHEAD_DISCARD	(2)	/*!< Cancelled; draining the link */
+#define PROTO_AHEAD_READY	(3)	/*!< Data held for the host */
+
+/*!
+ * Read-ahead of the block following a run of sequential memory reads.
+ */
+static struct proto_ahead_t {
+	uint16_t addr;		/*!< Address of data[0] */
+	uint16_t end;		/*!< End of the last read by the host */
+	uint8_t space;		/*!< DW_SPACE_* of both */
+	uint8_t sz;		/*!< Bytes being read ahead */
+	uint8_t got;		/*!< Bytes of those arrived */
+	uint8_t stage;		/*!< PROTO_AHEAD_* */
+	uint8_t follow;		/*!< end/space are valid */
+	uint8_t data[PROTO_AHEAD_SZ];
+} ahead;
+
+/*! Stages of a memory write */
+#define PROTO_WRITE_IDLE	(0)	/*!< No write in progress */
+#define PROTO_WRITE_DATA	(1)	/*!< Passing data to the target */
+#define PROTO_WRITE_FLASH	(2)	/*!< Programming flash pages */
+#define PROTO_WRITE_END		(3)	/*!< Replying */
+
+/*!
+ * Memory write being passed to the target (WRITE_MEMORY).
+ */
+static struct proto_write_t {
+	uint16_t left;		/*!< Bytes still to send */
+	uint16_t addr;		/*!< Address of the next byte */
+	uint16_t offset;	/*!< Offset of the next byte in the message */
+	uint8_t stage;		/*!< PROTO_WRITE_* */
+	uint8_t rsp;		/*!< Response to send at the end */
+} mem_write;
+
+/*! Stages of programming one flash page */
+#define PROTO_PROG_COMPARE_BEGIN (0)	/*!< Asking for the page */
+#define PROTO_PROG_COMPARE	(1)	/*!< Comparing it with the new data */
+#define PROTO_PROG_BEGIN	(2)	/*!< Setting up for programming */
+#define PROTO_PROG_ERASE	(3)	/*!< Erasing the page */
+#define PROTO_PROG_FILL_BEGIN	(4)	/*!< Setting up the page buffer */
+#define PROTO_PROG_FILL		(5)	/*!< Loading the page buffer */
+#define PROTO_PROG_WRITE	(6)	/*!< Writing the page */
+#define PROTO_PROG_RWW		(7)	/*!< Re-enabling the RWW section */
+#define PROTO_PROG_END		(8)	/*!< Putting registers back */
+
+/*! Flash pages whose erased state can be remembered */
+#define PROTO_BLANK_PAGES	(256)
+
+/*!
+ * Flash programming.  A page is handed over to be programmed in the
+ * background, so the host can send the next one meanwhile; each page is
+ * read back first, and left alone if it already holds the new data.
+ * Pages known to be erased need no reading back, nor erasing again.
+ */
+static struct proto_prog_t {
+	uint16_t pos;		/*!< Bytes of the page compared or loaded */
+	uint16_t chip;		/*!< Next page of a CHIP_ERASE */
+	uint8_t stage;		/*!< PROTO_PROG_* */
+	uint8_t differ;		/*!< Page differs from the new data */
+	uint8_t erased;		/*!< Page on the target is blank */
+	uint8_t fill;		/*!< Page buffer being assembled */
+	uint8_t failed;		/*!< Failure to report from programming */
+	uint8_t blank[PROTO_BLANK_PAGES / 8];	/*!< Pages known erased */
+} prog;
+
+/*! Largest flash page that can be assembled (that of any debugWIRE part) */
+#define PROTO_PAGE_MAX		(128)
+
+/*! Page buffers: one assembled while the other is programmed */
+#define PROTO_PAGES		(2)
+
+/*! States of a page buffer */
+#define PROTO_PAGE_FREE		(0)	/*!< Not in use */
+#define PROTO_PAGE_FILL		(1)	/*!< Being assembled */
+#define PROTO_PAGE_QUEUED	(2)	/*!< To be (or being) programmed */
+
+/*!
+ * Flash page assembled from WRITE_MEMORY commands.  Hosts write in
+ * chunks that need not line up with pages, so the data is gathered here
+ * and each page programmed once: when it is complete, or when a write to
+ * another page (or any other command) comes along.  Bytes the host did
+ * not write are filled in from the read-back of the page.
+ */
+static struct proto_page_t {
+	uint16_t addr;		/*!< Byte address of the page */
+	uint8_t state;		/*!< PROTO_PAGE_* */
+	uint8_t erase;		/*!< Erase it without reading it back */
+	uint8_t valid[PROTO_PAGE_MAX / 8];	/*!< Bytes written by the host */
+	uint8_t data[PROTO_PAGE_MAX];
+} pages[PROTO_PAGES];
+
+/*!
+ * Words before the end of flash from which SPM is executed: inside the
+ * smallest boot section of any part, where SPM is always allowed.
+ */
+#define PROTO_SPM_PC_BACK	(64)
+
+/*! Stages of taking a snapshot of a stopped target */
+#define PROTO_STOP_NONE		(0)	/*!< Nothing to do */
+#define PROTO_STOP_PC_BEGIN	(1)	/*!< Asking for the PC */
+#define PROTO_STOP_PC		(2)	/*!< Waiting for the PC */
+#define PROTO_STOP_RANGE	(3)	/*!< Stepping on through a range */
+#define PROTO_STOP_REGS_BEGIN	(4)	/*!< Asking for the registers */
+#define PROTO_STOP_REGS		(5)	/*!< Reading the registers */
+#define PROTO_STOP_IO_BEGIN	(6)	/*!< Asking for SP and SREG */
+#define PROTO_STOP_IO		(7)	/*!< Reading SP and SREG */
+#define PROTO_STOP_EVENT	(8)	/*!< Telling the host it stopped */
+#define PROTO_STOP_LOST		(9)	/*!< Telling the host it was lost */
+
+/*!
+ * Most steps taken for one range step.  Commands wait meanwhile, so this
+ * keeps the wait to well under a second.
+ */
+#define PROTO_RANGE_STEPS	(256)
+
+/*! Stages of a target reset (CMND_RESET) */
+#define PROTO_RESET_IDLE	(0)	/*!< No reset in progress */
+#define PROTO_RESET_STOP	(1)	/*!< Stopping the target first */
+#define PROTO_RESET_WAIT	(2)	/*!< Waiting for it to come back */
+
+/*!
+ * Run control state of the target.
+ */
+static struct proto_target_t {
+	uint8_t stage;		/*!< PROTO_STOP_* */
+	uint8_t pos;		/*!< Bytes of the snapshot part read */
+	uint8_t report;		/*!< Send EVT_BREAK when it stops */
+	uint8_t failed;		/*!< It stopped answering */
+	uint8_t reset;		/*!< PROTO_RESET_* */
+	uint8_t run;		/*!< Set running by GO: may stop at a BREAK */
+	uint8_t step_off;	/*!< GO stepped off the hardware breakpoint */
+	uint8_t range;		/*!< Stepping until the PC leaves the range */
+	uint16_t steps;		/*!< Steps the range step may still take */
+	uint16_t start;		/*!< Range (words) */
+	uint16_t end;		/*!< End of range (words, exclusive) */
+} target;
+
+/*! Stages of bringing the flash in line with the breakpoints */
+#define PROTO_BPC_IDLE		(0)	/*!< Not reading anything */
+#define PROTO_BPC_INSN		(1)	/*!< Reading an instruction to replace */
+
+/*!
+ * Breakpoint commit, done when the target is next set running.
+ */
+static struct proto_bpc_t {
+	struct proto_bp_t* bp;	/*!< Breakpoint whose instruction is read */
+	uint8_t stage;		/*!< PROTO_BPC_* */
+	uint8_t pos;		/*!< Bytes of the instruction read */
+	uint8_t insn[2];	/*!< The instruction */
+	uint8_t pages;		/*!< Pages rewritten for this commit */
+	uint8_t held;		/*!< prog.failed from before those pages */
+} bp_commit;
+
+/*! Sequence number of event frames */
+#define PROTO_SEQ_EVENT		(0xffff)
+
+/*!
+ * Forget any frames received or queued.  Called once the host FIFOs have
+ * been emptied.
+ */
+void proto_reset() {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		timer_stop(&state.timer);
+	}
+	state.state = PROTO_STATE_START;
+	state.start = 0;
+	state.offset = 0;
+	state.tail = 0;
+	state.q_head = 0;
+	state.q_tail = 0;
+	mem_read.stage = PROTO_READ_IDLE;
+	ahead.stage = PROTO_AHEAD_IDLE;
+	ahead.follow = 0;
+	mem_write.stage = PROTO_WRITE_IDLE;
+	prog.stage = PROTO_PROG_COMPARE_BEGIN;
+	prog.fill = 0;
+	prog.failed = 0;
+	prog.chip = 0;
+	memset(prog.blank, 0, sizeof(prog.blank));
+	memset(pages, 0, sizeof(pages));
+	target.stage = PROTO_STOP_NONE;
+	target.reset = PROTO_RESET_IDLE;
+	target.report = 0;
+	target.run = 0;
+	target.step_off = 0;
+	target.range = 0;
+	bp_commit.stage = PROTO_BPC_IDLE;
+	bp_commit.pages = 0;
+	bp_commit.held = 0;
+	last.seq = PROTO_SEQ_EVENT;
+	/* Any BREAK left in flash comes out with the next run */
+	proto_bp_clear_all(&bps);
+	proto_cache_flush(&cache);
+	dw_reset();
+}
+
+/*!
+ * Fill in a frame header.
+ */
+static void proto_hdr(uint8_t* hdr, uint16_t seq, uint16_t sz) {
+	hdr[0] = PROTO_DELIM_START;
+	hdr[1] = seq;
+	hdr[2] = seq >> 8;
+	hdr[3] = sz;
+	hdr[4] = sz >> 8;
+	hdr[5] = 0;
+	hdr[6] = 0;
+	hdr[7] = PROTO_DELIM_TOKEN;
+}
+
+/*!
+ * Return the free space in the host transmit FIFO.
+ */
+static uint16_t proto_tx_free(void) {
+	return proto_host_uart_tx.total_sz
+		- fifo16_stored(&proto_host_uart_tx);
+}
+
+/*!
+ * Write `sz` bytes to the host, folding them into `crc` as they are
+ * copied.  The caller checks there is room first.
+ */
+static void proto_put(const uint8_t* data, uint16_t sz, uint16_t* crc) {
+	while (sz) {
+		uint8_t* span;
+		uint16_t run = fifo16_write_reserve(&proto_host_uart_tx, &span);
+		uint16_t i;
+		if (!run)
+			break;
+		if (run > sz)
+			run = sz;
+
+		for (i = 0; i < run; i++) {
+			span[i] = data[i];
+			*crc = proto_crc_update(*crc, data[i]);
+		}
+		fifo16_write_commit(&proto_host_uart_tx, run);
+		data += run;
+		sz -= run;
+	}
+}
+
+/*!
+ * Copy `sz` bytes into the host transmit FIFO, `offset` bytes past the
+ * write pointer, without publishing them.
+ */
+static void proto_poke(uint16_t offset, const uint8_t* data, uint16_t sz) {
+	while (sz) {
+		uint8_t* span;
+		uint16_t run = fifo16_poke_reserve(&proto_host_uart_tx,
+				offset, &span);
+		if (!run)
+			break;
+		if (run > sz)
+			run = sz;
+
+		memcpy(span, data, run);
+		data += run;
+		offset += run;
+		sz -= run;
+	}
+}
+
+/*!
+ * Start a response to command `seq`.  If the message size `sz` is known,
+ * the header is sent straight away and the message follows as it is
+ * written, so the host can start on a long response before its end has
+ * been produced.  Otherwise (PROTO_RSP_SZ_DEFER) the header is reserved,
+ * the message is held back, and both are sent by proto_rsp_end; such a
+ * response may be abandoned simply by not ending it.  Returns 0 (and
+ * does nothing) if there is not room for the header.
+ */
+static uint8_t proto_rsp_begin(uint16_t seq, uint16_t sz) {
+	if (proto_tx_free() < PROTO_FRAME_OVERHEAD)
+		return 0;
+
+	if ((seq != PROTO_SEQ_EVENT)
+			&& ((seq != last.seq) || (response.op != last.op)))
+		/* A new response replaces the one kept */
+		last.seq = PROTO_SEQ_EVENT;
+	response.seq = seq;
+	response.sz = sz;
+	response.done = 0;
+	response.crc = PROTO_CRC_INIT;
+	if (sz != PROTO_RSP_SZ_DEFER) {
+		uint8_t hdr[PROTO_HDR_SZ];
+		proto_hdr(hdr, seq, sz);
+		proto_put(hdr, sizeof(hdr), &response.crc);
+	}
+	return 1;
+}
+
+/*!
+ * Return how many more message bytes may be written right now.
+ */
+static uint16_t proto_rsp_room(void) {
+	uint16_t room = proto_tx_free();
+
+	if (response.sz == PROTO_RSP_SZ_DEFER) {
+		/* Held back: leave room for the header and CRC too */
+		uint16_t used = PROTO_FRAME_OVERHEAD + response.done;
+		return (room > used) ? (room - used) : 0;
+	}
+
+	if (room > (response.sz - response.done))
+		room = response.sz - response.done;
+	return room;
+}
+
+/*!
+ * Append `sz` bytes to the response.  The caller checks proto_rsp_room
+ * first.
+ */
+static void proto_rsp_put(const uint8_t* data, uint16_t sz) {
+	if ((response.seq != PROTO_SEQ_EVENT) && (response.seq != last.seq)
+			&& ((response.done + sz) <= sizeof(last.body)))
+		memcpy(&last.body[response.done], data, sz);
+	if (response.sz == PROTO_RSP_SZ_DEFER)
+		proto_poke(PROTO_HDR_SZ + response.done, data, sz);
+	else
+		proto_put(data, sz, &response.crc);
+	response.done += sz;
+}
+
+/*!
+ * Append one byte to the response.
+ */
+static void proto_rsp_put_byte(uint8_t byte) {
+	proto_rsp_put(&byte, 1);
+}
+
+/*!
+ * Keep the response just finished, if it is short enough to send again.
+ */
+static void proto_rsp_keep(void) {
+	if ((response.seq == PROTO_SEQ_EVENT)
+			|| (response.done > sizeof(last.body)))
+		return;
+	last.seq = response.seq;
+	last.op = response.op;
+	last.sz = response.done;
+}
+
+/*!
+ * Finish the response, sending the CRC (and for a held back response,
+ * the header and message).  Returns 0 if there is not yet room for the
+ * CRC, in which case it should be called again later.
+ */
+static uint8_t proto_rsp_end(void) {
+	uint8_t tail[2];
+
+	if (response.sz == PROTO_RSP_SZ_DEFER) {
+		uint8_t hdr[PROTO_HDR_SZ];
+		uint16_t len = PROTO_HDR_SZ + response.done;
+		uint16_t offset = 0;
+
+		/* Backfill the header, then CRC the frame in place */
+		proto_hdr(hdr, response.seq, response.done);
+		proto_poke(0, hdr, sizeof(hdr));
+		while (offset < len) {
+			uint8_t* span;
+			uint16_t run = fifo16_poke_reserve(&proto_host_uart_tx,
+					offset, &span);
+			if (!run)
+				break;
+			if (run > (len - offset))
+				run = len - offset;
+			response.crc = proto_crc_span(response.crc, span, run);
+			offset += run;
+		}
+
+		tail[0] = response.crc;
+		tail[1] = response.crc >> 8;
+		proto_poke(len, tail, sizeof(tail));
+		fifo16_write_commit(&proto_host_uart_tx, len + sizeof(tail));
+		proto_rsp_keep();
+		return 1;
+	}
+
+	if (proto_tx_free() < sizeof(tail))
+		return 0;
+	tail[0] = response.crc;
+	tail[1] = response.crc >> 8;
+	fifo16_write(&proto_host_uart_tx, tail, sizeof(tail));
+	proto_rsp_keep();
+	return 1;
+}
+
+/*!
+ * Send a short response frame to the host.  Returns 0 (and sends
+ * nothing) if there is not room for the whole frame.
+ */
+static uint8_t proto_send(uint16_t seq, const uint8_t* body, uint16_t sz) {
+	if (proto_tx_free() < (PROTO_FRAME_OVERHEAD + sz))
+		return 0;
+
+	proto_rsp_begin(seq, sz);
+	proto_rsp_put(body, sz);
+	return proto_rsp_end();
+}
+
+/*!
+ * Send a response consisting of just a response code.
+ */
+static uint8_t proto_reply(uint16_t seq, uint8_t rsp) {
+	return proto_send(seq, &rsp, sizeof(rsp));
+}
+
+/*!
+ * Copy `sz` bytes of the current message, starting `offset` bytes in,
+ * to `buffer`.  The caller has checked the message is long enough.
+ */
+static void proto_arg(uint16_t offset, uint8_t* buffer, uint16_t sz) {
+	while (sz) {
+		uint8_t* span;
+		uint16_t run = fifo16_peek_reserve(&proto_host_uart_rx,
+				offset, &span);
+		if (!run)
+			break;
+		if (run > sz)
+			run = sz;
+
+		memcpy(buffer, span, run);
+		buffer += run;
+		offset += run;
+		sz -= run;
+	}
 }
 
-static void host_rx_evth(struct fifo_t* const fifo, uint8_t events) {
+/*!
+ * Decode a little-endian 32-bit argument.
+ */
+static uint32_t proto_u32(const uint8_t* arg) {
+	return arg[0] | ((uint32_t)arg[1] << 8)
+		| ((uint32_t)arg[2] << 16) | ((uint32_t)arg[3] << 24);
+}
+
+/*!
+ * Command handler.  The message (`sz` bytes, command byte first) is at
+ * the head of proto_host_uart_rx.  Returns 0 if the command must be
+ * retried later, in which case it must not have sent anything.  Handlers
+ * flagged PROTO_CMND_FL_STREAM instead keep their own state, and carry on
+ * from where they left off when called again.
+ */
+typedef uint8_t (*proto_cmnd_fn)(uint16_t seq, uint16_t sz);
+
+#define PROTO_CMND_FL_STOPPED	(1 << 0)	/*!< Target must be stopped */
+#define PROTO_CMND_FL_STREAM	(1 << 1)	/*!< Handler streams its
+						  own (large) response */
+
+/*!
+ * Dispatch table entry.
+ */
+struct proto_cmnd_t {
+	proto_cmnd_fn handler;	/*!< Handler, NULL if not supported */
+	uint16_t min_sz;	/*!< Shortest valid message */
+	uint8_t flags;		/*!< PROTO_CMND_FL_* flags */
+};
+
+/*! Firmware version reported to the host (major, minor) */
+#define PROTO_FW_MAJOR		(7)
+#define PROTO_FW_MINOR		(0)
+
+/*!
+ * Target voltage reported to the host in mV.  The board cannot measure
+ * it; the target is assumed to run from the probe's USB supply.
+ */
+#define PROTO_VTARGET_MV	(5000)
+
+static uint8_t proto_cmnd_get_sign_on(uint16_t seq, uint16_t sz) {
+	static const uint8_t sign_on[] PROGMEM = {
+		PROTO_RSP_SIGN_ON,
+		0x01,					/* Protocol version */
+		0x00, PROTO_FW_MINOR, PROTO_FW_MAJOR, 0x00, /* Master MCU */
+		0x00, PROTO_FW_MINOR, PROTO_FW_MAJOR, 0x00, /* Slave MCU */
+		0, 0, 0, 0, 0, 0,			/* Serial number */
+		'J', 'T', 'A', 'G', 'I', 'C', 'E',
+		'm', 'k', 'I', 'I', 0
+	};
+	uint8_t i;
+
+	proto_rsp_begin(seq, sizeof(sign_on));
+	for (i = 0; i < sizeof(sign_on); i++)
+		proto_rsp_put_byte(pgm_read_byte(&sign_on[i]));
+	if (!proto_rsp_end())
+		return 0;
+	/* A new session may start its numbering anywhere */
+	last.seq = PROTO_SEQ_EVENT;
+	return 1;
+}
+
+static uint8_t proto_cmnd_get_sync(uint16_t seq, uint16_t sz) {
+	return proto_reply(seq, PROTO_RSP_OK);
+}
+
+static uint8_t proto_cmnd_set_parameter(uint16_t seq, uint16_t sz) {
+	uint8_t arg[3];
+	proto_arg(1, arg, (sz > 3) ? 3 : (sz - 1));
+
+	switch (arg[0]) {
+	case PROTO_PAR_EMULATOR_MODE:
+		if (arg[1] != PROTO_EMULATOR_MODE_DEBUGWIRE)
+			return proto_reply(seq, PROTO_RSP_ILLEGAL_EMULATOR_MODE);
+		emulator_mode = arg[1];
+		/* Attach: stop the target to take a snapshot of it */
+		dw_break();
+		target.report = 0;
+		break;
+	case PROTO_PAR_TIMERS_RUNNING:
+		timers_running = arg[1];
+		break;
+	case PROTO_PAR_BAUD_RATE:
+		/* Host link is USB: nothing to change */
+		break;
+	case PROTO_PAR_FLASH_PAGE_SIZE:
+		if (sz < 4)
+			return proto_reply(seq, PROTO_RSP_ILLEGAL_VALUE);
+		device.flash_page_sz = arg[1] | ((uint16_t)arg[2] << 8);
+		break;
+	case PROTO_PAR_EEPROM_PAGE_SIZE:
+		device.eeprom_page_sz = arg[1];
+		break;
+	default:
+		return proto_reply(seq, PROTO_RSP_ILLEGAL_PARAMETER);
+	}
+	return proto_reply(seq, PROTO_RSP_OK);
+}
+
+static uint8_t proto_cmnd_get_parameter(uint16_t seq, uint16_t sz) {
+	uint8_t param;
+	proto_arg(1, &param, 1);
+
+	/* Value size depends on the parameter */
+	proto_rsp_begin(seq, PROTO_RSP_SZ_DEFER);
+	proto_rsp_put_byte(PROTO_RSP_PARAMETER);
+
+	switch (param) {
+	case PROTO_PAR_HW_VERSION:
+		proto_rsp_put_byte(0x00);
+		break;
+	case PROTO_PAR_FW_VERSION:
+		proto_rsp_put_byte(PROTO_FW_MINOR);
+		proto_rsp_put_byte(PROTO_FW_MAJOR);
+		proto_rsp_put_byte(PROTO_FW_MINOR);
+		proto_rsp_put_byte(PROTO_FW_MAJOR);
+		break;
+	case PROTO_PAR_EMULATOR_MODE:
+		proto_rsp_put_byte(emulator_mode);
+		break;
+	case PROTO_PAR_OCD_VTARGET:
+		proto_rsp_put_byte((uint8_t)PROTO_VTARGET_MV);
+		proto_rsp_put_byte(PROTO_VTARGET_MV >> 8);
+		break;
+	case PROTO_PAR_TIMERS_RUNNING:
+		proto_rsp_put_byte(timers_running);
+		break;
+	case PROTO_PAR_FLASH_PAGE_SIZE:
+		proto_rsp_put_byte(device.flash_page_sz);
+		proto_rsp_put_byte(device.flash_page_sz >> 8);
+		break;
+	case PROTO_PAR_EEPROM_PAGE_SIZE:
+		proto_rsp_put_byte(device.eeprom_page_sz);
+		break;
+	case PROTO_PAR_MCU_STATE:
+		proto_rsp_put_byte(mcu_state);
+		break;
+	default:
+		/* Nothing was sent; just start a different response */
+		return proto_reply(seq, PROTO_RSP_ILLEGAL_PARAMETER);
+	}
+	return proto_rsp_end();
+}
+
+/*!
+ * Drop any read-ahead, and stop following the host's reads.  A transfer
+ * still running is left to drain off the link.
+ */
+static void proto_ahead_cancel(void) {
+	if (ahead.stage == PROTO_AHEAD_FILL) {
+		ahead.stage = PROTO_AHEAD_DISCARD;
+		PROTO_STAT_INC(ahead_drops);
+	} else if (ahead.stage == PROTO_AHEAD_READY) {
+		ahead.stage = PROTO_AHEAD_IDLE;
+		PROTO_STAT_INC(ahead_drops);
+	}
+	ahead.follow = 0;
+}
+
+/*!
+ * Note that the host has read `count` bytes at `addr`.  If that carries
+ * on from its last read, read the same amount again after it while the
+ * host deals with this one.  Registers and I/O space are never read
+ * ahead, since reading some I/O registers has side effects.
+ */
+static void proto_ahead_next(uint8_t space, uint16_t addr, uint16_t count) {
+	uint8_t follows = ahead.follow && (ahead.space == space)
+		&& (ahead.end == addr);
+	uint32_t end = (uint32_t)addr + count;
+	uint32_t limit;
+
+	ahead.space = space;
+	ahead.end = end;
+	ahead.follow = (end < 0x10000);
+	if (!follows || (count > PROTO_AHEAD_SZ)
+			|| (ahead.stage != PROTO_AHEAD_IDLE))
+		return;
+
+	if (space == DW_SPACE_SRAM) {
+		if (!device.sram_start || (addr < device.sram_start))
+			return;
+		limit = 0x10000;
+	} else {
+		limit = device.flash_sz ? device.flash_sz : 0x10000;
+	}
+	if ((end + count) > limit)
+		return;
+
+	if (!dw_read_begin(space, end, count))
+		return;
+	ahead.addr = end;
+	ahead.sz = count;
+	ahead.got = 0;
+	ahead.stage = PROTO_AHEAD_FILL;
+}
+
+/*!
+ * Collect read-ahead data as it arrives from the target.
+ */
+static void proto_ahead(void) {
+	uint8_t* span;
+	uint8_t run;
+
+	if ((ahead.stage != PROTO_AHEAD_FILL)
+			&& (ahead.stage != PROTO_AHEAD_DISCARD))
+		return;
+
+	if (dw_timed_out()) {
+		/* Nobody is waiting for it: just give up */
+		dw_reset();
+		ahead.stage = PROTO_AHEAD_IDLE;
+		return;
+	}
+
+	while ((ahead.got < ahead.sz) && (run = dw_read(&span))) {
+		if (ahead.stage == PROTO_AHEAD_FILL) {
+			memcpy(&ahead.data[ahead.got], span, run);
+			if (ahead.space == DW_SPACE_FLASH)
+				proto_bp_unpatch(&bps, ahead.addr + ahead.got,
+						&ahead.data[ahead.got], run);
+		}
+		dw_read_commit(run);
+		ahead.got += run;
+	}
+	if ((ahead.got < ahead.sz) || !dw_end())
+		return;
+	ahead.stage = (ahead.stage == PROTO_AHEAD_FILL)
+		? PROTO_AHEAD_READY : PROTO_AHEAD_IDLE;
+}
+
+/*!
+ * Answer a memory read from the read-ahead data.  The caller has checked
+ * that it is all there and that the response fits.
+ */
+static uint8_t proto_read_ahead(uint16_t seq, uint16_t addr, uint16_t count) {
+	const uint8_t* data = &ahead.data[addr - ahead.addr];
+	uint16_t i;
+
+	proto_rsp_begin(seq, 1 + count);
+	proto_rsp_put_byte(PROTO_RSP_MEMORY);
+	proto_rsp_put(data, count);
+	if (ahead.space == DW_SPACE_SRAM)
+		for (i = 0; i < count; i++)
+			proto_cache_put(&cache, addr + i, data[i], 1);
+	if (!proto_rsp_end())
+		return 0;
+
+	ahead.stage = PROTO_AHEAD_IDLE;
+	proto_ahead_next(ahead.space, addr, count);
+	return 1;
+}
+
+/*!
+ * Forward the data of a memory read to the host as it arrives from the
+ * target, without collecting it first.  The response is only started
+ * with the first byte, so that a target which does not answer at all
+ * can be reported as such.  Returns 0 until the response is complete.
+ */
+static uint8_t proto_read_stream(uint16_t seq) {
+	for (;;) {
+		uint8_t* span;
+		uint16_t room;
+		uint8_t run;
+
+		switch (mem_read.stage) {
+		case PROTO_READ_WAIT:
+		case PROTO_READ_DATA:
+			run = dw_read(&span);
+			if (!run) {
+				if (!dw_timed_out())
+					return 0;
+				if (mem_read.stage == PROTO_READ_WAIT) {
+					if (!proto_reply(seq,
+						PROTO_RSP_DEBUGWIRE_SYNC_FAILED))
+						return 0;
+					dw_reset();
+					mem_read.stage = PROTO_READ_IDLE;
+					return 1;
+				}
+				/* Stick to the length already sent */
+				dw_reset();
+				mem_read.stage = PROTO_READ_PAD;
+				break;
+			}
+
+			if (mem_read.stage == PROTO_READ_WAIT) {
+				if (!proto_rsp_begin(seq, 1 + mem_read.left))
+					return 0;
+				proto_rsp_put_byte(PROTO_RSP_MEMORY);
+				mem_read.stage = PROTO_READ_DATA;
+			}
+
+			room = proto_rsp_room();
+			if (!room)
+				return 0;
+			if (run > room)
+				run = room;
+			if (mem_read.space == DW_SPACE_FLASH)
+				proto_bp_unpatch(&bps, mem_read.addr,
+						span, run);
+			proto_rsp_put(span, run);
+			if (mem_read.space == DW_SPACE_SRAM) {
+				uint8_t i;
+				for (i = 0; i < run; i++)
+					proto_cache_put(&cache,
+						mem_read.addr + i, span[i],
+						mem_read.fill);
+			}
+			dw_read_commit(run);
+			mem_read.addr += run;
+			mem_read.left -= run;
+			if (!mem_read.left)
+				mem_read.stage = PROTO_READ_DONE;
+			break;
+		case PROTO_READ_PAD:
+			room = proto_rsp_room();
+			if (!room)
+				return 0;
+			mem_read.left -= room;
+			while (room--)
+				proto_rsp_put_byte(0xff);
+			if (!mem_read.left)
+				mem_read.stage = PROTO_READ_END;
+			break;
+		case PROTO_READ_DONE:
+			if (!dw_end())
+				return 0;
+			proto_ahead_next(mem_read.space,
+					mem_read.addr - mem_read.count,
+					mem_read.count);
+			mem_read.stage = PROTO_READ_END;
+			/* Fall through */
+		default:
+			if (!proto_rsp_end())
+				return 0;
+			mem_read.stage = PROTO_READ_IDLE;
+			return 1;
+		}
+	}
+}
+
+/*!
+ * Return non-zero if all `count` bytes of data space from `addr` are in
+ * the cache.
+ */
+static uint8_t proto_cache_hit(uint16_t addr, uint16_t count) {
+	uint8_t byte;
+
+	while (count--)
+		if (!proto_cache_get(&cache, addr++, &byte))
+			return 0;
+	return 1;
+}
+
+/*!
+ * Answer a memory read from the cache.  The caller has checked that it
+ * all hits and that the response fits.
+ */
+static uint8_t proto_read_cached(uint16_t seq, uint16_t addr,
+		uint16_t count) {
+	uint8_t byte;
+
+	proto_rsp_begin(seq, 1 + count);
+	proto_rsp_put_byte(PROTO_RSP_MEMORY);
+	while (count--) {
+		proto_cache_get(&cache, addr++, &byte);
+		proto_rsp_put_byte(byte);
+	}
+	return proto_rsp_end();
+}
+
+static uint8_t proto_cmnd_read_memory(uint16_t seq, uint16_t sz) {
+	if (mem_read.stage == PROTO_READ_IDLE) {
+		uint8_t arg[9];
+		uint32_t count, addr, limit;
+		uint8_t space;
+
+		proto_arg(1, arg, sizeof(arg));
+		count = proto_u32(&arg[1]);
+		addr = proto_u32(&arg[5]);
+
+		switch (arg[0]) {
+		case PROTO_MEM_SRAM:
+			space = DW_SPACE_SRAM;
+			limit = 0x10000;
+			break;
+		case PROTO_MEM_SPM:
+		case PROTO_MEM_FLASH_PAGE:
+			space = DW_SPACE_FLASH;
+			limit = device.flash_sz ? device.flash_sz : 0x10000;
+			break;
+		default:
+			return proto_reply(seq, PROTO_RSP_ILLEGAL_MEMORY_TYPE);
+		}
+
+		/* The response size (with its leading byte) is 16 bits */
+		if (!count || (count >= 0xffff) || (addr >= limit)
+				|| (count > (limit - addr)))
+			return proto_reply(seq, PROTO_RSP_ILLEGAL_MEMORY_RANGE);
+
+		if ((space == DW_SPACE_FLASH) && prog.failed) {
+			/* What is there is not what the host wrote */
+			if (!proto_reply(seq, prog.failed))
+				return 0;
+			prog.failed = 0;
+			return 1;
+		}
+
+		if (space == DW_SPACE_SRAM) {
+			if ((count <= PROTO_CACHE_FILL_MAX)
+					&& proto_cache_hit(addr, count)) {
+				if (proto_tx_free()
+					< (PROTO_FRAME_OVERHEAD + 1 + count))
+					return 0;
+				PROTO_STAT_INC(mem_hits);
+				return proto_read_cached(seq, addr, count);
+			}
+		}
+
+		if ((ahead.stage != PROTO_AHEAD_IDLE)
+				&& (ahead.stage != PROTO_AHEAD_DISCARD)
+				&& (ahead.space == space)
+				&& (addr >= ahead.addr)
+				&& ((addr + count) <= (ahead.addr + ahead.sz))) {
+			/* Read ahead, or on its way */
+			if ((ahead.stage != PROTO_AHEAD_READY)
+					|| (proto_tx_free() < (
+						PROTO_FRAME_OVERHEAD
+						+ 1 + count)))
+				return 0;
+			PROTO_STAT_INC(ahead_hits);
+			return proto_read_ahead(seq, addr, count);
+		}
+
+		if (ahead.stage != PROTO_AHEAD_IDLE) {
+			/* Not what was expected: the link is needed */
+			uint8_t follow = ahead.follow;
+			proto_ahead_cancel();
+			ahead.follow = follow;
+		}
+		if (!dw_read_begin(space, addr, count))
+			return 0;
+		if (space == DW_SPACE_SRAM)
+			PROTO_STAT_INC(mem_misses);
+		mem_read.count = count;
+		mem_read.left = count;
+		mem_read.addr = addr;
+		mem_read.space = space;
+		/* Small reads are the ones likely to be repeated */
+		mem_read.fill = (count <= PROTO_CACHE_FILL_MAX);
+		mem_read.stage = PROTO_READ_WAIT;
+	}
+	return proto_read_stream(seq);
+}
+
+static uint8_t proto_cmnd_set_device_descriptor(uint16_t seq, uint16_t sz) {
+	uint8_t arg[4];
+
+	proto_arg(1 + PROTO_DEV_SPMCR_ADDR, &device.spmcr_addr, 1);
+	proto_arg(1 + PROTO_DEV_FLASH_PAGE_SZ, arg, 3);
+	device.flash_page_sz = arg[0] | ((uint16_t)arg[1] << 8);
+	device.eeprom_page_sz = arg[2];
+	proto_arg(1 + PROTO_DEV_FLASH_SZ, arg, 4);
+	device.flash_sz = proto_u32(arg);
+	proto_arg(1 + PROTO_DEV_DWDR_ADDR, &device.dwdr_addr, 1);
+	proto_arg(1 + PROTO_DEV_SRAM_START, arg, 2);
+	device.sram_start = arg[0] | ((uint16_t)arg[1] << 8);
+	dw_prog_setup(device.spmcr_addr, device.dwdr_addr,
+			(device.flash_sz > (2 * PROTO_SPM_PC_BACK))
+			? (device.flash_sz / 2) - PROTO_SPM_PC_BACK : 0);
+	/* What was cached as I/O space may be SRAM, or vice versa */
+	proto_cache_flush(&cache);
+	proto_ahead_cancel();
+	cache.sram_start = device.sram_start;
+	/* Pages are numbered by the page size */
+	memset(prog.blank, 0, sizeof(prog.blank));
+	return proto_reply(seq, PROTO_RSP_OK);
+}
+
+/*!
+ * Return non-zero if the flash page at `addr` is known to be erased.
+ */
+static uint8_t proto_blank_test(uint16_t addr) {
+	uint16_t n = addr / device.flash_page_sz;
+	return (n < PROTO_BLANK_PAGES) && (prog.blank[n / 8] & (1 << (n % 8)));
+}
+
+/*!
+ * Note whether the flash page at `addr` is erased.
+ */
+static void proto_blank_set(uint16_t addr, uint8_t blank) {
+	uint16_t n = addr / device.flash_page_sz;
+
+	if (n >= PROTO_BLANK_PAGES)
+		return;
+	if (blank)
+		prog.blank[n / 8] |= 1 << (n % 8);
+	else
+		prog.blank[n / 8] &= ~(1 << (n % 8));
+}
+
+/*!
+ * Return non-zero if the data of page `pg` is all 0xff, which an erase
+ * alone leaves behind.
+ */
+static uint8_t proto_page_blank(const struct proto_page_t* const pg) {
+	uint8_t i;
+
+	for (i = 0; i < device.flash_page_sz; i++)
+		if (pg->data[i] != 0xff)
+			return 0;
+	return 1;
+}
+
+/*!
+ * Take `byte`, as held by the target at prog.pos, into the comparison
+ * with `pg`.
+ */
+static void proto_prog_byte(struct proto_page_t* const pg, uint8_t byte) {
+	if (!(pg->valid[prog.pos / 8] & (1 << (prog.pos % 8))))
+		pg->data[prog.pos] = byte;
+	else if (pg->data[prog.pos] != byte)
+		prog.differ = 1;
+	if (byte != 0xff)
+		prog.erased = 0;
+	prog.pos++;
+}
+
+/*!
+ * Compare the page being read back with `pg`, taking the bytes the host
+ * did not write from it.  A page known to be erased is not read back.
+ * Returns non-zero once the whole page has been compared.
+ */
+static uint8_t proto_prog_compare(struct proto_page_t* const pg) {
+	uint8_t* span;
+	uint8_t run;
+
+	if (proto_blank_test(pg->addr)) {
+		while (prog.pos < device.flash_page_sz)
+			proto_prog_byte(pg, 0xff);
+		return 1;
+	}
+
+	while ((prog.pos < device.flash_page_sz)
+			&& (run = dw_read(&span))) {
+		uint8_t i;
+
+		for (i = 0; i < run; i++)
+			proto_prog_byte(pg, span[i]);
+		dw_read_commit(run);
+	}
+	return (prog.pos == device.flash_page_sz) && dw_end();
+}
+
+/*!
+ * Program `pg`, unless the target already holds it.  Returns non-zero
+ * when done (or abandoned, with prog.failed saying why).
+ */
+static uint8_t proto_page_flush(struct proto_page_t* const pg) {
+	const uint16_t page_sz = device.flash_page_sz;
+
+	if (dw_timed_out()) {
+		dw_reset();
+		prog.stage = PROTO_PROG_COMPARE_BEGIN;
+		prog.failed = PROTO_RSP_DEBUGWIRE_SYNC_FAILED;
+		/* Abandon any CHIP_ERASE too */
+		prog.chip = 0;
+		return 1;
+	}
+
+	switch (prog.stage) {
+	case PROTO_PROG_COMPARE_BEGIN:
+		if (pg->erase) {
+			/* Erasing takes no longer than reading it back */
+			prog.erased = 0;
+			prog.stage = PROTO_PROG_BEGIN;
+			return 0;
+		}
+		if (!proto_blank_test(pg->addr)
+				&& !dw_read_begin(DW_SPACE_FLASH, pg->addr,
+					page_sz))
+			return 0;
+		prog.pos = 0;
+		prog.differ = 0;
+		prog.erased = 1;
+		prog.stage = PROTO_PROG_COMPARE;
+		/* Fall through */
+	case PROTO_PROG_COMPARE:
+		if (!proto_prog_compare(pg))
+			return 0;
+		if (prog.erased)
+			proto_blank_set(pg->addr, 1);
+		if (!prog.differ) {
+			PROTO_STAT_INC(pages_skipped);
+			break;
+		}
+		prog.stage = PROTO_PROG_BEGIN;
+		/* Fall through */
+	case PROTO_PROG_BEGIN:
+		if (!dw_prog_begin())
+			return 0;
+		prog.stage = PROTO_PROG_ERASE;
+		/* Fall through */
+	case PROTO_PROG_ERASE:
+		if (!prog.erased) {
+			if (!dw_spm(pg->addr, DW_SPM_ERASE))
+				return 0;
+			PROTO_STAT_INC(pages_erased);
+			proto_blank_set(pg->addr, 1);
+			prog.erased = 1;
+		}
+		if (proto_page_blank(pg)) {
+			/* That is all 0xff needs */
+			prog.stage = PROTO_PROG_RWW;
+			return 0;
+		}
+		prog.stage = PROTO_PROG_FILL_BEGIN;
+		/* Fall through */
+	case PROTO_PROG_FILL_BEGIN:
+		if (!dw_fill_begin(pg->addr))
+			return 0;
+		prog.pos = 0;
+		prog.stage = PROTO_PROG_FILL;
+		/* Fall through */
+	case PROTO_PROG_FILL:
+		prog.pos += dw_fill(&pg->data[prog.pos], page_sz - prog.pos);
+		if (prog.pos < page_sz)
+			/* Wait for room towards the target */
+			return 0;
+		prog.stage = PROTO_PROG_WRITE;
+		/* Fall through */
+	case PROTO_PROG_WRITE:
+		if (!dw_spm(pg->addr, DW_SPM_WRITE))
+			return 0;
+		PROTO_STAT_INC(pages_written);
+		proto_blank_set(pg->addr, 0);
+		prog.stage = PROTO_PROG_RWW;
+		/* Fall through */
+	case PROTO_PROG_RWW:
+		if (!dw_spm(pg->addr, DW_SPM_RWW))
+			return 0;
+		prog.stage = PROTO_PROG_END;
+		/* Fall through */
+	case PROTO_PROG_END:
+		if (!dw_end())
+			return 0;
+		break;
+	}
+
+	prog.stage = PROTO_PROG_COMPARE_BEGIN;
+	return 1;
+}
+
+/*!
+ * Hand the page being assembled over to be programmed, and start on the
+ * other buffer.  Returns 0 while that one is still being programmed.
+ */
+static uint8_t proto_page_queue(void) {
+	if (pages[prog.fill ^ 1].state != PROTO_PAGE_FREE)
+		return 0;
+	pages[prog.fill].state = PROTO_PAGE_QUEUED;
+	prog.fill ^= 1;
+	return 1;
+}
+
+/*!
+ * Return non-zero if the host has written all of page `pg`.
+ */
+static uint8_t proto_page_full(const struct proto_page_t* const pg) {
+	uint8_t i;
+
+	for (i = 0; i < (device.flash_page_sz / 8); i++)
+		if (pg->valid[i] != 0xff)
+			return 0;
+	return 1;
+}
+
+/*!
+ * Program the page handed over, if there is one, then hand over the
+ * next if it was completed meanwhile.
+ */
+static void proto_program(void) {
+	struct proto_page_t* const pg = &pages[prog.fill ^ 1];
+
+	if ((pg->state == PROTO_PAGE_QUEUED) && proto_page_flush(pg))
+		pg->state = PROTO_PAGE_FREE;
+	if ((pages[prog.fill].state == PROTO_PAGE_FILL)
+			&& proto_page_full(&pages[prog.fill]))
+		proto_page_queue();
+}
+
+/*!
+ * Hand over any page being assembled.  Returns non-zero once everything
+ * gathered has been programmed.
+ */
+static uint8_t proto_page_sync(void) {
+	if ((pages[prog.fill].state == PROTO_PAGE_FILL)
+			&& !proto_page_queue())
+		return 0;
+	return pages[prog.fill ^ 1].state == PROTO_PAGE_FREE;
+}
+
+/*!
+ * Return the response for a flash command: the failure of any earlier
+ * programming (which is then forgotten), or RSP_OK.  Programming runs in
+ * the background, so it can only be reported this late; it goes to the
+ * next command that writes, erases or reads flash.
+ */
+static uint8_t proto_prog_status(void) {
+	uint8_t rsp = prog.failed ? prog.failed : PROTO_RSP_OK;
+
+	prog.failed = 0;
+	return rsp;
+}
+
+/*!
+ * Gather the data of a flash WRITE_MEMORY into pages, handing over each
+ * page that is completed or left behind.  Returns non-zero once all the
+ * data is held here; it is programmed afterwards.
+ */
+static uint8_t proto_write_flash(void) {
+	const uint16_t page_sz = device.flash_page_sz;
+
+	for (;;) {
+		struct proto_page_t* const pg = &pages[prog.fill];
+		uint16_t base = mem_write.addr & ~(page_sz - 1);
+		uint16_t pos = mem_write.addr - base;
+		uint16_t run, i;
+
+		if ((pg->state == PROTO_PAGE_FILL) && (proto_page_full(pg)
+				|| (mem_write.left && (pg->addr != base)))) {
+			if (proto_page_queue())
+				continue;
+			if (mem_write.left)
+				/* Both buffers are in use */
+				return 0;
+		}
+		if (!mem_write.left)
+			return 1;
+
+		if (pg->state == PROTO_PAGE_FREE) {
+			pg->addr = base;
+			pg->erase = 0;
+			memset(pg->valid, 0, sizeof(pg->valid));
+			pg->state = PROTO_PAGE_FILL;
+		}
+		run = page_sz - pos;
+		if (run > mem_write.left)
+			run = mem_write.left;
+		proto_arg(mem_write.offset, &pg->data[pos], run);
+		for (i = 0; i < run; i++)
+			pg->valid[(pos + i) / 8] |= 1 << ((pos + i) % 8);
+		proto_bp_complete(&bps, base, pg->data, pg->valid, page_sz);
+		proto_bp_replaced(&bps, mem_write.addr, &pg->data[pos], run);
+		mem_write.addr += run;
+		mem_write.offset += run;
+		mem_write.left -= run;
+	}
+}
+
+/*!
+ * Return non-zero if the flash page size in the descriptor is one that
+ * pages can be assembled and erased in.
+ */
+static uint8_t proto_page_sz_ok(void) {
+	const uint16_t page_sz = device.flash_page_sz;
+	return (page_sz >= 8) && (page_sz <= PROTO_PAGE_MAX)
+		&& !(page_sz & (page_sz - 1));
+}
+
+/*!
+ * Hand the flash page at `addr` over to be erased, unless it is known to
+ * be already.  The page buffers must be free.
+ */
+static void proto_page_erase(uint16_t addr) {
+	struct proto_page_t* const pg = &pages[prog.fill];
+
+	proto_bp_replaced(&bps, addr, NULL, device.flash_page_sz);
+	if (proto_blank_test(addr)) {
+		PROTO_STAT_INC(pages_skipped);
+		return;
+	}
+	pg->addr = addr;
+	pg->erase = 1;
+	memset(pg->valid, 0xff, sizeof(pg->valid));
+	memset(pg->data, 0xff, sizeof(pg->data));
+	pg->state = PROTO_PAGE_FILL;
+	proto_page_queue();
+}
+
+static uint8_t proto_cmnd_write_memory(uint16_t seq, uint16_t sz) {
+	if (mem_write.stage == PROTO_WRITE_IDLE) {
+		uint8_t arg[9];
+		uint32_t count, addr, limit;
+
+		proto_arg(1, arg, sizeof(arg));
+		count = proto_u32(&arg[1]);
+		addr = proto_u32(&arg[5]);
+
+		switch (arg[0]) {
+		case PROTO_MEM_SRAM:
+			limit = 0x10000;
+			break;
+		case PROTO_MEM_SPM:
+		case PROTO_MEM_FLASH_PAGE:
+			/* Gathered into pages of the size in the descriptor */
+			limit = device.flash_sz ? device.flash_sz : 0x10000;
+			if (!proto_page_sz_ok())
+				return proto_reply(seq,
+						PROTO_RSP_ILLEGAL_MEMORY_RANGE);
+			break;
+		case PROTO_MEM_EEPROM:
+		case PROTO_MEM_EEPROM_PAGE:
+			/* No EEPROM write path over debugWIRE: refused, not
+			 * acknowledged and then never written */
+		default:
+			return proto_reply(seq, PROTO_RSP_ILLEGAL_MEMORY_TYPE);
+		}
+		if (!count || (count != (uint32_t)(sz - 10))
+				|| (addr >= limit)
+				|| (count > (limit - addr)))
+			return proto_reply(seq, PROTO_RSP_ILLEGAL_MEMORY_RANGE);
+
+		proto_ahead_cancel();
+		if (arg[0] == PROTO_MEM_SRAM) {
+			if (!dw_write_begin(addr, count))
+				return 0;
+			mem_write.stage = PROTO_WRITE_DATA;
+		} else {
+			mem_write.stage = PROTO_WRITE_FLASH;
+		}
+		mem_write.left = count;
+		mem_write.addr = addr;
+		mem_write.offset = 10;
+		mem_write.rsp = PROTO_RSP_OK;
+	}
+
+	if (mem_write.stage == PROTO_WRITE_FLASH) {
+		if (!proto_write_flash())
+			return 0;
+		mem_write.rsp = proto_prog_status();
+		mem_write.stage = PROTO_WRITE_END;
+	}
+
+	if (mem_write.stage == PROTO_WRITE_DATA) {
+		/* The data is passed on from the receive FIFO in place */
+		while (mem_write.left) {
+			uint8_t* span;
+			uint16_t run = fifo16_peek_reserve(&proto_host_uart_rx,
+					mem_write.offset, &span);
+			uint16_t done, i;
+
+			if (run > mem_write.left)
+				run = mem_write.left;
+			done = dw_write(span, run);
+			for (i = 0; i < done; i++)
+				proto_cache_put(&cache, mem_write.addr + i,
+						span[i], 0);
+			mem_write.addr += done;
+			mem_write.offset += done;
+			mem_write.left -= done;
+			if (done < run)
+				/* Wait for room towards the target */
+				return 0;
+		}
+		if (!dw_end())
+			return 0;
+		mem_write.stage = PROTO_WRITE_END;
+	}
+
+	if (!proto_reply(seq, mem_write.rsp))
+		return 0;
+	mem_write.stage = PROTO_WRITE_IDLE;
+	return 1;
+}
+
+static uint8_t proto_cmnd_erasepage_spm(uint16_t seq, uint16_t sz) {
+	uint8_t arg[4];
+	uint32_t addr;
+
+	proto_arg(1, arg, sizeof(arg));
+	addr = proto_u32(arg);
+	if (!proto_page_sz_ok() || (addr >= device.flash_sz))
+		return proto_reply(seq, PROTO_RSP_ILLEGAL_MEMORY_RANGE);
+
+	proto_ahead_cancel();
+	/* Erased in the background, like a page written */
+	proto_page_erase(addr & ~(device.flash_page_sz - 1));
+	return proto_reply(seq, proto_prog_status());
+}
+
+/*!
+ * debugWIRE has no chip erase, so every page not known to be erased
+ * already is erased in turn.  The page buffers are free each time this
+ * is called, so one page is handed over per call.
+ */
+static uint8_t proto_cmnd_chip_erase(uint16_t seq, uint16_t sz) {
+	if (!proto_page_sz_ok() || !device.flash_sz)
+		return proto_reply(seq, PROTO_RSP_ILLEGAL_MEMORY_RANGE);
+
+	proto_ahead_cancel();
+	while (prog.chip < device.flash_sz) {
+		uint16_t addr = prog.chip;
+
+		prog.chip += device.flash_page_sz;
+		if (!proto_blank_test(addr)) {
+			proto_page_erase(addr);
+			/* Wait for it */
+			return 0;
+		}
+	}
+	if (!proto_reply(seq, proto_prog_status()))
+		return 0;
+	prog.chip = 0;
+	return 1;
+}
+
+/*!
+ * Note that the target has been set running.  Everything cached is
+ * stale; `report` says whether the host is told when it stops.
+ */
+static void proto_resumed(uint8_t report) {
+	proto_cache_flush(&cache);
+	/* It may write its own flash */
+	memset(prog.blank, 0, sizeof(prog.blank));
+	mcu_state = PROTO_MCU_STATE_RUNNING;
+	target.report = report;
+	target.failed = 0;
+	target.run = 0;
+	target.range = 0;
+}
+
+/*!
+ * Make sure the PC is cached, asking the target for it if need be.
+ * Returns 1 once it is, 0 while waiting, or -1 if the target does not
+ * answer.
+ */
+static int8_t proto_need_pc(void) {
+	if (cache.flags & PROTO_CACHE_FL_PC)
+		return 1;
+	if (dw_pc(&cache.pc)) {
+		cache.flags |= PROTO_CACHE_FL_PC;
+		return 1;
+	}
+	if (dw_timed_out()) {
+		dw_reset();
+		return -1;
+	}
+	dw_pc_begin();
+	return 0;
+}
+
+/*!
+ * Bring the flash in line with the breakpoints for a run starting at
+ * `pc` (and stopping at `to`, see proto_bp_plan): read the instruction
+ * each new BREAK replaces, then rewrite the pages whose breakpoints
+ * changed, each once.  Returns 1 once done, 0 while waiting, or -1 if
+ * the target does not answer.
+ */
+static int8_t proto_bp_commit(uint16_t pc, uint16_t to) {
+	struct proto_bp_t* bp;
+
+	if (dw_timed_out()) {
+		dw_reset();
+		if (bp_commit.pages && !prog.failed)
+			prog.failed = bp_commit.held;
+		bp_commit.held = 0;
+		bp_commit.pages = 0;
+		bp_commit.stage = PROTO_BPC_IDLE;
+		return -1;
+	}
+
+	if (bp_commit.stage == PROTO_BPC_IDLE)
+		proto_bp_plan(&bps, pc, to);
+	for (;;) {
+		uint8_t* span;
+		uint8_t run;
+
+		if (bp_commit.stage == PROTO_BPC_IDLE) {
+			bp = proto_bp_unread(&bps);
+			if (!bp)
+				break;
+			if (!dw_read_begin(DW_SPACE_FLASH, bp->addr * 2, 2))
+				return 0;
+			bp_commit.bp = bp;
+			bp_commit.pos = 0;
+			bp_commit.stage = PROTO_BPC_INSN;
+		}
+
+		while ((bp_commit.pos < 2) && (run = dw_read(&span))) {
+			if (run > (2 - bp_commit.pos))
+				run = 2 - bp_commit.pos;
+			memcpy(&bp_commit.insn[bp_commit.pos], span, run);
+			dw_read_commit(run);
+			bp_commit.pos += run;
+		}
+		if ((bp_commit.pos < 2) || !dw_end())
+			return 0;
+		bp = bp_commit.bp;
+		bp->insn = bp_commit.insn[0] | (bp_commit.insn[1] << 8);
+		bp->flags |= PROTO_BP_FL_INSN;
+		bp_commit.stage = PROTO_BPC_IDLE;
+	}
+
+	/* One page at a time, as the buffers come free */
+	while ((bp = proto_bp_pending(&bps))) {
+		struct proto_page_t* const pg = &pages[prog.fill];
+		const uint16_t page_sz = device.flash_page_sz;
+
+		if (!proto_page_sync())
+			return 0;
+		if (!bp_commit.pages) {
+			/* Keep the host's failures apart from these */
+			bp_commit.held = prog.failed;
+			prog.failed = 0;
+		}
+		pg->addr = (bp->addr * 2) & ~(page_sz - 1);
+		pg->erase = 0;
+		memset(pg->valid, 0, sizeof(pg->valid));
+		proto_bp_patch(&bps, pg->addr, pg->data, pg->valid, page_sz);
+		pg->state = PROTO_PAGE_FILL;
+		proto_page_queue();
+		bp_commit.pages++;
+		PROTO_STAT_INC(bp_pages);
+	}
+	if (!proto_page_sync())
+		return 0;
+	if (bp_commit.pages) {
+		uint8_t failed = prog.failed;
+
+		prog.failed = bp_commit.held;
+		bp_commit.held = 0;
+		if (failed) {
+			/* The breakpoints are not where they were meant to be */
+			bp_commit.pages = 0;
+			return -1;
+		}
+	}
+
+#ifdef PROTO_STATS
+	if (bps.changes > bp_commit.pages)
+		counters.bp_avoided += bps.changes - bp_commit.pages;
+#endif
+	bps.changes = 0;
+	bp_commit.pages = 0;
+	return 1;
+}
+
+static uint8_t proto_cmnd_set_break(uint16_t seq, uint16_t sz) {
+	uint8_t arg[7];
+	uint32_t addr;
+
+	proto_arg(1, arg, sizeof(arg));
+	addr = proto_u32(&arg[2]);
+	/* Only program memory breakpoints, recorded until the next run */
+	if ((arg[0] != PROTO_BP_TYPE_PROGRAM) || !proto_page_sz_ok()
+			|| (addr >= (device.flash_sz / 2))
+			|| !proto_bp_set(&bps, arg[1], addr))
+		return proto_reply(seq, PROTO_RSP_ILLEGAL_BREAKPOINT);
+	return proto_reply(seq, PROTO_RSP_OK);
+}
+
+static uint8_t proto_cmnd_clr_break(uint16_t seq, uint16_t sz) {
+	uint8_t arg[5];
+
+	proto_arg(1, arg, sizeof(arg));
+	if (!proto_bp_clear(&bps, arg[0], proto_u32(&arg[1])))
+		return proto_reply(seq, PROTO_RSP_ILLEGAL_BREAKPOINT);
+	return proto_reply(seq, PROTO_RSP_OK);
+}
+
+static uint8_t proto_cmnd_get_break(uint16_t seq, uint16_t sz) {
+	const struct proto_bp_t* bp;
+	uint8_t num;
+	uint8_t rsp[7];
+
+	proto_arg(1, &num, 1);
+	bp = proto_bp_get(&bps, num);
+	if (!bp)
+		return proto_reply(seq, PROTO_RSP_ILLEGAL_BREAKPOINT);
+
+	rsp[0] = PROTO_RSP_GET_BREAK;
+	rsp[1] = PROTO_BP_TYPE_PROGRAM;
+	rsp[2] = bp->addr;
+	rsp[3] = bp->addr >> 8;
+	rsp[4] = 0;
+	rsp[5] = 0;
+	rsp[6] = 0;	/* Mode */
+	return proto_send(seq, rsp, sizeof(rsp));
+}
+
+static uint8_t proto_cmnd_sign_off(uint16_t seq, uint16_t sz) {
+	/* Leave no BREAK behind in the flash (if the target will listen) */
+	proto_bp_clear_all(&bps);
+	if ((mcu_state == PROTO_MCU_STATE_STOPPED)
+			&& !proto_bp_commit(PROTO_BP_NONE, PROTO_BP_NONE))
+		return 0;
+	if (!proto_reply(seq, PROTO_RSP_OK))
+		return 0;
+	/* The next session numbers its commands afresh */
+	last.seq = PROTO_SEQ_EVENT;
+	return 1;
+}
+
+static uint8_t proto_cmnd_read_pc(uint16_t seq, uint16_t sz) {
+	uint8_t hit = cache.flags & PROTO_CACHE_FL_PC;
+	int8_t ok = proto_need_pc();
+	uint8_t rsp[5];
+
+	if (!ok)
+		return 0;
+	if (ok < 0)
+		return proto_reply(seq, PROTO_RSP_DEBUGWIRE_SYNC_FAILED);
+
+	if (hit)
+		PROTO_STAT_INC(pc_hits);
+	else
+		PROTO_STAT_INC(pc_misses);
+
+	rsp[0] = PROTO_RSP_PC;
+	rsp[1] = cache.pc;
+	rsp[2] = cache.pc >> 8;
+	rsp[3] = 0;
+	rsp[4] = 0;
+	return proto_send(seq, rsp, sizeof(rsp));
+}
+
+static uint8_t proto_cmnd_write_pc(uint16_t seq, uint16_t sz) {
+	uint8_t arg[4];
+
+	/* Passed to the target with the next GO or SINGLE_STEP */
+	proto_arg(1, arg, sizeof(arg));
+	cache.pc = proto_u32(arg);
+	cache.flags |= PROTO_CACHE_FL_PC;
+	return proto_reply(seq, PROTO_RSP_OK);
+}
+
+/*!
+ * Set the target running from the PC, to stop at the breakpoints and at
+ * `to` (words) unless that is PROTO_BP_NONE.
+ */
+static uint8_t proto_run(uint16_t seq, uint16_t to) {
+	int8_t ok;
+
+	proto_ahead_cancel();
+	if (target.step_off && target.failed) {
+		target.step_off = 0;
+		return proto_reply(seq, PROTO_RSP_DEBUGWIRE_SYNC_FAILED);
+	}
+	ok = proto_need_pc();
+	if (ok > 0)
+		ok = proto_bp_commit(cache.pc, to);
+	if (!ok)
+		return 0;
+	if (ok < 0)
+		return proto_reply(seq, PROTO_RSP_DEBUGWIRE_SYNC_FAILED);
+
+	if ((cache.pc == bps.hw) && !target.step_off) {
+		/* Step past the breakpoint first, then carry on from there */
+		if (!dw_step(cache.pc, timers_running))
+			return 0;
+		proto_resumed(0);
+		target.step_off = 1;
+		return 0;
+	}
+	if (!dw_go(cache.pc, timers_running, bps.hw))
+		return 0;
+	proto_resumed(1);
+	target.run = 1;
+	target.step_off = 0;
+	return proto_reply(seq, PROTO_RSP_OK);
+}
+
+static uint8_t proto_cmnd_go(uint16_t seq, uint16_t sz) {
+	return proto_run(seq, PROTO_BP_NONE);
+}
+
+static uint8_t proto_cmnd_run_to_addr(uint16_t seq, uint16_t sz) {
+	uint8_t arg[4];
+	uint32_t addr;
+
+	proto_arg(1, arg, sizeof(arg));
+	addr = proto_u32(arg);
+	if (addr >= (device.flash_sz / 2))
+		return proto_reply(seq, PROTO_RSP_ILLEGAL_PARAMETER);
+	/* Given the hardware breakpoint: nothing to write for it */
+	return proto_run(seq, addr);
+}
+
+/*!
+ * Single step.  Given a range of words as well (after the usual flag and
+ * step mode), the steps carry on here until the PC leaves the range, so a
+ * whole source line takes one command; see proto_range_more.
+ */
+static uint8_t proto_cmnd_single_step(uint16_t seq, uint16_t sz) {
+	int8_t ok;
+
+	proto_ahead_cancel();
+	ok = proto_need_pc();
+	if (ok > 0)
+		ok = proto_bp_commit(cache.pc, PROTO_BP_NONE);
+	if (!ok)
+		return 0;
+	if (ok < 0)
+		return proto_reply(seq, PROTO_RSP_DEBUGWIRE_SYNC_FAILED);
+	if (!dw_step(cache.pc, timers_running))
+		return 0;
+	proto_resumed(1);
+	if (sz >= 11) {
+		uint8_t arg[8];
+
+		proto_arg(3, arg, sizeof(arg));
+		target.start = proto_u32(arg);
+		target.end = proto_u32(&arg[4]);
+		target.steps = PROTO_RANGE_STEPS - 1;
+		target.range = 1;
+	}
+	return proto_reply(seq, PROTO_RSP_OK);
+}
+
+static uint8_t proto_cmnd_forced_stop(uint16_t seq, uint16_t sz) {
+	if (dw_running()) {
+		dw_break();
+		target.report = 1;
+	}
+	return proto_reply(seq, PROTO_RSP_OK);
+}
+
+static uint8_t proto_cmnd_reset(uint16_t seq, uint16_t sz) {
+	proto_ahead_cancel();
+	switch (target.reset) {
+	case PROTO_RESET_IDLE:
+		if (dw_running()) {
+			/* The target only listens once stopped */
+			dw_break();
+			target.report = 0;
+			target.reset = PROTO_RESET_STOP;
+			return 0;
+		}
+		/* Fall through */
+	case PROTO_RESET_STOP:
+		if (dw_running() || !dw_target_reset())
+			return 0;
+		proto_resumed(0);
+		target.reset = PROTO_RESET_WAIT;
+		return 0;
+	default:
+		if (dw_running())
+			return 0;
+	}
+
+	if (!proto_reply(seq, target.failed
+				? PROTO_RSP_DEBUGWIRE_SYNC_FAILED
+				: PROTO_RSP_OK))
+		return 0;
+	target.reset = PROTO_RESET_IDLE;
+	return 1;
+}
+
+/*!
+ * Command dispatch table, indexed by command byte.  Commands without a
+ * handler are answered with RSP_ILLEGAL_COMMAND.
+ */
+static const struct proto_cmnd_t proto_cmnd_table[] PROGMEM = {
+	[PROTO_CMND_SIGN_OFF] = {
+		proto_cmnd_sign_off, 1, 0 },
+	[PROTO_CMND_GET_SIGN_ON] = {
+		proto_cmnd_get_sign_on, 1, 0 },
+	[PROTO_CMND_SET_PARAMETER] = {
+		proto_cmnd_set_parameter, 3, 0 },
+	[PROTO_CMND_GET_PARAMETER] = {
+		proto_cmnd_get_parameter, 2, 0 },
+	[PROTO_CMND_WRITE_MEMORY] = {
+		proto_cmnd_write_memory, 10,
+		PROTO_CMND_FL_STOPPED | PROTO_CMND_FL_STREAM },
+	[PROTO_CMND_READ_MEMORY] = {
+		proto_cmnd_read_memory, 10,
+		PROTO_CMND_FL_STOPPED | PROTO_CMND_FL_STREAM },
+	[PROTO_CMND_WRITE_PC] = {
+		proto_cmnd_write_pc, 5, PROTO_CMND_FL_STOPPED },
+	[PROTO_CMND_READ_PC] = {
+		proto_cmnd_read_pc, 1, PROTO_CMND_FL_STOPPED },
+	[PROTO_CMND_GO] = {
+		proto_cmnd_go, 1, PROTO_CMND_FL_STOPPED },
+	[PROTO_CMND_SINGLE_STEP] = {
+		proto_cmnd_single_step, 1, PROTO_CMND_FL_STOPPED },
+	[PROTO_CMND_FORCED_STOP] = {
+		proto_cmnd_forced_stop, 1, 0 },
+	[PROTO_CMND_RESET] = {
+		proto_cmnd_reset, 1, 0 },
+	[PROTO_CMND_SET_DEVICE_DESCRIPTOR] = {
+		proto_cmnd_set_device_descriptor, 1 + PROTO_DEV_SZ,
+		PROTO_CMND_FL_STOPPED },
+	[PROTO_CMND_ERASEPAGE_SPM] = {
+		proto_cmnd_erasepage_spm, 5, PROTO_CMND_FL_STOPPED },
+	[PROTO_CMND_GET_SYNC] = {
+		proto_cmnd_get_sync, 1, 0 },
+	[PROTO_CMND_SET_BREAK] = {
+		proto_cmnd_set_break, 8, 0 },
+	[PROTO_CMND_GET_BREAK] = {
+		proto_cmnd_get_break, 2, 0 },
+	[PROTO_CMND_CHIP_ERASE] = {
+		proto_cmnd_chip_erase, 1, PROTO_CMND_FL_STOPPED },
+	[PROTO_CMND_CLR_BREAK] = {
+		proto_cmnd_clr_break, 6, 0 },
+	[PROTO_CMND_RUN_TO_ADDR] = {
+		proto_cmnd_run_to_addr, 5, PROTO_CMND_FL_STOPPED },
+	/* Cover the whole command range */
+	[PROTO_CMND_XMEGA_ERASE] = { NULL, 0, 0 },
+};
+
+#define PROTO_CMND_TABLE_SZ	\
+	(sizeof(proto_cmnd_table) / sizeof(proto_cmnd_table[0]))
+
+/*!
+ * Return non-zero if the current message (command `op`, `sz` bytes) is a
+ * write to flash, which may add to the page being assembled.  EEPROM
+ * writes are not gathered: proto_cmnd_write_memory refuses them with
+ * RSP_ILLEGAL_MEMORY_TYPE, after the pages gathered so far are
+ * programmed like those of any other command.
+ */
+static uint8_t proto_cmnd_flash_write(uint8_t op, uint16_t sz) {
+	uint8_t type;
+
+	if ((op != PROTO_CMND_WRITE_MEMORY) || (sz < 2))
+		return 0;
+	proto_arg(1, &type, 1);
+	return (type == PROTO_MEM_SPM) || (type == PROTO_MEM_FLASH_PAGE);
+}
+
+/*!
+ * Handle a received command.  The message (`sz` bytes) is at the head of
+ * proto_host_uart_rx; the parser releases it afterwards.  Returns 0 if
+ * the command must be retried later (no room for the response yet).
+ */
+static uint8_t proto_dispatch(uint16_t seq, uint16_t sz) {
+	struct proto_cmnd_t cmnd = { NULL, 0, 0 };
+	uint8_t op;
+
+	proto_arg(0, &op, 1);
+	response.op = op;
+	if ((seq == last.seq) && (op == last.op))
+		/* Sent again: the response went astray, so repeat it */
+		return proto_send(seq, last.body, last.sz);
+
+	if ((target.stage != PROTO_STOP_NONE) || dw_stopping())
+		/* Let the target settle first */
+		return 0;
+
+	if (op < PROTO_CMND_TABLE_SZ)
+		memcpy_P(&cmnd, &proto_cmnd_table[op], sizeof(cmnd));
+
+	if (!(cmnd.handler && (cmnd.flags & PROTO_CMND_FL_STREAM))
+			&& (proto_tx_free()
+				< (PROTO_FRAME_OVERHEAD + PROTO_RSP_MAX_SZ)))
+		/* Wait until any short response is sure to fit */
+		return 0;
+
+	if (!proto_cmnd_flash_write(op, sz) && !proto_page_sync())
+		/* Program the pages gathered before anything else */
+		return 0;
+
+	if (!cmnd.handler)
+		return proto_reply(seq, PROTO_RSP_ILLEGAL_COMMAND);
+	if (sz < cmnd.min_sz)
+		return proto_reply(seq, PROTO_RSP_FAILED);
+	if ((cmnd.flags & PROTO_CMND_FL_STOPPED)
+			&& (mcu_state == PROTO_MCU_STATE_RUNNING))
+		return proto_reply(seq, PROTO_RSP_ILLEGAL_MCU_STATE);
+	return cmnd.handler(seq, sz);
+}
+
+/*!
+ * Feed one byte of a frame header to the state machine.  Returns 0 if the
+ * frame is rejected, in which case the hunt for the next one resumes
+ * just after its start delimiter.
+ */
+static uint8_t proto_header(uint8_t byte) {
+	switch (state.state) {
+	case PROTO_STATE_START:
+		if (byte != PROTO_DELIM_START) {
+			/* Hunt for the start of a frame */
+			state.offset++;
+			return 1;
+		}
+		state.start = state.offset;
+		state.seq = 0;
+		state.msg_sz = 0;
+		state.pos = 0;
+		state.crc = PROTO_CRC_INIT;
+		state.state = PROTO_STATE_SEQ_NO;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			timer_start(&state.timer, PROTO_TIMEOUT_TICKS);
+		}
+		break;
+	case PROTO_STATE_SEQ_NO:
+		state.seq |= (uint16_t)byte << (8 * state.pos);
+		if (++state.pos == sizeof(state.seq)) {
+			if (state.seq == PROTO_SEQ_EVENT)
+				/* Reserved for events from the emulator */
+				goto reject;
+			state.pos = 0;
+			state.state = PROTO_STATE_MSG_SZ;
+		}
+		break;
+	case PROTO_STATE_MSG_SZ:
+		state.msg_sz |= (uint32_t)byte << (8 * state.pos);
+		if (++state.pos < sizeof(state.msg_sz))
+			break;
+		/* The whole frame must fit in the receive FIFO */
+		if (!state.msg_sz || (state.msg_sz > (uint32_t)(
+				proto_host_uart_rx.total_sz
+				- PROTO_FRAME_OVERHEAD)))
+			goto reject;
+		state.state = PROTO_STATE_TOKEN;
+		break;
+	case PROTO_STATE_TOKEN:
+		if (byte != PROTO_DELIM_TOKEN)
+			goto reject;
+		state.state = PROTO_STATE_DATA;
+		break;
+	}
+	state.crc = proto_crc_update(state.crc, byte);
+	state.offset++;
+	return 1;
+
+reject:
+	state.state = PROTO_STATE_START;
+	state.offset = state.start + 1;
+	return 0;
+}
+
+/*!
+ * Release `sz` bytes from the head of the receive FIFO, keeping the
+ * parser's offsets in step.
+ */
+static void proto_release(uint16_t sz) {
+	fifo16_read_commit(&proto_host_uart_rx, sz);
+	state.offset -= sz;
+	state.start -= sz;
+	if (state.q_head == state.q_tail)
+		/* Nothing queued: hunted bytes, the tail stays at the head */
+		state.tail = 0;
+	else
+		state.tail -= sz;
+}
+
+/*!
+ * Run the frame parser over whatever has arrived from the host.  Frames
+ * are examined in place, at an offset past any commands still queued
+ * ahead of them: nothing is copied or scanned twice.  Good frames are
+ * added to the command queue; the parser stops while that is full.
+ */
+static void proto_parse(void) {
+	for (;;) {
+		uint8_t* span;
+		uint16_t sz, i;
+
+		if ((state.state != PROTO_STATE_START)
+				&& (state.timer.flags & TIMER_FLAG_EXPIRED)) {
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				timer_ack(&state.timer);
+				if (state.q_head != state.q_tail)
+					/* Held up behind queued commands */
+					timer_start(&state.timer,
+							PROTO_TIMEOUT_TICKS);
+			}
+			if (state.q_head == state.q_tail) {
+				/* Frame stalled part way; hunt for the next */
+				state.state = PROTO_STATE_START;
+				state.offset = state.start + 1;
+			}
+		}
+
+		if ((state.state == PROTO_STATE_START)
+				&& (state.q_head == state.q_tail)
+				&& state.offset)
+			/* Nothing queued: drop what has been hunted through */
+			proto_release(state.offset);
+
+		if (state.state < PROTO_STATE_DATA) {
+			sz = fifo16_peek_reserve(&proto_host_uart_rx,
+					state.offset, &span);
+			if (!sz)
+				return;
+
+			for (i = 0; (i < sz) && (state.state < PROTO_STATE_DATA);
+					i++)
+				if (!proto_header(span[i]))
+					/* Rescan from the new offset */
+					break;
+			continue;
+		}
+
+		/*
+		 * Check the message and CRC in place.  Running the CRC over
+		 * its own (little-endian) value leaves a remainder of zero.
+		 */
+		uint16_t end = state.start + PROTO_FRAME_OVERHEAD + state.msg_sz;
+		while (state.offset < end) {
+			sz = fifo16_peek_reserve(&proto_host_uart_rx,
+					state.offset, &span);
+			if (!sz)
+				return;
+			if (sz > (end - state.offset))
+				sz = end - state.offset;
+
+			state.crc = proto_crc_span(state.crc, span, sz);
+			state.offset += sz;
+		}
+
+		if (state.state == PROTO_STATE_DATA) {
+			/* Whole frame is here: no more time-out */
+			state.state = PROTO_STATE_CRC;
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+				timer_stop(&state.timer);
+			}
+		}
+
+		if (!state.crc) {
+			struct proto_queue_t* cmnd;
+			if ((uint8_t)(state.q_tail - state.q_head)
+					>= PROTO_QUEUE_SZ)
+				/* Wait for a command to finish */
+				return;
+
+			cmnd = &state.queue[state.q_tail
+				& (PROTO_QUEUE_SZ - 1)];
+			cmnd->seq = state.seq;
+			cmnd->sz = state.msg_sz;
+			cmnd->lead = state.start + PROTO_HDR_SZ - state.tail;
+			state.tail = end;
+			state.q_tail++;
+		}
+		/* A bad frame is left to be dropped with what follows it */
+
+		state.start = state.offset;
+		state.state = PROTO_STATE_START;
+	}
+}
+
+/*!
+ * Execute queued commands, in order, for as long as they complete.  The
+ * message of each is at the head of the receive FIFO while it runs.
+ * Returns the number of commands completed.
+ */
+static uint8_t proto_exec(void) {
+	uint8_t done = 0;
+
+	while (state.q_head != state.q_tail) {
+		struct proto_queue_t* cmnd = &state.queue[state.q_head
+			& (PROTO_QUEUE_SZ - 1)];
+
+		if (cmnd->lead) {
+			/* Header, and anything skipped before it */
+			proto_release(cmnd->lead);
+			cmnd->lead = 0;
+		}
+
+		if (!proto_dispatch(cmnd->seq, cmnd->sz))
+			/* Try again later */
+			break;
+
+		proto_release(cmnd->sz + 2);
+		state.q_head++;
+		done++;
+	}
+	return done;
+}
+
+/*!
+ * Read the snapshot part at `addr` into the cache as it arrives.
+ * Returns non-zero once all `sz` bytes are in and the link is free.
+ */
+static uint8_t proto_snapshot(uint16_t addr, uint8_t sz) {
+	uint8_t* span;
+	uint8_t run, i;
+
+	while ((target.pos < sz) && (run = dw_read(&span))) {
+		for (i = 0; i < run; i++)
+			proto_cache_put(&cache, addr + target.pos + i,
+					span[i], 1);
+		dw_read_commit(run);
+		target.pos += run;
+	}
+	return (target.pos == sz) && dw_end();
+}
+
+/*!
+ * Return non-zero if a range step is to carry on from `pc`: still in the
+ * range, short of the step limit, and not at a breakpoint (which also
+ * keeps it from stepping onto a BREAK).
+ */
+static uint8_t proto_range_more(uint16_t pc) {
+	const struct proto_bp_t* bp;
+
+	if (!target.range || !target.steps
+			|| (pc < target.start) || (pc >= target.end))
+		return 0;
+	bp = proto_bp_find(&bps, pc);
+	return !(bp && (bp->flags & PROTO_BP_FL_WANTED));
+}
+
+/*!
+ * Follow the target as it stops.  The PC, registers, SP and SREG are
+ * read straight away, so the reads the host makes at every prompt are
+ * answered from the cache; then the host is told (if it asked to be).
+ */
+static void proto_target(void) {
+	if (target.stage == PROTO_STOP_NONE) {
+		if (dw_stopped())
+			target.stage = PROTO_STOP_PC_BEGIN;
+		else if (dw_running() && dw_timed_out())
+			goto lost;
+		else
+			return;
+	} else if ((target.stage < PROTO_STOP_EVENT) && dw_timed_out()) {
+		goto lost;
+	}
+
+	switch (target.stage) {
+	case PROTO_STOP_PC_BEGIN:
+		if (!dw_pc_begin())
+			return;
+		target.stage = PROTO_STOP_PC;
+		/* Fall through */
+	case PROTO_STOP_PC:
+		if (!dw_pc(&cache.pc))
+			return;
+		if (target.run)
+			/* Report a BREAK as the breakpoint it stands for */
+			cache.pc = proto_bp_hit(&bps, cache.pc);
+		target.run = 0;
+		cache.flags |= PROTO_CACHE_FL_PC;
+		target.stage = PROTO_STOP_RANGE;
+		/* Fall through */
+	case PROTO_STOP_RANGE:
+		if (proto_range_more(cache.pc)) {
+			/* No snapshot, no event: just the next step */
+			if (!dw_step(cache.pc, timers_running))
+				return;
+			proto_cache_flush(&cache);
+			target.steps--;
+			PROTO_STAT_INC(range_steps);
+			target.stage = PROTO_STOP_NONE;
+			return;
+		}
+		target.range = 0;
+		target.stage = PROTO_STOP_REGS_BEGIN;
+		/* Fall through */
+	case PROTO_STOP_REGS_BEGIN:
+		if (!dw_read_begin(DW_SPACE_SRAM, 0, PROTO_CACHE_REGS))
+			return;
+		cache.flags |= PROTO_CACHE_FL_REGS;
+		target.pos = 0;
+		target.stage = PROTO_STOP_REGS;
+		/* Fall through */
+	case PROTO_STOP_REGS:
+		if (!proto_snapshot(0, PROTO_CACHE_REGS))
+			return;
+		target.stage = PROTO_STOP_IO_BEGIN;
+		/* Fall through */
+	case PROTO_STOP_IO_BEGIN:
+		if (!dw_read_begin(DW_SPACE_SRAM, PROTO_CACHE_SP,
+				PROTO_CACHE_SREG + 1 - PROTO_CACHE_SP))
+			return;
+		target.pos = 0;
+		target.stage = PROTO_STOP_IO;
+		/* Fall through */
+	case PROTO_STOP_IO:
+		if (!proto_snapshot(PROTO_CACHE_SP,
+				PROTO_CACHE_SREG + 1 - PROTO_CACHE_SP))
+			return;
+		mcu_state = PROTO_MCU_STATE_STOPPED;
+		target.stage = PROTO_STOP_EVENT;
+		/* Fall through */
+	case PROTO_STOP_EVENT:
+		if (target.report) {
+			const uint8_t evt[] = {
+				PROTO_EVT_BREAK,
+				cache.pc, cache.pc >> 8, 0, 0,	/* PC */
+				1				/* Status */
+			};
+			if (!proto_send(PROTO_SEQ_EVENT, evt, sizeof(evt)))
+				return;
+			target.report = 0;
+		}
+		target.stage = PROTO_STOP_NONE;
+		return;
+	default:
+		break;
+	}
+
+	if (target.report) {
+		const uint8_t evt = PROTO_EVT_ERROR_PHY_SYNC_TIMEOUT;
+		if (!proto_send(PROTO_SEQ_EVENT, &evt, sizeof(evt)))
+			return;
+		target.report = 0;
+	}
+	target.stage = PROTO_STOP_NONE;
+	return;
+
+lost:
+	/* Give up on it; commands will report the failure */
+	dw_reset();
+	proto_cache_flush(&cache);
+	mcu_state = PROTO_MCU_STATE_STOPPED;
+	target.failed = 1;
+	target.range = 0;
+	target.stage = PROTO_STOP_LOST;
+	proto_target();
+}
+
+/*!
+ * Parse and execute as far as possible.
+ */
+static void proto_poll(void) {
+	do {
+		proto_target();
+		proto_ahead();
+		proto_program();
+		proto_parse();
+	} while (proto_exec());
+}
+
+static void host_rx_evth(struct fifo16_t* const fifo, uint8_t events) {
+	proto_poll();
+}
+
+static void host_tx_evth(struct fifo16_t* const fifo, uint8_t events) {
+	/* Room to reply: resume any command or event held back for it */
+	if ((state.q_head != state.q_tail)
+			|| (target.stage != PROTO_STOP_NONE))
+		proto_poll();
 }
 
 static void target_rx_evth(struct fifo_t* const fifo, uint8_t events) {
+	/* Data for the command in progress, or the target has stopped */
+	proto_poll();
 }
+
+/*! Run work that waits on time rather than data */
+void proto_task() {
+	if ((state.q_head != state.q_tail)
+			|| (target.stage != PROTO_STOP_NONE)
+			|| (ahead.stage == PROTO_AHEAD_FILL)
+			|| (ahead.stage == PROTO_AHEAD_DISCARD)
+			|| (pages[prog.fill ^ 1].state == PROTO_PAGE_QUEUED)
+			|| dw_running() || dw_timed_out())
+		proto_poll();
+}
+
+#ifdef PROTO_STATS
+/*!
+ * Copy the protocol statistics to `stats`, zeroing them if `reset` is
+ * set.
+ */
+void proto_stats(struct proto_stats_t* const stats, uint8_t reset) {
+	*stats = counters;
+	if (reset)
+		memset(&counters, 0, sizeof(counters));
+}
+#endif
+
+#endif
@@ -34,15 +34,39 @@
 #define PROTO_TIMEOUT_TICKS	(10)	/*!< Number of ticks
 					  before time-out (a guess) */
 
+/*! Depth of the command queue (a power of two) */
+#define PROTO_QUEUE_SZ		(4)
+
 /*!
- * Protocol state machine variables
+ * A received command, waiting to be (or being) executed.  Its message is
+ * still in the host receive FIFO, `lead` bytes (its header, and anything
+ * skipped before it) past the end of the command ahead of it.
+ */
+struct proto_queue_t {
+	uint16_t seq;		/*!< Sequence number */
+	uint16_t sz;		/*!< Message size */
+	uint16_t lead;		/*!< Bytes before the message */
+};
+
+/*!
+ * Protocol state machine variables.  Offsets are from the head of the
+ * host receive FIFO.
  */
 struct proto_state_t {
-	const char* msg;	/*!< Message buffer */
-	uint16_t msg_sz;	/*!< Message size */
+	uint32_t msg_sz;	/*!< Message size */
 	uint16_t seq;		/*!< Sequence number */
+	uint16_t crc;		/*!< CRC of the frame so far */
+	uint16_t start;		/*!< Offset of the frame being parsed */
+	uint16_t offset;	/*!< Offset of the next byte to parse */
+	uint16_t tail;		/*!< Offset past the last queued frame */
+	uint8_t pos;		/*!< Byte position within a header field */
 	uint8_t state;		/*!< State number */
 	struct timer_t timer;	/*!< Time-out timer */
+
+	/*! Commands received and not yet completed */
+	struct proto_queue_t queue[PROTO_QUEUE_SZ];
+	uint8_t q_head;		/*!< Command being executed */
+	uint8_t q_tail;		/*!< Next free queue entry */
 };
 
 #endif
@@ -0,0 +1,296 @@
+/*!
+ * Breakpoint bookkeeping (protocol/breakpoint.h), on its own: requests
+ * that cancel out, the choice of the hardware breakpoint, patching and
+ * unpatching flash page data, flash being replaced under breakpoints,
+ * half-written BREAK words completed, and working out which breakpoint the target stopped at.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "protocol/breakpoint.h"
+
+/*! Flash page size used here, in bytes */
+#define TEST_PAGE_SZ		(128)
+
+static struct proto_bp_table_t bps;
+
+/*!
+ * Return the word at byte `at` of `data`.
+ */
+static uint16_t test_word(const uint8_t* data, uint16_t at) {
+	return data[at] | (data[at + 1] << 8);
+}
+
+/*!
+ * Fill `data` with the instructions of the page at byte address `addr`.
+ */
+static void test_page(uint8_t* data, uint16_t addr) {
+	uint16_t i;
+
+	for (i = 0; i < TEST_PAGE_SZ; i++)
+		data[i] = (addr + i) ^ 0x3c;
+}
+
+/*!
+ * Setting and clearing: only requests that change something count, and
+ * the table holds PROTO_BP_MAX.
+ */
+static void test_set_clear(void) {
+	uint8_t i;
+
+	proto_bp_reset(&bps);
+	assert(bps.hw == PROTO_BP_NONE);
+	assert(proto_bp_set(&bps, 1, 0x110) && (bps.changes == 1));
+	assert(proto_bp_set(&bps, 1, 0x110) && (bps.changes == 1));
+	assert(proto_bp_get(&bps, 1) == proto_bp_find(&bps, 0x110));
+
+	/* The wrong number, or nothing there */
+	assert(!proto_bp_clear(&bps, 2, 0x110));
+	assert(!proto_bp_clear(&bps, 1, 0x112));
+	assert(proto_bp_clear(&bps, 1, 0x110) && (bps.changes == 2));
+	assert(!proto_bp_find(&bps, 0x110) && !proto_bp_get(&bps, 1));
+
+	for (i = 0; i < PROTO_BP_MAX; i++)
+		assert(proto_bp_set(&bps, i, 0x200 + i));
+	assert(!proto_bp_set(&bps, 9, 0x300));
+	assert(proto_bp_set(&bps, 9, 0x203) && (proto_bp_get(&bps, 9)));
+	proto_bp_clear_all(&bps);
+	for (i = 0; i < PROTO_BP_MAX; i++)
+		assert(!bps.bp[i].flags);
+	printf("set and clear ok\n");
+}
+
+/*!
+ * The hardware breakpoint: one at the PC must have it, then the address
+ * to run to, then the one hit most often, the latest set of equals.
+ */
+static void test_plan(void) {
+	struct proto_bp_t* bp;
+	uint8_t i;
+
+	proto_bp_reset(&bps);
+	proto_bp_plan(&bps, 0x100, PROTO_BP_NONE);
+	assert((bps.hw == PROTO_BP_NONE) && !proto_bp_pending(&bps));
+
+	proto_bp_set(&bps, 1, 0x110);
+	proto_bp_set(&bps, 2, 0x120);
+	proto_bp_set(&bps, 3, 0x150);
+	proto_bp_plan(&bps, 0x100, PROTO_BP_NONE);
+	assert(bps.hw == 0x150);
+	for (i = 0; i < 3; i++) {
+		bp = proto_bp_get(&bps, 1 + i);
+		assert(!(bp->flags & PROTO_BP_FL_PLACE) == (bp->addr == 0x150));
+	}
+
+	/* Hits count for more than being set last */
+	assert(proto_bp_hit(&bps, 0x120) == 0x120);
+	proto_bp_plan(&bps, 0x100, PROTO_BP_NONE);
+	assert(bps.hw == 0x120);
+
+	/* Running to an address */
+	proto_bp_plan(&bps, 0x100, 0x170);
+	assert(bps.hw == 0x170);
+	for (i = 0; i < 3; i++)
+		assert(proto_bp_get(&bps, 1 + i)->flags & PROTO_BP_FL_PLACE);
+
+	/* Starting on one, which must not be a BREAK */
+	proto_bp_plan(&bps, 0x110, 0x170);
+	assert(bps.hw == 0x110);
+	assert(!(proto_bp_get(&bps, 1)->flags & PROTO_BP_FL_PLACE));
+
+	/* Every planned BREAK needs its instruction first */
+	assert(proto_bp_unread(&bps) && proto_bp_pending(&bps));
+	printf("plan ok\n");
+}
+
+/*!
+ * Patching a page puts BREAKs in and instructions back, and marks the
+ * bytes changed; unpatching data read back shows the instructions.
+ */
+static void test_patch(void) {
+	uint8_t data[TEST_PAGE_SZ], orig[TEST_PAGE_SZ], read[TEST_PAGE_SZ];
+	uint8_t valid[TEST_PAGE_SZ / 8];
+	uint16_t at;
+	uint8_t i;
+
+	/* 0x110 and 0x120 are in the page at 0x200, 0x150 is not */
+	proto_bp_reset(&bps);
+	proto_bp_set(&bps, 1, 0x110);
+	proto_bp_set(&bps, 2, 0x120);
+	proto_bp_set(&bps, 3, 0x150);
+	test_page(orig, 0x200);
+	proto_bp_replaced(&bps, 0x200, orig, TEST_PAGE_SZ);
+	assert(proto_bp_find(&bps, 0x110)->insn == test_word(orig, 0x20));
+	assert(!(proto_bp_find(&bps, 0x150)->flags & PROTO_BP_FL_INSN));
+	proto_bp_plan(&bps, 0x100, PROTO_BP_NONE);
+	assert(bps.hw == 0x150);
+	assert(!proto_bp_unread(&bps));
+
+	memcpy(data, orig, sizeof(data));
+	memset(valid, 0, sizeof(valid));
+	proto_bp_patch(&bps, 0x200, data, valid, TEST_PAGE_SZ);
+	assert(test_word(data, 0x20) == PROTO_BP_BREAK);
+	assert(test_word(data, 0x40) == PROTO_BP_BREAK);
+	for (at = 0; at < TEST_PAGE_SZ; at++)
+		assert(((valid[at / 8] >> (at % 8)) & 1)
+				== ((at & ~1) == 0x20 || (at & ~1) == 0x40));
+	for (at = 0; at < TEST_PAGE_SZ; at++)
+		if ((at & ~1) != 0x20 && (at & ~1) != 0x40)
+			assert(data[at] == orig[at]);
+	assert(!proto_bp_pending(&bps));
+
+	/* Reads of the page, whole or cut anywhere, see the instructions */
+	for (i = 0; i < TEST_PAGE_SZ; i += 7) {
+		uint8_t sz = TEST_PAGE_SZ - i;
+		memcpy(read, &data[i], sz);
+		proto_bp_unpatch(&bps, 0x200 + i, read, sz);
+		assert(!memcmp(read, &orig[i], sz));
+	}
+
+	/* Cleared: the instruction goes back, and the entry with it */
+	proto_bp_clear(&bps, 2, 0x120);
+	assert(proto_bp_find(&bps, 0x120));
+	proto_bp_plan(&bps, 0x100, PROTO_BP_NONE);
+	assert(proto_bp_pending(&bps) == proto_bp_find(&bps, 0x120));
+	memset(valid, 0, sizeof(valid));
+	proto_bp_patch(&bps, 0x200, data, valid, TEST_PAGE_SZ);
+	assert(test_word(data, 0x40) == test_word(orig, 0x40));
+	assert(test_word(data, 0x20) == PROTO_BP_BREAK);
+	assert(valid[0x40 / 8] == 3);
+	assert(!proto_bp_find(&bps, 0x120) && !proto_bp_pending(&bps));
+	printf("patch ok\n");
+}
+
+/*!
+ * Flash replaced under breakpoints: the BREAK is gone, and what was
+ * written is the instruction from then on.
+ */
+static void test_replaced(void) {
+	static const uint8_t data[] = { 0x12, 0x34, 0x56 };
+	struct proto_bp_t* bp;
+
+	/* From the state test_patch left: 0x110 in flash */
+	bp = proto_bp_find(&bps, 0x110);
+	assert(bp->flags & PROTO_BP_FL_FLASH);
+	proto_bp_replaced(&bps, 0x21f, data, sizeof(data));
+	assert(!(bp->flags & PROTO_BP_FL_FLASH) && (bp->insn == 0x5634));
+
+	/* Erased */
+	proto_bp_replaced(&bps, 0x200, NULL, TEST_PAGE_SZ);
+	assert((bp->flags & PROTO_BP_FL_INSN) && (bp->insn == 0xffff));
+
+	/* Half of it written, either half: the other half stays */
+	proto_bp_replaced(&bps, 0x21f, data, 2);
+	assert((bp->flags & PROTO_BP_FL_INSN) && (bp->insn == 0xff34));
+	proto_bp_replaced(&bps, 0x221, data, 1);
+	assert((bp->flags & PROTO_BP_FL_INSN) && (bp->insn == 0x1234));
+
+	/* ...and is still not known if it was not */
+	bp->flags &= ~PROTO_BP_FL_INSN;
+	proto_bp_replaced(&bps, 0x220, data, 1);
+	assert(!(bp->flags & PROTO_BP_FL_INSN) && ((bp->insn & 0xff) == 0x12));
+
+	/* One the host cleared is forgotten once it is out of flash */
+	bp->flags |= PROTO_BP_FL_FLASH | PROTO_BP_FL_INSN;
+	proto_bp_clear(&bps, 1, 0x110);
+	assert(proto_bp_find(&bps, 0x110));
+	proto_bp_replaced(&bps, 0x200, NULL, TEST_PAGE_SZ);
+	assert(!proto_bp_find(&bps, 0x110));
+	printf("replaced ok\n");
+}
+
+/*!
+ * Page data the host wrote half a BREAK word of: the other half is the
+ * instruction, not what the target holds.
+ */
+static void test_complete(void) {
+	uint8_t data[TEST_PAGE_SZ], valid[TEST_PAGE_SZ / 8];
+	struct proto_bp_t* bp;
+
+	proto_bp_reset(&bps);
+	proto_bp_set(&bps, 1, 0x110);
+	proto_bp_set(&bps, 2, 0x120);
+	proto_bp_set(&bps, 3, 0x130);
+	bp = proto_bp_find(&bps, 0x110);
+	bp->insn = 0x1234;
+	bp->flags |= PROTO_BP_FL_FLASH | PROTO_BP_FL_INSN;
+	bp = proto_bp_find(&bps, 0x120);
+	bp->insn = 0x5678;
+	bp->flags |= PROTO_BP_FL_FLASH | PROTO_BP_FL_INSN;
+	bp = proto_bp_find(&bps, 0x130);
+	bp->insn = 0x9abc;
+	bp->flags |= PROTO_BP_FL_INSN;
+
+	/* High half of 0x110, low half of 0x120, nothing of the rest */
+	memset(data, 0, sizeof(data));
+	memset(valid, 0, sizeof(valid));
+	valid[0x21 / 8] |= 1 << (0x21 % 8);
+	valid[0x40 / 8] |= 1 << (0x40 % 8);
+	valid[0x60 / 8] |= 1 << (0x60 % 8);
+	proto_bp_complete(&bps, 0x200, data, valid, TEST_PAGE_SZ);
+	assert((data[0x20] == 0x34) && (data[0x41] == 0x56));
+	assert((valid[0x20 / 8] == 3) && (valid[0x40 / 8] == 3));
+
+	/* 0x130 is not in flash: the target holds the instruction */
+	assert(!data[0x61] && (valid[0x60 / 8] == 1));
+	printf("complete ok\n");
+}
+
+/*!
+ * Stops: at a breakpoint, or just after one that is a BREAK in flash.
+ */
+static void test_hit(void) {
+	struct proto_bp_t* bp;
+	uint16_t n;
+
+	proto_bp_reset(&bps);
+	proto_bp_set(&bps, 1, 0x110);
+	proto_bp_set(&bps, 2, 0x120);
+	bp = proto_bp_find(&bps, 0x120);
+
+	assert(proto_bp_hit(&bps, 0x111) == 0x111);
+	bp->flags |= PROTO_BP_FL_FLASH;
+	assert(proto_bp_hit(&bps, 0x121) == 0x120);
+	assert(proto_bp_hit(&bps, 0x120) == 0x120);
+	assert(proto_bp_hit(&bps, 0x122) == 0x122);
+	assert(bp->hits == 2);
+	for (n = 0; n < 300; n++)
+		proto_bp_hit(&bps, 0x110);
+	assert(proto_bp_find(&bps, 0x110)->hits == 0xff);
+
+	/* Those cleared are not reported */
+	proto_bp_clear(&bps, 2, 0x120);
+	assert(proto_bp_hit(&bps, 0x120) == 0x120);
+	assert(bp->hits == 2);
+	assert(proto_bp_hit(&bps, 0x121) == 0x121);
+	printf("hit ok\n");
+}
+
+int main(void) {
+	test_set_clear();
+	test_plan();
+	test_patch();
+	test_replaced();
+	test_complete();
+	test_hit();
+
+	printf("ok\n");
+	return 0;
+}
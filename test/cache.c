@@ -0,0 +1,180 @@
+/*!
+ * Register and SRAM cache (protocol/cache.h), on its own: what may be
+ * cached, byte validity within a line, lines replaced in turn, and
+ * flushing.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "protocol/cache.h"
+
+static struct proto_cache_t cache;
+
+/*!
+ * Return non-zero if `addr` is cached, holding `byte`.
+ */
+static uint8_t test_has(uint16_t addr, uint8_t byte) {
+	uint8_t got = ~byte;
+
+	return proto_cache_get(&cache, addr, &got) && (got == byte);
+}
+
+/*!
+ * Return non-zero if `addr` is not cached.
+ */
+static uint8_t test_missing(uint16_t addr) {
+	uint8_t got;
+
+	return !proto_cache_get(&cache, addr, &got);
+}
+
+/*!
+ * The register file: only kept once taken as a whole.
+ */
+static void test_regs(void) {
+	uint8_t i;
+
+	proto_cache_put(&cache, 3, 0x33, 1);
+	assert(test_missing(3));
+
+	for (i = 0; i < PROTO_CACHE_REGS; i++)
+		cache.regs[i] = 0xa0 + i;
+	cache.flags |= PROTO_CACHE_FL_REGS;
+	for (i = 0; i < PROTO_CACHE_REGS; i++)
+		assert(test_has(i, 0xa0 + i));
+	proto_cache_put(&cache, 3, 0x33, 0);
+	assert(test_has(3, 0x33));
+	printf("registers ok\n");
+}
+
+/*!
+ * What may go in a line: SP and SREG, and SRAM once its start is known,
+ * but no other I/O register.
+ */
+static void test_cacheable(void) {
+	uint16_t addr;
+
+	for (addr = PROTO_CACHE_REGS; addr < 0x200; addr++)
+		proto_cache_put(&cache, addr, addr, 1);
+	for (addr = PROTO_CACHE_REGS; addr < 0x200; addr++)
+		assert(test_has(addr, addr) == ((addr >= PROTO_CACHE_SP)
+					&& (addr <= PROTO_CACHE_SREG)));
+
+	proto_cache_flush(&cache);
+	cache.sram_start = 0x100;
+	for (addr = 0xf8; addr < 0x108; addr++)
+		proto_cache_put(&cache, addr, addr, 1);
+	for (addr = 0xf8; addr < 0x108; addr++)
+		assert(test_has(addr, addr) == (addr >= 0x100));
+	printf("cacheable ok\n");
+}
+
+/*!
+ * Each byte of a line is valid on its own, and bytes are only added to a
+ * line, or a line taken for them, when asked.
+ */
+static void test_bytes(void) {
+	struct proto_cache_line_t* line;
+	uint8_t i;
+
+	proto_cache_flush(&cache);
+	proto_cache_put(&cache, 0x205, 0x55, 0);
+	assert(test_missing(0x205));
+
+	proto_cache_put(&cache, 0x205, 0x55, 1);
+	assert(test_has(0x205, 0x55));
+	for (i = 0; i < PROTO_CACHE_LINE_SZ; i++)
+		if (i != 5)
+			assert(test_missing(0x200 + i));
+
+	/* A write to a line already there updates it */
+	proto_cache_put(&cache, 0x20f, 0xf0, 0);
+	proto_cache_put(&cache, 0x205, 0x56, 0);
+	assert(test_has(0x20f, 0xf0) && test_has(0x205, 0x56));
+	line = proto_cache_line(&cache, 0x200, 0);
+	assert(line && (line->valid == ((1 << 15) | (1 << 5))));
+
+	/* The next address is in the next line */
+	assert(test_missing(0x210));
+	assert(!proto_cache_line(&cache, 0x210, 0));
+	printf("bytes ok\n");
+}
+
+/*!
+ * Lines are replaced in turn, once all are in use.
+ */
+static void test_replace(void) {
+	uint16_t addr;
+	uint8_t i;
+
+	proto_cache_flush(&cache);
+	cache.victim = 0;
+	for (i = 0; i < PROTO_CACHE_LINES; i++)
+		proto_cache_put(&cache, 0x400 + i * PROTO_CACHE_LINE_SZ, i, 1);
+	for (i = 0; i < PROTO_CACHE_LINES; i++)
+		assert(test_has(0x400 + i * PROTO_CACHE_LINE_SZ, i));
+
+	/* Each new line pushes out the oldest */
+	for (i = 0; i < PROTO_CACHE_LINES; i++) {
+		addr = 0x800 + i * PROTO_CACHE_LINE_SZ;
+		proto_cache_put(&cache, addr, 0x80 + i, 1);
+		assert(test_has(addr, 0x80 + i));
+		assert(test_missing(0x400 + i * PROTO_CACHE_LINE_SZ));
+		if (i + 1 < PROTO_CACHE_LINES)
+			assert(test_has(0x400 + (i + 1) * PROTO_CACHE_LINE_SZ,
+						i + 1));
+	}
+
+	/* A replaced line keeps nothing of what it held */
+	proto_cache_put(&cache, 0x403, 0x33, 1);
+	for (i = 0; i < PROTO_CACHE_LINE_SZ; i++)
+		assert((i == 3) ? test_has(0x403, 0x33)
+				: test_missing(0x400 + i));
+	assert(test_missing(0x800));
+	printf("replacement ok\n");
+}
+
+/*!
+ * A flush forgets the registers, the PC and every line.
+ */
+static void test_flush(void) {
+	uint16_t addr;
+
+	cache.flags = PROTO_CACHE_FL_REGS | PROTO_CACHE_FL_PC;
+	proto_cache_put(&cache, PROTO_CACHE_SP, 0xff, 1);
+	proto_cache_flush(&cache);
+	assert(!cache.flags);
+	for (addr = 0; addr < 0x1000; addr++)
+		assert(test_missing(addr));
+	printf("flush ok\n");
+}
+
+int main(void) {
+	memset(&cache, 0, sizeof(cache));
+
+	test_regs();
+	test_cacheable();
+	test_bytes();
+	test_replace();
+	test_flush();
+
+	printf("ok\n");
+	return 0;
+}
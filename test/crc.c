@@ -0,0 +1,137 @@
+/*!
+ * Frame CRC (protocol/crc.h).  Built twice: as the firmware builds by
+ * default, on avr-libc's _crc_ccitt_update, and with PROTO_CRC_TABLE, on
+ * the table in protocol/crc.c.  Either way the update must match a
+ * plain bitwise CRC-CCITT (reflected, polynomial 0x8408), and a CRC run
+ * over a frame including its own CRC must leave zero, which is how the
+ * parser checks frames.  The table build also checks each entry.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol/crc.h"
+
+#ifdef PROTO_CRC_TABLE
+#define TEST_VARIANT	"table"
+#else
+#define TEST_VARIANT	"bitwise"
+#endif
+
+/*!
+ * Fold one byte into the CRC a bit at a time.
+ */
+static uint16_t test_crc_bitwise(uint16_t crc, uint8_t byte) {
+	uint8_t i;
+
+	crc ^= byte;
+	for (i = 0; i < 8; i++)
+		crc = (crc & 1) ? ((crc >> 1) ^ 0x8408) : (crc >> 1);
+	return crc;
+}
+
+static void test_fail(const char* what, unsigned a, unsigned b,
+		unsigned got, unsigned want) {
+	printf("FAIL: %s: %s %04x %02x gives %04x, expected %04x\n",
+			TEST_VARIANT, what, a, b, got, want);
+	exit(1);
+}
+
+#ifdef PROTO_CRC_TABLE
+/*!
+ * Each entry is the CRC of its index from a zero start.
+ */
+static void test_table(void) {
+	unsigned n;
+
+	for (n = 0; n < 256; n++) {
+		uint16_t want = test_crc_bitwise(0, n);
+		if (pgm_read_word(&proto_crc_table[n]) != want)
+			test_fail("entry", 0, n,
+				pgm_read_word(&proto_crc_table[n]), want);
+	}
+	printf("%s: 256 entries ok\n", TEST_VARIANT);
+}
+#endif
+
+/*!
+ * proto_crc_update matches the bitwise update for every CRC and byte.
+ */
+static void test_update(void) {
+	uint32_t crc;
+	unsigned byte;
+
+	for (crc = 0; crc < 0x10000; crc++)
+		for (byte = 0; byte < 256; byte++) {
+			uint16_t got = proto_crc_update(crc, byte);
+			uint16_t want = test_crc_bitwise(crc, byte);
+			if (got != want)
+				test_fail("update", crc, byte, got, want);
+		}
+	printf("%s: every update ok\n", TEST_VARIANT);
+}
+
+/*!
+ * The standard check value, and a frame checked as the parser does.
+ */
+static void test_frame(void) {
+	static const uint8_t check[] = "123456789";
+	uint8_t frame[8 + 300 + 2];
+	uint16_t crc, sz;
+
+	crc = proto_crc_span(PROTO_CRC_INIT, check, sizeof(check) - 1);
+	if (crc != 0x6f91)
+		test_fail("check", PROTO_CRC_INIT, 0, crc, 0x6f91);
+
+	for (sz = 0; sz <= 300; sz += 13) {
+		uint16_t i;
+
+		/* Start, sequence, size, token, message, CRC */
+		frame[0] = 27;
+		frame[1] = sz;
+		frame[2] = 0;
+		frame[3] = sz;
+		frame[4] = sz >> 8;
+		frame[5] = 0;
+		frame[6] = 0;
+		frame[7] = 14;
+		for (i = 0; i < sz; i++)
+			frame[8 + i] = i * 31 + sz;
+		crc = proto_crc_span(PROTO_CRC_INIT, frame, 8 + sz);
+		frame[8 + sz] = crc;
+		frame[9 + sz] = crc >> 8;
+
+		crc = proto_crc_span(PROTO_CRC_INIT, frame, 10 + sz);
+		if (crc)
+			test_fail("remainder", PROTO_CRC_INIT, sz, crc, 0);
+		frame[8 + (sz / 2)] ^= 0x04;
+		if (!proto_crc_span(PROTO_CRC_INIT, frame, 10 + sz))
+			test_fail("corrupt", PROTO_CRC_INIT, sz, 0, 1);
+	}
+	printf("%s: frames ok\n", TEST_VARIANT);
+}
+
+int main(void) {
+#ifdef PROTO_CRC_TABLE
+	test_table();
+#endif
+	test_update();
+	test_frame();
+	return 0;
+}
@@ -0,0 +1,193 @@
+/*!
+ * Throughput of the FIFO calls (util/fifo.h), for comparing the copying
+ * calls (fifo_write, fifo_read) with the span calls (fifo_write_reserve
+ * and fifo_write_commit, fifo_read_reserve and fifo_read_commit) and the
+ * byte at a time calls.  Both sides run in turn in one thread, moving a
+ * chunk at a time, and the time per byte is printed for each.
+ *
+ * This runs on the host, so the figures only compare the calls with one
+ * another; they are not AVR cycle counts.
+ *
+ * Usage: fifo_bench [megabytes per run]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "util/fifo.h"
+
+FIFO_DEFINE(fifo, 128);
+FIFO16_DEFINE(fifo16, 512);
+
+/*! Chunk sizes tried, in bytes */
+static const uint8_t bench_chunks[] = { 1, 8, 32, 64 };
+
+/*! Sum of the bytes read, so the reads are not optimised away */
+static volatile uint32_t bench_sum;
+
+/*!
+ * Move `total` bytes `chunk` at a time with fifo_write and fifo_read.
+ */
+static void bench_copy(uint32_t total, uint8_t chunk) {
+	uint8_t in[64], out[64];
+	uint32_t sum = 0;
+	uint8_t i;
+
+	for (i = 0; i < chunk; i++)
+		in[i] = i;
+	while (total >= chunk) {
+		fifo_write(&fifo, in, chunk);
+		fifo_read(&fifo, out, chunk);
+		for (i = 0; i < chunk; i++)
+			sum += out[i];
+		total -= chunk;
+	}
+	bench_sum = sum;
+}
+
+/*!
+ * Move `total` bytes `chunk` at a time through reserved spans.
+ */
+static void bench_span(uint32_t total, uint8_t chunk) {
+	uint32_t sum = 0;
+	uint8_t* span;
+	uint8_t run, i;
+
+	while (total >= chunk) {
+		run = fifo_write_reserve(&fifo, &span);
+		if (run > chunk)
+			run = chunk;
+		for (i = 0; i < run; i++)
+			span[i] = i;
+		fifo_write_commit(&fifo, run);
+
+		run = fifo_read_reserve(&fifo, &span);
+		for (i = 0; i < run; i++)
+			sum += span[i];
+		fifo_read_commit(&fifo, run);
+		total -= run;
+	}
+	bench_sum = sum;
+}
+
+/*!
+ * Move `total` bytes `chunk` at a time with fifo_write_one and
+ * fifo_read_one.
+ */
+static void bench_byte(uint32_t total, uint8_t chunk) {
+	uint32_t sum = 0;
+	uint8_t i;
+
+	while (total >= chunk) {
+		for (i = 0; i < chunk; i++)
+			fifo_write_one(&fifo, i);
+		for (i = 0; i < chunk; i++)
+			sum += fifo_read_one(&fifo);
+		total -= chunk;
+	}
+	bench_sum = sum;
+}
+
+/*!
+ * As bench_copy, through the wide FIFO.
+ */
+static void bench_copy16(uint32_t total, uint8_t chunk) {
+	uint8_t in[64], out[64];
+	uint32_t sum = 0;
+	uint8_t i;
+
+	for (i = 0; i < chunk; i++)
+		in[i] = i;
+	while (total >= chunk) {
+		fifo16_write(&fifo16, in, chunk);
+		fifo16_read(&fifo16, out, chunk);
+		for (i = 0; i < chunk; i++)
+			sum += out[i];
+		total -= chunk;
+	}
+	bench_sum = sum;
+}
+
+/*!
+ * As bench_span, through the wide FIFO.
+ */
+static void bench_span16(uint32_t total, uint8_t chunk) {
+	uint32_t sum = 0;
+	uint8_t* span;
+	uint16_t run, i;
+
+	while (total >= chunk) {
+		run = fifo16_write_reserve(&fifo16, &span);
+		if (run > chunk)
+			run = chunk;
+		for (i = 0; i < run; i++)
+			span[i] = i;
+		fifo16_write_commit(&fifo16, run);
+
+		run = fifo16_read_reserve(&fifo16, &span);
+		for (i = 0; i < run; i++)
+			sum += span[i];
+		fifo16_read_commit(&fifo16, run);
+		total -= run;
+	}
+	bench_sum = sum;
+}
+
+/*!
+ * Time one way of moving data, and print the time per byte.
+ */
+static void bench_run(const char* name, void (*run)(uint32_t, uint8_t),
+		uint32_t total) {
+	struct timespec start, end;
+	uint8_t i;
+
+	printf("%-8s", name);
+	for (i = 0; i < sizeof(bench_chunks); i++) {
+		double ns;
+
+		fifo_empty(&fifo);
+		fifo16_empty(&fifo16);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		run(total, bench_chunks[i]);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ns = (end.tv_sec - start.tv_sec) * 1e9
+			+ (end.tv_nsec - start.tv_nsec);
+		printf(" %8.2f", ns / total);
+	}
+	printf("\n");
+}
+
+int main(int argc, char** argv) {
+	uint32_t total = ((argc > 1) ? atoi(argv[1]) : 64) * 1048576UL;
+	uint8_t i;
+
+	FIFO_INIT(fifo);
+	FIFO16_INIT(fifo16);
+
+	printf("ns/byte ");
+	for (i = 0; i < sizeof(bench_chunks); i++)
+		printf(" %6u B", bench_chunks[i]);
+	printf("\n");
+	bench_run("copy", bench_copy, total);
+	bench_run("span", bench_span, total);
+	bench_run("byte", bench_byte, total);
+	bench_run("copy16", bench_copy16, total);
+	bench_run("span16", bench_span16, total);
+	return 0;
+}
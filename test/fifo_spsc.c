@@ -0,0 +1,352 @@
+/*!
+ * Stress test for the single producer, single consumer FIFO (util/fifo.h).
+ *
+ * One side writes a pseudo-random byte stream and the other reads it back
+ * and checks every byte, so a lost, repeated or reordered byte is caught.
+ * Each side picks a different way of moving data at every step: the byte
+ * at a time calls, the copying calls, and the span (reserve and commit)
+ * calls.
+ *
+ * The two sides run in three ways.  Either one may be a signal handler,
+ * interrupting the other anywhere, as the USART receive interrupt (a
+ * producer) and transmit interrupt (a consumer) do on the target.  Or the
+ * producer runs in a thread of its own, truly alongside the consumer
+ * where the host has the cores for it.  The FIFO relies on
+ * memory accesses happening in program order, as on the AVR; x86 hosts
+ * keep that order between threads, other hosts do not, so the threaded
+ * run is only made on x86.
+ *
+ * Usage: fifo_spsc [seconds per run]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "util/fifo.h"
+
+/*! Largest transfer made in one call */
+#define TEST_CHUNK_SZ		(48)
+
+/*! Calls made each time the timer signal fires */
+#define TEST_BURST		(4)
+
+/*! Interval of the timer signal, in microseconds */
+#define TEST_TICK_US		(20)
+
+FIFO_DEFINE(fifo, 128);
+
+/*!
+ * Byte stream.  Producer and consumer each run a copy from the same seed,
+ * so the consumer knows what the next byte must be.
+ */
+struct stream_t {
+	uint32_t state;		/*!< xorshift32 state */
+	uint64_t count;		/*!< Bytes generated */
+};
+
+static struct stream_t tx;	/*!< Producer's stream */
+static struct stream_t rx;	/*!< Consumer's stream */
+static uint32_t tx_pick;	/*!< Producer's choice of call */
+static uint32_t rx_pick;	/*!< Consumer's choice of call */
+
+/*! Set when the producer sees the FIFO overfilled */
+static volatile sig_atomic_t tx_bad;
+
+/*! Tells the producer thread to finish */
+static volatile sig_atomic_t tx_stop;
+
+/*!
+ * Step a xorshift32 generator.
+ */
+static uint32_t test_rand(uint32_t* state) {
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/*!
+ * Return the next byte of a stream.
+ */
+static uint8_t stream_next(struct stream_t* s) {
+	s->count++;
+	return test_rand(&s->state);
+}
+
+/*!
+ * Report a byte that is not the one expected, and give up.
+ */
+static void test_fail(const char* how, uint8_t got, uint8_t want) {
+	printf("FAIL: %s: byte %llu is %02x, expected %02x\n", how,
+			(unsigned long long)rx.count, got, want);
+	exit(1);
+}
+
+/*!
+ * Check `sz` bytes read against the consumer's stream.  If `consume` is
+ * not set the bytes were only peeked at, and the stream is left alone.
+ */
+static void test_check(const char* how, const uint8_t* data, uint8_t sz,
+		uint8_t consume) {
+	struct stream_t s = rx;
+	uint8_t i;
+
+	for (i = 0; i < sz; i++) {
+		uint8_t want = stream_next(&s);
+		if (data[i] != want)
+			test_fail(how, data[i], want);
+	}
+	if (consume)
+		rx = s;
+}
+
+/*!
+ * Make one producer call, chosen at random.  Returns the bytes written.
+ */
+static uint8_t produce(void) {
+	uint32_t pick = test_rand(&tx_pick);
+	uint8_t sz = 1 + ((pick >> 8) % TEST_CHUNK_SZ);
+	uint8_t buf[TEST_CHUNK_SZ];
+	struct stream_t s = tx;
+	uint8_t* span = NULL;
+	uint8_t i, done = 0;
+
+	if (fifo_stored(&fifo) > fifo.total_sz)
+		tx_bad = 1;
+
+	switch (pick % 3) {
+	case 0:
+		if (fifo_write_one(&fifo, stream_next(&s))) {
+			tx = s;
+			done = 1;
+		}
+		break;
+	case 1:
+		for (i = 0; i < sz; i++)
+			buf[i] = stream_next(&s);
+		done = fifo_write(&fifo, buf, sz);
+		for (i = 0; i < done; i++)
+			stream_next(&tx);
+		break;
+	default:
+		done = fifo_write_reserve(&fifo, &span);
+		if (done > sz)
+			done = sz;
+		for (i = 0; i < done; i++)
+			span[i] = stream_next(&tx);
+		fifo_write_commit(&fifo, done);
+		break;
+	}
+	return done;
+}
+
+/*!
+ * Make one consumer call, chosen at random.  Returns the bytes consumed.
+ */
+static uint8_t consume(void) {
+	uint32_t pick = test_rand(&rx_pick);
+	uint8_t sz = 1 + ((pick >> 8) % TEST_CHUNK_SZ);
+	uint8_t buf[TEST_CHUNK_SZ];
+	uint8_t* span = NULL;
+	int16_t byte;
+	uint8_t done = 0;
+
+	if (fifo_stored(&fifo) > fifo.total_sz) {
+		printf("FAIL: %u bytes stored in %u\n",
+				fifo_stored(&fifo), fifo.total_sz);
+		exit(1);
+	}
+
+	switch (pick % 4) {
+	case 0:
+		byte = fifo_read_one(&fifo);
+		if (byte >= 0) {
+			buf[0] = byte;
+			done = 1;
+			test_check("read_one", buf, done, 1);
+		}
+		break;
+	case 1:
+		done = fifo_read(&fifo, buf, sz);
+		test_check("read", buf, done, 1);
+		break;
+	case 2:
+		done = fifo_read_reserve(&fifo, &span);
+		if (done > sz)
+			done = sz;
+		test_check("read_reserve", span, done, 1);
+		fifo_read_commit(&fifo, done);
+		break;
+	default:
+		test_check("peek", buf, fifo_peek(&fifo, buf, sz), 0);
+		break;
+	}
+	return done;
+}
+
+/*!
+ * Start a run: an empty FIFO, and both streams from the same seed.
+ */
+static void test_begin(uint32_t seed) {
+	fifo_empty(&fifo);
+	tx.state = rx.state = seed;
+	tx.count = rx.count = 0;
+	tx_pick = seed ^ 0x5a5a5a5a;
+	rx_pick = seed ^ 0xa5a5a5a5;
+	tx_bad = 0;
+	tx_stop = 0;
+}
+
+/*!
+ * Finish a run: take what is left, then check nothing went astray.
+ */
+static void test_end(const char* run) {
+	while (fifo_stored(&fifo))
+		consume();
+	if (tx_bad) {
+		printf("FAIL: %s: producer saw the FIFO overfilled\n", run);
+		exit(1);
+	}
+	if (tx.count != rx.count) {
+		printf("FAIL: %s: %llu bytes written, %llu read\n", run,
+				(unsigned long long)tx.count,
+				(unsigned long long)rx.count);
+		exit(1);
+	}
+	printf("%s: %llu bytes ok\n", run, (unsigned long long)rx.count);
+}
+
+/*!
+ * Return non-zero once `end` has passed.
+ */
+static int test_done(const struct timespec* end) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec > end->tv_sec) || ((now.tv_sec == end->tv_sec)
+			&& (now.tv_nsec >= end->tv_nsec));
+}
+
+/*!
+ * Timer signal handler: the producer as an interrupt.
+ */
+static void test_tick_produce(int sig) {
+	uint8_t i;
+
+	for (i = 0; i < TEST_BURST; i++)
+		produce();
+}
+
+/*!
+ * Timer signal handler: the consumer as an interrupt.
+ */
+static void test_tick_consume(int sig) {
+	uint8_t i;
+
+	for (i = 0; i < TEST_BURST; i++)
+		consume();
+}
+
+/*!
+ * Run with one side (`tick`) in a timer signal handler, and the other
+ * (`loop`) called over and over until time is up.
+ */
+static void test_signal(const char* run, void (*tick)(int),
+		uint8_t (*loop)(void), uint32_t seed, unsigned seconds) {
+	struct itimerval timer = { { 0, TEST_TICK_US }, { 0, TEST_TICK_US } };
+	struct itimerval off = { { 0, 0 }, { 0, 0 } };
+	struct sigaction sa = { .sa_handler = tick, .sa_flags = SA_RESTART };
+	struct timespec end;
+
+	test_begin(seed);
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGALRM, &sa, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += seconds;
+
+	setitimer(ITIMER_REAL, &timer, NULL);
+	while (!test_done(&end))
+		loop();
+	setitimer(ITIMER_REAL, &off, NULL);
+	/* Drop any signal still pending, so only this side is left */
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGALRM, &sa, NULL);
+
+	test_end(run);
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+/*!
+ * Producer thread body.
+ */
+static void* test_producer(void* arg) {
+	while (!tx_stop)
+		if (!produce())
+			sched_yield();
+	return NULL;
+}
+
+/*!
+ * Run with the producer in a thread of its own.
+ */
+static void test_thread(unsigned seconds) {
+	struct timespec end;
+	pthread_t producer;
+
+	test_begin(0x87654321);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += seconds;
+
+	if (pthread_create(&producer, NULL, test_producer, NULL)) {
+		printf("FAIL: cannot start the producer thread\n");
+		exit(1);
+	}
+	while (!test_done(&end))
+		if (!consume())
+			sched_yield();
+	tx_stop = 1;
+	pthread_join(producer, NULL);
+
+	test_end("thread");
+}
+#endif
+
+int main(int argc, char** argv) {
+	unsigned seconds = (argc > 1) ? atoi(argv[1]) : 2;
+
+	setvbuf(stdout, NULL, _IONBF, 0);
+	FIFO_INIT(fifo);
+
+	test_signal("signal producer", test_tick_produce, consume,
+			0x12345678, seconds);
+	test_signal("signal consumer", test_tick_consume, produce,
+			0x13579bdf, seconds);
+#if defined(__i386__) || defined(__x86_64__)
+	test_thread(seconds);
+#else
+	printf("thread: skipped, needs an x86 host\n");
+#endif
+	return 0;
+}
@@ -0,0 +1,137 @@
+/*!
+ * Read-ahead (protocol/protocol.c): once the host reads memory in
+ * sequence, the next block is fetched while the host handles the last,
+ * and served from there.  Writes, reads elsewhere, steps and I/O reads
+ * must never be answered from it, and a fetch under way when one comes
+ * is drained from the link first.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "proto_sim.h"
+
+/*!
+ * Read `sz` bytes of `type` memory from `addr`, and check they are what
+ * the target holds.
+ */
+static void test_read(uint16_t seq, uint8_t type, uint16_t addr,
+		uint16_t sz) {
+	const uint8_t* mem = (type == PROTO_MEM_SRAM) ? sim.sram : sim.flash;
+	uint8_t* rsp;
+	uint16_t i;
+
+	sim_read(seq, type, addr, sz);
+	sim_pump(SIM_CMD_ITERS);
+	rsp = sim_expect(seq, 1 + sz, PROTO_RSP_MEMORY);
+	for (i = 0; i < sz; i++)
+		assert(rsp[1 + i] == mem[addr + i]);
+}
+
+/*!
+ * SRAM in sequence: the third read on is served from read-ahead.
+ */
+static void test_sram(void) {
+	struct proto_stats_t st;
+	uint8_t k;
+
+	proto_stats(&st, 1);
+	for (k = 0; k < 6; k++)
+		test_read(30 + k, PROTO_MEM_SRAM, 0x300 + 16 * k, 16);
+	proto_stats(&st, 0);
+	assert((st.ahead_hits == 4) && (st.mem_misses == 2));
+	assert((ahead.stage == PROTO_AHEAD_READY) && (ahead.addr == 0x360));
+	printf("sram ok\n");
+}
+
+/*!
+ * Flash in sequence, as a debugger reads code to show it.
+ */
+static void test_flash(void) {
+	struct proto_stats_t st;
+	uint8_t k;
+
+	proto_stats(&st, 1);
+	for (k = 0; k < 8; k++)
+		test_read(50 + k, PROTO_MEM_FLASH_PAGE, 0x1000 + 64 * k, 64);
+	proto_stats(&st, 0);
+	assert(st.ahead_hits == 6);
+	printf("flash ok\n");
+}
+
+/*!
+ * What must not be served from read-ahead.
+ */
+static void test_drop(void) {
+	static const uint8_t data[] = { 0x5a };
+	struct proto_stats_t st;
+	uint8_t k;
+
+	/* A read elsewhere drops what was read ahead of the flash */
+	test_read(59, PROTO_MEM_SRAM, 0x580, 4);
+	assert(ahead.stage == PROTO_AHEAD_IDLE);
+
+	/* A write drops what was read ahead, and the target is read again */
+	proto_stats(&st, 1);
+	for (k = 0; k < 3; k++)
+		test_read(60 + k, PROTO_MEM_SRAM, 0x600 + 16 * k, 16);
+	assert((ahead.stage == PROTO_AHEAD_READY) && (ahead.addr == 0x630));
+	proto_stats(&st, 1);
+	assert((st.ahead_hits == 1) && (st.mem_misses == 2));
+	sim_write(40, PROTO_MEM_SRAM, 0x635, data, sizeof(data));
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(40, 1, PROTO_RSP_OK);
+	assert(ahead.stage == PROTO_AHEAD_IDLE);
+	test_read(41, PROTO_MEM_SRAM, 0x630, 16);
+	assert(sim.sram[0x635] == 0x5a);
+	proto_stats(&st, 0);
+	assert((st.ahead_drops == 1) && !st.ahead_hits && (st.mem_misses == 1));
+
+	/* A read elsewhere while reading ahead */
+	test_read(42, PROTO_MEM_SRAM, 0x640, 16);
+	assert(ahead.stage != PROTO_AHEAD_IDLE);
+	test_read(43, PROTO_MEM_SRAM, 0x500, 4);
+	test_read(44, PROTO_MEM_SRAM, 0x504, 4);
+
+	/* A step straight after a fetch starts */
+	sim_read(45, PROTO_MEM_SRAM, 0x508, 4);
+	sim_send(46, (uint8_t[]){ PROTO_CMND_SINGLE_STEP }, 1);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(45, 5, PROTO_RSP_MEMORY);
+	sim_expect(46, 1, PROTO_RSP_OK);
+	sim_expect_break();
+	assert(ahead.stage == PROTO_AHEAD_IDLE);
+
+	/* I/O registers are never read ahead */
+	test_read(47, PROTO_MEM_SRAM, 0x40, 8);
+	test_read(48, PROTO_MEM_SRAM, 0x48, 8);
+	assert(ahead.stage == PROTO_AHEAD_IDLE);
+	sim_expect_none();
+	printf("drop ok\n");
+}
+
+int main(void) {
+	sim_init();
+	sim_set_device(1);
+	SIM_CMD_OK(2, PROTO_RSP_OK, PROTO_CMND_SET_PARAMETER,
+			PROTO_PAR_EMULATOR_MODE, PROTO_EMULATOR_MODE_DEBUGWIRE);
+
+	test_sram();
+	test_flash();
+	test_drop();
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,274 @@
+/*!
+ * Throughput of the frame parser (protocol/protocol.c).  Frames of a few
+ * message sizes are fed to the receive FIFO in 64-byte USB packets, and
+ * each packet is handed to the parser with fifo16_dispatch, as the main
+ * loop does.  The frames carry GET_SYNC, whose handling costs next to
+ * nothing, so the figures are those of the parser: frames per second,
+ * the mean time per byte, and the time per byte of the dearest packet
+ * of a frame (usually the last, which checks the CRC and runs the
+ * command).
+ *
+ * Then the dispatch paths: commands refused as illegal, as too short, as
+ * out of range and (with the target running) as needing it stopped, and
+ * a mix of the commands a debugger sends most, each answered without
+ * the target.  For these the figure is the time per command, frame and
+ * response included.
+ *
+ * The CRC is timed on its own too.  Built as proto_bench_table, with
+ * PROTO_CRC_TABLE, the table in protocol/crc.c takes the place of
+ * avr-libc's bitwise _crc_ccitt_update, so running both compares them.
+ *
+ * This runs on the host, so the figures only compare one build with
+ * another; they are not AVR cycle counts.
+ *
+ * Usage: proto_bench [frames per run]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <time.h>
+
+#include "proto_sim.h"
+
+/*! USB packet size: the most the parser is given at once */
+#define BENCH_PACKET_SZ		(64)
+
+#ifdef PROTO_CRC_TABLE
+#define BENCH_CRC	"table"
+#else
+#define BENCH_CRC	"bitwise"
+#endif
+
+/*! CRC so far, so the CRC is not optimised away */
+static volatile uint16_t bench_crc_sum;
+
+/*! Message sizes tried: the smallest, a short write, a page, the largest */
+static const uint16_t bench_sizes[] = { 1, 16, 138, 299 };
+
+/*!
+ * Return the time now, in nanoseconds.
+ */
+static double bench_now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/*!
+ * Throw away the responses.
+ */
+static void bench_drop_responses(void) {
+	fifo16_read_commit(&proto_host_uart_tx,
+			fifo16_stored(&proto_host_uart_tx));
+}
+
+/*!
+ * Feed `frames` frames of `frame_sz` bytes, taking them from `frame` in
+ * turn.  Returns the total time taken, or if `worst` is set the worst
+ * time per byte of a dispatch.  For that each packet of a frame is timed
+ * on its own, and the quickest time of each taken, so that what is left
+ * is the cost of the parser rather than of the host being busy elsewhere.
+ */
+static double bench_feed(uint8_t frame[2][10 + 512], uint32_t frame_sz,
+		uint32_t frames, uint8_t worst) {
+	double best[(10 + 512) / BENCH_PACKET_SZ + 1];
+	double start = bench_now(), most = 0;
+	uint32_t n;
+	uint8_t p;
+
+	for (p = 0; p < sizeof(best) / sizeof(best[0]); p++)
+		best[p] = 1e18;
+
+	for (n = 0; n < frames; n++) {
+		const uint8_t* data = frame[n & 1];
+		uint32_t left = frame_sz;
+
+		for (p = 0; left; p++) {
+			uint16_t run = (left < BENCH_PACKET_SZ)
+				? left : BENCH_PACKET_SZ;
+
+			fifo16_write(&proto_host_uart_rx, data, run);
+			if (worst) {
+				double t = bench_now();
+				fifo16_dispatch(&proto_host_uart_rx);
+				t = (bench_now() - t) / run;
+				if (t < best[p])
+					best[p] = t;
+			} else {
+				fifo16_dispatch(&proto_host_uart_rx);
+			}
+			data += run;
+			left -= run;
+		}
+		bench_drop_responses();
+	}
+	assert(!fifo16_stored(&proto_host_uart_rx));
+	if (!worst)
+		return bench_now() - start;
+
+	for (p = 0; p < (frame_sz + BENCH_PACKET_SZ - 1) / BENCH_PACKET_SZ; p++)
+		if (best[p] > most)
+			most = best[p];
+	return most;
+}
+
+/*!
+ * Time frames with a `sz`-byte message, and print the figures.
+ */
+static void bench_parse(uint32_t frames, uint16_t sz) {
+	static uint8_t frame[2][10 + 512];
+	uint8_t body[512];
+	uint32_t frame_sz = 0;
+	double total, worst;
+	uint8_t i;
+
+	/* Two sequence numbers in turn, so that none is taken as a repeat */
+	memset(body, 0x5a, sizeof(body));
+	body[0] = PROTO_CMND_GET_SYNC;
+	for (i = 0; i < 2; i++)
+		frame_sz = sim_frame(frame[i], 1 + i, body, sz);
+
+	total = bench_feed(frame, frame_sz, frames, 0);
+	worst = bench_feed(frame, frame_sz, frames, 1);
+	printf("%7u %12.0f %10.2f %11.2f\n", frame_sz,
+			frames / (total / 1e9),
+			total / ((double)frames * frame_sz), worst);
+}
+
+/*! Commands timed by bench_dispatch, at most */
+#define BENCH_CMNDS_MAX		(4)
+
+/*!
+ * Commands run by bench_dispatch.
+ */
+struct bench_cmnds_t {
+	const char* name;			/*!< What they are */
+	uint8_t n;				/*!< How many */
+	uint8_t sz[BENCH_CMNDS_MAX];		/*!< Their sizes */
+	uint8_t body[BENCH_CMNDS_MAX][10];	/*!< Their messages */
+};
+
+/*! Read of 8 registers */
+#define BENCH_READ_REGS		\
+	{ PROTO_CMND_READ_MEMORY, PROTO_MEM_SRAM, 8, 0, 0, 0, 4, 0, 0, 0 }
+
+static const struct bench_cmnds_t bench_stopped[] = {
+	{ "illegal", 1, { 1 }, { { 0x20 } } },
+	{ "short", 1, { 1 }, { { PROTO_CMND_GET_PARAMETER } } },
+	{ "out of range", 1, { 10 }, { { PROTO_CMND_READ_MEMORY,
+		PROTO_MEM_SRAM, 16, 0, 0, 0, 0xf8, 0xff, 0, 0 } } },
+	{ "GET_SYNC", 1, { 1 }, { { PROTO_CMND_GET_SYNC } } },
+	{ "GET_PARAMETER", 1, { 2 }, { { PROTO_CMND_GET_PARAMETER,
+		PROTO_PAR_FW_VERSION } } },
+	{ "READ_PC", 1, { 1 }, { { PROTO_CMND_READ_PC } } },
+	{ "READ_MEMORY", 1, { 10 }, { BENCH_READ_REGS } },
+	{ "mix", 4, { 1, 2, 1, 10 }, {
+		{ PROTO_CMND_GET_SYNC },
+		{ PROTO_CMND_GET_PARAMETER, PROTO_PAR_FW_VERSION },
+		{ PROTO_CMND_READ_PC }, BENCH_READ_REGS } },
+};
+
+static const struct bench_cmnds_t bench_running[] = {
+	{ "not stopped", 1, { 1 }, { { PROTO_CMND_READ_PC } } },
+};
+
+/*!
+ * Time `frames` of the commands of `cmnds`, taken in turn, each fed to
+ * the parser and answered in one dispatch, and print the figures.
+ */
+static void bench_dispatch(uint32_t frames, const struct bench_cmnds_t* cmnds) {
+	static uint8_t frame[2 * BENCH_CMNDS_MAX][10 + 10];
+	uint32_t frame_sz[2 * BENCH_CMNDS_MAX];
+	uint8_t k = 2 * cmnds->n;
+	double start, total;
+	uint32_t n;
+	uint8_t i;
+
+	/* Two sequence numbers for each, so that none is taken as a repeat */
+	for (i = 0; i < k; i++)
+		frame_sz[i] = sim_frame(frame[i], 1 + i,
+				cmnds->body[i % cmnds->n],
+				cmnds->sz[i % cmnds->n]);
+
+	start = bench_now();
+	for (n = 0; n < frames; n++) {
+		i = n % k;
+		fifo16_write(&proto_host_uart_rx, frame[i], frame_sz[i]);
+		fifo16_dispatch(&proto_host_uart_rx);
+		assert(fifo16_stored(&proto_host_uart_tx));
+		bench_drop_responses();
+	}
+	total = bench_now() - start;
+	assert(!fifo16_stored(&proto_host_uart_rx));
+
+	printf("  %-14s %12.0f %10.1f\n", cmnds->name,
+			frames / (total / 1e9), total / frames);
+}
+
+/*!
+ * Time the CRC over as many bytes as the frames of the largest size,
+ * and print the time per byte.
+ */
+static void bench_crc(uint32_t frames) {
+	static uint8_t data[309];
+	uint16_t crc = PROTO_CRC_INIT;
+	double start, total;
+	uint32_t n;
+
+	for (n = 0; n < sizeof(data); n++)
+		data[n] = n * 7;
+	start = bench_now();
+	for (n = 0; n < frames; n++)
+		crc = proto_crc_span(crc, data, sizeof(data));
+	total = bench_now() - start;
+	bench_crc_sum = crc;
+
+	printf("crc (%s): %.2f ns/byte\n", BENCH_CRC,
+			total / ((double)frames * sizeof(data)));
+}
+
+int main(int argc, char** argv) {
+	uint32_t frames = (argc > 1) ? atoi(argv[1]) : 200000;
+	uint8_t i;
+
+	sim_init();
+
+	bench_crc(frames);
+	printf("parser (%s CRC), %u frames per run, %u-byte packets\n",
+			BENCH_CRC, frames, BENCH_PACKET_SZ);
+	printf("  frame     frames/s    ns/byte  worst/byte\n");
+	for (i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++)
+		bench_parse(frames, bench_sizes[i]);
+
+	/* Attach, which takes the registers and PC into the cache */
+	sim_set_device(1);
+	sim_cmd_ok(2, (uint8_t[]){ PROTO_CMND_SET_PARAMETER,
+			PROTO_PAR_EMULATOR_MODE,
+			PROTO_EMULATOR_MODE_DEBUGWIRE }, 3, PROTO_RSP_OK);
+	assert(cache.flags & PROTO_CACHE_FL_PC);
+
+	printf("dispatch, %u commands per run\n", frames);
+	printf("  command           commands/s     ns/cmd\n");
+	for (i = 0; i < sizeof(bench_stopped) / sizeof(bench_stopped[0]); i++)
+		bench_dispatch(frames, &bench_stopped[i]);
+
+	sim.free_run = 1;
+	sim_cmd_ok(3, (uint8_t[]){ PROTO_CMND_GO }, 1, PROTO_RSP_OK);
+	for (i = 0; i < sizeof(bench_running) / sizeof(bench_running[0]); i++)
+		bench_dispatch(frames, &bench_running[i]);
+	return 0;
+}
@@ -0,0 +1,234 @@
+/*!
+ * Breakpoints on the target (protocol/protocol.c): requests touch
+ * nothing until the target is run, then the flash is brought in line in
+ * as few page writes as can be, with the hardware breakpoint where it
+ * saves most.  Flash reads see the instructions, not the BREAKs, the
+ * target is stepped off a breakpoint it resumes from, and everything is
+ * taken out again once the breakpoints are cleared or the host signs
+ * off.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "proto_sim.h"
+
+/*! Flash as it was before any breakpoint went in */
+static uint8_t test_orig[SIM_FLASH_SZ];
+
+/*!
+ * Set breakpoint `num` at word address `addr`, expecting `rsp`.
+ */
+static void test_set(uint16_t seq, uint8_t num, uint16_t addr, uint8_t rsp) {
+	SIM_CMD_OK(seq, rsp, PROTO_CMND_SET_BREAK, PROTO_BP_TYPE_PROGRAM, num,
+			addr, addr >> 8, 0, 0, 0);
+}
+
+/*!
+ * Clear breakpoint `num` at word address `addr`, expecting `rsp`.
+ */
+static void test_clear(uint16_t seq, uint8_t num, uint16_t addr, uint8_t rsp) {
+	SIM_CMD_OK(seq, rsp, PROTO_CMND_CLR_BREAK, num, addr, addr >> 8, 0, 0);
+}
+
+/*!
+ * Run the target, and check it stops at word address `stop`.
+ */
+static void test_go(uint16_t seq, uint16_t stop) {
+	uint16_t pc;
+
+	SIM_CMD_OK(seq, PROTO_RSP_OK, PROTO_CMND_GO);
+	pc = sim_expect_break();
+	if (pc != stop) {
+		printf("FAIL: stopped at %04x, expected %04x\n", pc, stop);
+		exit(1);
+	}
+}
+
+/*!
+ * Read the flash word at word address `addr`.
+ */
+static uint16_t test_word(uint16_t seq, uint16_t addr) {
+	uint8_t* rsp;
+
+	sim_read(seq, PROTO_MEM_FLASH_PAGE, 2 * addr, 2);
+	sim_pump(SIM_CMD_ITERS);
+	rsp = sim_expect(seq, 3, PROTO_RSP_MEMORY);
+	return rsp[1] | (rsp[2] << 8);
+}
+
+/*!
+ * Return the original flash word at word address `addr`.
+ */
+static uint16_t test_orig_word(uint16_t addr) {
+	return test_orig[2 * addr] | (test_orig[2 * addr + 1] << 8);
+}
+
+/*!
+ * Requests that cannot be met.
+ */
+static void test_errors(void) {
+	SIM_CMD_OK(3, PROTO_RSP_ILLEGAL_BREAKPOINT, PROTO_CMND_SET_BREAK,
+			2, 1, 0x10, 1, 0, 0, 0);
+	test_set(4, 1, SIM_FLASH_SZ / 2, PROTO_RSP_ILLEGAL_BREAKPOINT);
+	test_clear(5, 1, 0x110, PROTO_RSP_ILLEGAL_BREAKPOINT);
+	sim_expect_none();
+	printf("errors ok\n");
+}
+
+/*!
+ * Three breakpoints, two in one page, and one that cancels out: nothing
+ * goes to the target until GO, then one page is written.  Flash reads
+ * see the instructions.
+ */
+static void test_lazy(void) {
+	struct proto_stats_t st;
+	uint32_t rx = sim.rx, erases = sim.erases;
+	uint8_t* rsp;
+
+	test_set(10, 1, 0x110, PROTO_RSP_OK);
+	test_set(11, 2, 0x120, PROTO_RSP_OK);
+	test_set(12, 3, 0x150, PROTO_RSP_OK);
+	test_set(13, 4, 0x160, PROTO_RSP_OK);
+	test_clear(14, 4, 0x160, PROTO_RSP_OK);
+	assert(sim.rx == rx);
+
+	sim_cmd(15, (uint8_t[]){ PROTO_CMND_GET_BREAK, 2 }, 2);
+	rsp = sim_expect(15, 7, PROTO_RSP_GET_BREAK);
+	assert((rsp[1] == PROTO_BP_TYPE_PROGRAM)
+			&& (rsp[2] == 0x20) && (rsp[3] == 0x01));
+
+	/* Most recently set of those never hit: 0x150 gets the hardware */
+	proto_stats(&st, 1);
+	test_go(20, 0x110);
+	assert((sim.erases - erases == 1) && (sim.hw_bp == 0x150));
+	assert((sim_word(0x110) == SIM_BREAK) && (sim_word(0x120) == SIM_BREAK));
+	assert(sim_word(0x150) != SIM_BREAK);
+	proto_stats(&st, 0);
+	assert((st.bp_pages == 1) && (st.bp_avoided == 4));
+
+	assert(test_word(21, 0x110) == test_orig_word(0x110));
+	assert(test_word(22, 0x120) == test_orig_word(0x120));
+	sim_read(23, PROTO_MEM_FLASH_PAGE, 0x200, 0x40);
+	sim_pump(SIM_CMD_ITERS);
+	rsp = sim_expect(23, 0x41, PROTO_RSP_MEMORY);
+	assert(!memcmp(&rsp[1], &test_orig[0x200], 0x40));
+	sim_read(24, PROTO_MEM_FLASH_PAGE, 0x240, 0x40);
+	sim_pump(SIM_CMD_ITERS);
+	rsp = sim_expect(24, 0x41, PROTO_RSP_MEMORY);
+	assert(!memcmp(&rsp[1], &test_orig[0x240], 0x40));
+	sim_expect_none();
+	printf("lazy ok\n");
+}
+
+/*!
+ * Resuming from a breakpoint: it is given the hardware breakpoint and
+ * the target stepped off it, and a single step from one steps.
+ */
+static void test_resume(void) {
+	uint32_t steps = sim.steps;
+
+	test_go(30, 0x120);
+	assert((sim.steps - steps == 1) && (sim.hw_bp == 0x110));
+	assert(sim_word(0x110) != SIM_BREAK);
+	assert((sim_word(0x120) == SIM_BREAK) && (sim_word(0x150) == SIM_BREAK));
+
+	steps = sim.steps;
+	SIM_CMD_OK(31, PROTO_RSP_OK, PROTO_CMND_SINGLE_STEP);
+	assert(sim_expect_break() == 0x121);
+	assert(sim.steps - steps == 1);
+	sim_expect_none();
+	printf("resume ok\n");
+}
+
+/*!
+ * Breakpoints cleared come out at the next run, and the rest when the
+ * host signs off.
+ */
+static void test_remove(void) {
+	uint8_t i;
+
+	test_clear(40, 2, 0x120, PROTO_RSP_OK);
+	test_clear(41, 3, 0x150, PROTO_RSP_OK);
+	test_go(42, 0x110);
+	assert(!memcmp(sim.flash, test_orig, SIM_FLASH_SZ));
+
+	test_set(50, 5, 0x130, PROTO_RSP_OK);
+	SIM_CMD_OK(51, PROTO_RSP_OK, PROTO_CMND_WRITE_PC, 0x00, 0x01, 0, 0);
+	test_go(52, 0x110);
+	assert(sim_word(0x130) == SIM_BREAK);
+	SIM_CMD_OK(53, PROTO_RSP_OK, PROTO_CMND_SIGN_OFF);
+	assert(!memcmp(sim.flash, test_orig, SIM_FLASH_SZ));
+	SIM_CMD_OK(54, PROTO_RSP_ILLEGAL_BREAKPOINT, PROTO_CMND_GET_BREAK, 1);
+
+	for (i = 0; i < sizeof(sim.regs); i++)
+		assert(sim.regs[i] == 0xa0 + i);
+	sim_expect_none();
+	printf("remove ok\n");
+}
+
+/*!
+ * A flash write that starts on the second byte of a BREAK: the host's
+ * byte goes in with the first byte of the instruction, not of the BREAK,
+ * and the BREAK goes back in at the next run.
+ */
+static void test_overwrite(void) {
+	static const uint8_t byte = 0x5a;
+	uint16_t insn;
+
+	SIM_CMD_OK(60, PROTO_RSP_OK, PROTO_CMND_WRITE_PC, 0x00, 0x01, 0, 0);
+	/* Set last, 0x110 gets the hardware: 0x120 is a BREAK */
+	test_set(61, 7, 0x120, PROTO_RSP_OK);
+	test_set(62, 6, 0x110, PROTO_RSP_OK);
+	test_go(63, 0x110);
+	assert(sim_word(0x120) == SIM_BREAK);
+
+	sim_write(64, PROTO_MEM_SPM, 2 * 0x120 + 1, &byte, 1);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(64, 1, PROTO_RSP_OK);
+	insn = (test_orig_word(0x120) & 0x00ff) | (byte << 8);
+	assert(test_word(65, 0x120) == insn);
+	assert(sim_word(0x120) == insn);
+
+	SIM_CMD_OK(66, PROTO_RSP_OK, PROTO_CMND_WRITE_PC, 0x00, 0x01, 0, 0);
+	test_go(67, 0x110);
+	assert(sim_word(0x120) == SIM_BREAK);
+	assert(test_word(68, 0x120) == insn);
+
+	test_clear(69, 6, 0x110, PROTO_RSP_OK);
+	test_clear(70, 7, 0x120, PROTO_RSP_OK);
+	SIM_CMD_OK(71, PROTO_RSP_OK, PROTO_CMND_SIGN_OFF);
+	assert(sim_word(0x120) == insn);
+	test_orig[2 * 0x120 + 1] = byte;
+	assert(!memcmp(sim.flash, test_orig, SIM_FLASH_SZ));
+	sim_expect_none();
+	printf("overwrite ok\n");
+}
+
+int main(void) {
+	sim_init();
+	memcpy(test_orig, sim.flash, sizeof(test_orig));
+	sim_set_device(1);
+	SIM_CMD_OK(2, PROTO_RSP_OK, PROTO_CMND_WRITE_PC, 0x00, 0x01, 0, 0);
+
+	test_errors();
+	test_lazy();
+	test_resume();
+	test_remove();
+	test_overwrite();
+
+	printf("ok\n");
+	return 0;
+}
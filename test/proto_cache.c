@@ -0,0 +1,175 @@
+/*!
+ * Register and SRAM cache in use (protocol/protocol.c): the registers,
+ * SP, SREG and PC taken when the target is attached to are served
+ * without going to it, SRAM lines are filled by a first read and served
+ * after, writes go through to the target and update what is cached, and
+ * all of it is taken again, or dropped, as the target is stepped, run,
+ * stopped and reset.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "proto_sim.h"
+
+/*!
+ * Read `sz` bytes of the data space from `addr`, and check they are what
+ * the target holds.  Returns the number of bytes sent to the target.
+ */
+static uint32_t test_read(uint16_t seq, uint16_t addr, uint16_t sz) {
+	uint32_t rx = sim.rx;
+	uint8_t* rsp;
+	uint16_t i;
+
+	sim_read(seq, PROTO_MEM_SRAM, addr, sz);
+	sim_pump(SIM_CMD_ITERS);
+	rsp = sim_expect(seq, 1 + sz, PROTO_RSP_MEMORY);
+	for (i = 0; i < sz; i++)
+		assert(rsp[1 + i] == ((addr + i < 32)
+				? sim.regs[addr + i] : sim.sram[addr + i]));
+	return sim.rx - rx;
+}
+
+/*!
+ * Take the PC from READ_PC.
+ */
+static uint16_t test_pc(uint16_t seq) {
+	uint8_t* rsp;
+
+	sim_cmd(seq, (uint8_t[]){ PROTO_CMND_READ_PC }, 1);
+	rsp = sim_expect(seq, 5, PROTO_RSP_PC);
+	return rsp[1] | (rsp[2] << 8);
+}
+
+/*!
+ * Attach to a running target: it is stopped, and the registers and PC
+ * taken, without an event.  Then they, SP and SREG are read from the
+ * cache.
+ */
+static void test_snapshot(void) {
+	struct proto_stats_t st;
+	uint32_t rx;
+
+	sim.free_run = 1;
+	sim.running = 1;
+	sim.pc = 0x120;
+	sim.sram[0x5d] = 0xf0;
+	sim.sram[0x5e] = 0x08;
+	sim.sram[0x5f] = 0x82;
+
+	SIM_CMD_OK(2, PROTO_RSP_OK, PROTO_CMND_SET_PARAMETER,
+			PROTO_PAR_EMULATOR_MODE, PROTO_EMULATOR_MODE_DEBUGWIRE);
+	sim_expect_none();
+	assert(cache.flags == (PROTO_CACHE_FL_REGS | PROTO_CACHE_FL_PC));
+	assert(cache.pc == 0x127);
+	assert(mcu_state == PROTO_MCU_STATE_STOPPED);
+
+	proto_stats(&st, 1);
+	rx = sim.rx;
+	assert(!test_read(3, 0, 32));
+	assert(!test_read(4, PROTO_CACHE_SP, 3));
+	assert(test_pc(5) == 0x127);
+	assert(sim.rx == rx);
+	proto_stats(&st, 0);
+	assert((st.mem_hits == 2) && !st.mem_misses && (st.pc_hits == 1));
+	printf("snapshot ok\n");
+}
+
+/*!
+ * SRAM: a miss fills lines, and writes go through them.
+ */
+static void test_lines(void) {
+	static const uint8_t data[] = { 1, 2, 3, 4 };
+	static const uint8_t regs[] = { 0x11, 0x22 };
+	struct proto_stats_t st;
+
+	/* A miss fills, and a read within what was filled hits */
+	assert(test_read(6, 0x8e0, 16));
+	assert(!test_read(7, 0x8e4, 8));
+	assert((sim.regs[30] == 0xa0 + 30) && (sim.regs[31] == 0xa0 + 31));
+
+	/* Writes go to the target, and the cache keeps up */
+	sim_write(8, PROTO_MEM_SRAM, 0x8e6, data, sizeof(data));
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(8, 1, PROTO_RSP_OK);
+	assert(!memcmp(&sim.sram[0x8e6], data, sizeof(data)));
+	assert((sim.regs[30] == 0xa0 + 30) && (sim.regs[31] == 0xa0 + 31));
+	assert(!test_read(9, 0x8e5, 6));
+
+	sim_write(10, PROTO_MEM_SRAM, 4, regs, sizeof(regs));
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(10, 1, PROTO_RSP_OK);
+	assert((sim.regs[4] == 0x11) && (sim.regs[5] == 0x22));
+	assert(!test_read(11, 4, 2));
+	sim_expect_none();
+
+	proto_stats(&st, 0);
+	printf("lines ok (%u hits, %u misses)\n",
+			(unsigned)st.mem_hits, (unsigned)st.mem_misses);
+}
+
+/*!
+ * Run control: a step takes the registers and PC again, a GO drops them
+ * and a stop takes them again, as does a reset.
+ */
+static void test_run(void) {
+	uint32_t rx;
+
+	sim.free_run = 0;
+	SIM_CMD_OK(12, PROTO_RSP_OK, PROTO_CMND_SINGLE_STEP);
+	assert(sim_expect_break() == 0x128);
+	assert(cache.pc == 0x128);
+	rx = sim.rx;
+	assert(!test_read(13, 0, 32));
+	assert(sim.rx == rx);
+
+	/* Refused while running, and nothing dropped is served */
+	sim.free_run = 1;
+	SIM_CMD_OK(14, PROTO_RSP_OK, PROTO_CMND_GO);
+	assert(!cache.flags);
+	sim_read(15, PROTO_MEM_SRAM, 0x100, 4);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(15, 1, PROTO_RSP_ILLEGAL_MCU_STATE);
+	assert(sim.running && (sim.pc == 0x128));
+	SIM_CMD_OK(16, PROTO_RSP_OK, PROTO_CMND_FORCED_STOP);
+	assert(sim_expect_break() == 0x12f);
+	assert(mcu_state == PROTO_MCU_STATE_STOPPED);
+	assert(test_pc(17) == 0x12f);
+
+	/* The PC written is where the target runs from */
+	SIM_CMD_OK(18, PROTO_RSP_OK, PROTO_CMND_WRITE_PC, 0x40, 0, 0, 0);
+	SIM_CMD_OK(19, PROTO_RSP_OK, PROTO_CMND_GO);
+	SIM_CMD_OK(20, PROTO_RSP_OK, PROTO_CMND_FORCED_STOP);
+	assert(sim_expect_break() == 0x47);
+
+	/* A reset of the running target */
+	SIM_CMD_OK(21, PROTO_RSP_OK, PROTO_CMND_GO);
+	SIM_CMD_OK(22, PROTO_RSP_OK, PROTO_CMND_RESET);
+	assert(test_pc(23) == 0);
+	sim_expect_none();
+	printf("run control ok\n");
+}
+
+int main(void) {
+	sim_init();
+	sim_set_device(1);
+
+	test_snapshot();
+	test_lines();
+	test_run();
+
+	printf("ok\n");
+	return 0;
+}
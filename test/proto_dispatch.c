@@ -0,0 +1,210 @@
+/*!
+ * Command dispatch (protocol/protocol.c): each path through the dispatch
+ * table.  Commands without a handler are refused as illegal, messages
+ * shorter than their command needs as failed, bad memory types, ranges
+ * and parameters with their own responses, and commands that need the
+ * target stopped with ILLEGAL_MCU_STATE while it runs, without a byte
+ * going to the target.  A mix of everyday commands is then answered in
+ * order.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "proto_sim.h"
+
+/*! Next sequence number to use */
+static uint16_t test_seq = 1;
+
+/*!
+ * Return the dispatch table entry of command `op`.
+ */
+static struct proto_cmnd_t test_entry(uint8_t op) {
+	struct proto_cmnd_t cmnd = { NULL, 0, 0 };
+
+	if (op < PROTO_CMND_TABLE_SZ)
+		memcpy_P(&cmnd, &proto_cmnd_table[op], sizeof(cmnd));
+	return cmnd;
+}
+
+/*!
+ * Send command `op` with `sz` - 1 zero bytes after it, and check it is
+ * answered with `rsp` alone.
+ */
+static void test_bare(uint8_t op, uint16_t sz, uint8_t rsp) {
+	uint8_t body[1 + PROTO_DEV_SZ];
+
+	assert(sz <= sizeof(body));
+	memset(body, 0, sizeof(body));
+	body[0] = op;
+	sim_cmd_ok(test_seq++, body, sz, rsp);
+}
+
+/*!
+ * Every command byte without a handler, with and without arguments.
+ */
+static void test_illegal(void) {
+	uint16_t op, n = 0;
+
+	for (op = 0; op < 0x100; op++) {
+		if (test_entry(op).handler)
+			continue;
+		test_bare(op, 1, PROTO_RSP_ILLEGAL_COMMAND);
+		test_bare(op, 12, PROTO_RSP_ILLEGAL_COMMAND);
+		n++;
+	}
+	sim_expect_none();
+	printf("%u illegal commands ok\n", n);
+}
+
+/*!
+ * Every command with a handler, one byte short.
+ */
+static void test_short(void) {
+	uint32_t rx = sim.rx;
+	uint16_t op, n = 0;
+
+	for (op = 0; op < 0x100; op++) {
+		struct proto_cmnd_t cmnd = test_entry(op);
+
+		if (!cmnd.handler || (cmnd.min_sz < 2))
+			continue;
+		test_bare(op, cmnd.min_sz - 1, PROTO_RSP_FAILED);
+		n++;
+	}
+	sim_expect_none();
+	assert(sim.rx == rx);
+	printf("%u short messages ok\n", n);
+}
+
+/*!
+ * Memory types, ranges and parameters the probe does not take.
+ */
+static void test_range(void) {
+	uint32_t rx = sim.rx;
+
+	/* Memory types the target has not got, or that cannot be read */
+	sim_read(test_seq, 0x77, 0, 4);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(test_seq++, 1, PROTO_RSP_ILLEGAL_MEMORY_TYPE);
+	sim_read(test_seq, PROTO_MEM_EEPROM, 0, 4);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(test_seq++, 1, PROTO_RSP_ILLEGAL_MEMORY_TYPE);
+
+	/* Past the end of the data space */
+	sim_read(test_seq, PROTO_MEM_SRAM, 0xfff8, 16);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(test_seq++, 1, PROTO_RSP_ILLEGAL_MEMORY_RANGE);
+
+	/* Parameters */
+	SIM_CMD_OK(test_seq++, PROTO_RSP_ILLEGAL_PARAMETER,
+			PROTO_CMND_GET_PARAMETER, 0x77);
+	SIM_CMD_OK(test_seq++, PROTO_RSP_ILLEGAL_PARAMETER,
+			PROTO_CMND_SET_PARAMETER, 0x77, 0);
+	SIM_CMD_OK(test_seq++, PROTO_RSP_ILLEGAL_EMULATOR_MODE,
+			PROTO_CMND_SET_PARAMETER, PROTO_PAR_EMULATOR_MODE, 1);
+	SIM_CMD_OK(test_seq++, PROTO_RSP_ILLEGAL_VALUE,
+			PROTO_CMND_SET_PARAMETER, PROTO_PAR_FLASH_PAGE_SIZE,
+			128);
+	sim_expect_none();
+	assert(sim.rx == rx);
+	printf("ranges ok\n");
+}
+
+/*!
+ * Every command that needs the target stopped, while it runs.
+ */
+static void test_stopped(void) {
+	uint32_t rx;
+	uint16_t op, n = 0;
+	uint8_t* rsp;
+
+	sim.free_run = 1;
+	SIM_CMD_OK(test_seq++, PROTO_RSP_OK, PROTO_CMND_GO);
+	assert(sim.running);
+	rx = sim.rx;
+
+	for (op = 0; op < 0x100; op++) {
+		struct proto_cmnd_t cmnd = test_entry(op);
+
+		if (!cmnd.handler || !(cmnd.flags & PROTO_CMND_FL_STOPPED))
+			continue;
+		test_bare(op, cmnd.min_sz, PROTO_RSP_ILLEGAL_MCU_STATE);
+		n++;
+	}
+
+	/* Those that do not need it still work */
+	SIM_CMD_OK(test_seq++, PROTO_RSP_OK, PROTO_CMND_GET_SYNC);
+	sim_cmd(test_seq, (uint8_t[]){ PROTO_CMND_GET_PARAMETER,
+			PROTO_PAR_MCU_STATE }, 2);
+	rsp = sim_expect(test_seq++, 2, PROTO_RSP_PARAMETER);
+	assert(rsp[1] == PROTO_MCU_STATE_RUNNING);
+	assert(sim.running && (sim.rx == rx));
+
+	/* And once stopped, so do the rest */
+	SIM_CMD_OK(test_seq++, PROTO_RSP_OK, PROTO_CMND_FORCED_STOP);
+	sim_expect_break();
+	sim.free_run = 0;
+	sim_cmd(test_seq, (uint8_t[]){ PROTO_CMND_READ_PC }, 1);
+	sim_expect(test_seq++, 5, PROTO_RSP_PC);
+	sim_expect_none();
+	printf("%u commands refused while running ok\n", n);
+}
+
+/*!
+ * A mix of the commands a debugger sends all the time, several at once.
+ */
+static void test_mix(void) {
+	uint8_t round, i;
+	uint8_t* rsp;
+
+	for (round = 0; round < 50; round++) {
+		uint16_t seq = test_seq;
+
+		sim_send(test_seq++, (uint8_t[]){ PROTO_CMND_GET_SYNC }, 1);
+		sim_send(test_seq++, (uint8_t[]){ PROTO_CMND_GET_PARAMETER,
+				PROTO_PAR_FW_VERSION }, 2);
+		sim_send(test_seq++, (uint8_t[]){ PROTO_CMND_READ_PC }, 1);
+		sim_read(test_seq++, PROTO_MEM_SRAM, round % 24, 8);
+		assert(!test_entry(0x20 + round).handler);
+		sim_send(test_seq++, (uint8_t[]){ 0x20 + round }, 1);
+		sim_pump(SIM_CMD_ITERS);
+
+		sim_expect(seq++, 1, PROTO_RSP_OK);
+		rsp = sim_expect(seq++, 5, PROTO_RSP_PARAMETER);
+		assert((rsp[1] == PROTO_FW_MINOR) && (rsp[2] == PROTO_FW_MAJOR));
+		sim_expect(seq++, 5, PROTO_RSP_PC);
+		rsp = sim_expect(seq++, 9, PROTO_RSP_MEMORY);
+		for (i = 0; i < 8; i++)
+			assert(rsp[1 + i] == (0xa0 + (round % 24) + i));
+		sim_expect(seq++, 1, PROTO_RSP_ILLEGAL_COMMAND);
+		sim_expect_none();
+	}
+	printf("command mix ok\n");
+}
+
+int main(void) {
+	sim_init();
+	sim_set_device(test_seq++);
+
+	test_illegal();
+	test_short();
+	test_range();
+	test_stopped();
+	test_mix();
+
+	printf("ok\n");
+	return 0;
+}
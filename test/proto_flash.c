@@ -0,0 +1,369 @@
+/*!
+ * Flash programming (protocol/protocol.c): pages already holding what
+ * is written are left alone, and only those that differ are erased and
+ * written.  Writes that do not line up with pages are gathered so that
+ * each page is programmed once, while the host sends the next.  Pages
+ * known to be erased are neither erased again nor read back.  EEPROM
+ * writes are refused, and a failure to program is reported to the host
+ * later.  The registers the firmware
+ * borrows to program the target are put back each time.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "proto_sim.h"
+
+/*!
+ * Check the registers hold what they held before programming.
+ */
+static void test_regs(void) {
+	uint8_t i;
+
+	for (i = 0; i < sizeof(sim.regs); i++)
+		assert(sim.regs[i] == 0xa0 + i);
+}
+
+/*!
+ * Three pages, two of them changed: only those two are programmed.
+ */
+static void test_diff(void) {
+	static uint8_t image[3 * SIM_PAGE_SZ];
+	struct proto_stats_t st;
+
+	memcpy(image, &sim.flash[0x1000], sizeof(image));
+	image[SIM_PAGE_SZ + 5] ^= 0x10;
+	image[3 * SIM_PAGE_SZ - 1] = 0x00;
+
+	proto_stats(&st, 1);
+	sim_write(2, PROTO_MEM_FLASH_PAGE, 0x1000, image, sizeof(image));
+	sim_pump(10 * SIM_CMD_ITERS);
+	sim_expect(2, 1, PROTO_RSP_OK);
+	assert(!memcmp(&sim.flash[0x1000], image, sizeof(image)));
+	assert((sim.erases == 2) && (sim.writes == 2));
+	assert(sim.fills == 2 * SIM_PAGE_SZ / 2);
+	proto_stats(&st, 0);
+	assert((st.pages_skipped == 1) && (st.pages_written == 2));
+	test_regs();
+
+	/* The same again: nothing to do */
+	sim_write(3, PROTO_MEM_FLASH_PAGE, 0x1000, image, sizeof(image));
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(3, 1, PROTO_RSP_OK);
+	assert((sim.erases == 2) && (sim.writes == 2));
+	sim_expect_none();
+	printf("diff ok\n");
+}
+
+/*!
+ * A whole image with a few bytes changed, sent page by page as AVaRICE
+ * does: only the pages with a change are programmed.
+ */
+static void test_image(void) {
+	static uint8_t image[SIM_FLASH_SZ];
+	uint32_t erases = sim.erases, addr;
+	uint8_t k;
+
+	memcpy(image, sim.flash, sizeof(image));
+	for (k = 0; k < 5; k++)
+		image[k * 6007 + 11] ^= 0xff;
+
+	for (addr = 0; addr < SIM_FLASH_SZ; addr += SIM_PAGE_SZ) {
+		sim_write(10 + addr / SIM_PAGE_SZ, PROTO_MEM_FLASH_PAGE, addr,
+				&image[addr], SIM_PAGE_SZ);
+		sim_pump(200);
+	}
+	sim_pump(SIM_CMD_ITERS);
+	for (addr = 0; addr < SIM_FLASH_SZ; addr += SIM_PAGE_SZ)
+		sim_expect(10 + addr / SIM_PAGE_SZ, 1, PROTO_RSP_OK);
+	sim_expect_none();
+
+	assert(!memcmp(sim.flash, image, sizeof(image)));
+	assert(sim.erases - erases == 5);
+	test_regs();
+	printf("image ok\n");
+}
+
+/*!
+ * 100-byte writes that do not line up with pages: each page they touch
+ * is programmed once, the last when something else comes along, and
+ * the bytes around them are kept.
+ */
+static void test_unaligned(void) {
+	static uint8_t image[1000];
+	uint32_t erases = sim.erases;
+	uint8_t before = sim.flash[0x2000], after = sim.flash[0x2010 + 1000];
+	uint16_t i;
+	uint8_t k;
+
+	for (i = 0; i < sizeof(image); i++)
+		image[i] = ~sim.flash[0x2010 + i];
+	for (k = 0; k < 10; k++) {
+		sim_write(500 + k, PROTO_MEM_SPM, 0x2010 + k * 100,
+				&image[k * 100], 100);
+		sim_pump(300);
+	}
+	for (k = 0; k < 10; k++)
+		sim_expect(500 + k, 1, PROTO_RSP_OK);
+
+	/* Pages 0x2000 to 0x2380: the last is still being gathered */
+	assert(sim.erases - erases == 7);
+	assert(pages[prog.fill].state == PROTO_PAGE_FILL);
+	sim_read(520, PROTO_MEM_FLASH_PAGE, 0, 4);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(520, 5, PROTO_RSP_MEMORY);
+	assert(sim.erases - erases == 8);
+	assert((pages[0].state == PROTO_PAGE_FREE)
+			&& (pages[1].state == PROTO_PAGE_FREE));
+
+	assert(!memcmp(&sim.flash[0x2010], image, sizeof(image)));
+	assert(sim.flash[0x2000] == before);
+	assert(sim.flash[0x2010 + 1000] == after);
+	test_regs();
+	sim_expect_none();
+	printf("unaligned ok\n");
+}
+
+/*!
+ * EEPROM writes are refused, after the flash page being gathered is
+ * programmed.
+ */
+static void test_eeprom(void) {
+	static const uint8_t data[] = { 1, 2, 3, 4 };
+	uint32_t erases = sim.erases;
+	uint8_t byte = ~sim.flash[0x2410];
+
+	sim_write(530, PROTO_MEM_SPM, 0x2410, &byte, 1);
+	sim_pump(300);
+	sim_expect(530, 1, PROTO_RSP_OK);
+	assert(pages[prog.fill].state == PROTO_PAGE_FILL);
+
+	sim_write(531, PROTO_MEM_EEPROM, 0x10, data, sizeof(data));
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(531, 1, PROTO_RSP_ILLEGAL_MEMORY_TYPE);
+	assert((sim.erases - erases == 1) && (sim.flash[0x2410] == byte));
+
+	sim_write(532, PROTO_MEM_EEPROM_PAGE, 0x10, data, sizeof(data));
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(532, 1, PROTO_RSP_ILLEGAL_MEMORY_TYPE);
+	sim_expect_none();
+	printf("eeprom ok\n");
+}
+
+/*!
+ * The reply to a changed page comes before it is programmed, and the
+ * next page is taken in while it is.
+ */
+static void test_overlap(void) {
+	static uint8_t image[2 * SIM_PAGE_SZ];
+	uint32_t erases = sim.erases, writes = sim.writes;
+	uint8_t* rsp;
+	uint16_t i;
+
+	for (i = 0; i < sizeof(image); i++)
+		image[i] = sim.flash[0x3000 + i] ^ 0x5a;
+
+	sim_write(600, PROTO_MEM_FLASH_PAGE, 0x3000, image, SIM_PAGE_SZ);
+	sim_pump(40);
+	sim_expect(600, 1, PROTO_RSP_OK);
+	assert(sim.writes == writes);
+	sim_write(601, PROTO_MEM_FLASH_PAGE, 0x3000 + SIM_PAGE_SZ,
+			&image[SIM_PAGE_SZ], SIM_PAGE_SZ);
+	sim_pump(40);
+	sim_expect(601, 1, PROTO_RSP_OK);
+	assert(sim.writes - writes < 2);
+
+	/* A read waits for both */
+	sim_read(602, PROTO_MEM_FLASH_PAGE, 0x3000, 2);
+	sim_pump(SIM_CMD_ITERS);
+	rsp = sim_expect(602, 3, PROTO_RSP_MEMORY);
+	assert((rsp[1] == image[0]) && (rsp[2] == image[1]));
+	assert((sim.erases - erases == 2) && (sim.writes - writes == 2));
+	assert(!memcmp(&sim.flash[0x3000], image, sizeof(image)));
+	test_regs();
+	sim_expect_none();
+	printf("overlap ok\n");
+}
+
+/*!
+ * Have the target fall silent while the page written under `seq` is
+ * programmed, after the write has been acknowledged, then come back.
+ */
+static void test_fail_one(uint16_t seq, uint16_t addr, const uint8_t* data) {
+	sim.silent = 1;
+	sim_write(seq, PROTO_MEM_FLASH_PAGE, addr, data, SIM_PAGE_SZ);
+	sim_pump(100);
+	sim_expect(seq, 1, PROTO_RSP_OK);
+
+	/* A command with nothing to do with flash is still run */
+	sim_send(seq + 1, (uint8_t[]){ PROTO_CMND_GET_SYNC }, 1);
+	sim_pump(20000);
+	sim.silent = 0;
+	sim_pump(100);
+	sim_expect(seq + 1, 1, PROTO_RSP_OK);
+	assert(prog.failed == PROTO_RSP_DEBUGWIRE_SYNC_FAILED);
+}
+
+/*!
+ * A page that could not be programmed is reported once, in reply to the
+ * next flash read, flash write or page erase.
+ */
+static void test_failed(void) {
+	static uint8_t image[SIM_PAGE_SZ];
+	uint16_t i;
+
+	for (i = 0; i < SIM_PAGE_SZ; i++)
+		image[i] = ~sim.flash[0x1000 + i];
+
+	/* On a flash read, then forgotten */
+	test_fail_one(40, 0x1000, image);
+	SIM_CMD_OK(42, PROTO_RSP_OK, PROTO_CMND_WRITE_PC, 0x00, 0x01, 0, 0);
+	sim_read(43, PROTO_MEM_FLASH_PAGE, 0x1000, 2);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(43, 1, PROTO_RSP_DEBUGWIRE_SYNC_FAILED);
+	sim_read(44, PROTO_MEM_FLASH_PAGE, 0x1000, 2);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(44, 3, PROTO_RSP_MEMORY);
+
+	/* On the next write, whose data is still programmed */
+	test_fail_one(45, 0x1000, image);
+	sim_write(47, PROTO_MEM_FLASH_PAGE, 0x1000, image, SIM_PAGE_SZ);
+	sim_pump(100);
+	sim_expect(47, 1, PROTO_RSP_DEBUGWIRE_SYNC_FAILED);
+	SIM_CMD_OK(48, PROTO_RSP_OK, PROTO_CMND_GET_SYNC);
+	assert(!memcmp(&sim.flash[0x1000], image, sizeof(image)));
+
+	/* On a page erase */
+	test_fail_one(49, 0x1100, image);
+	SIM_CMD_OK(51, PROTO_RSP_DEBUGWIRE_SYNC_FAILED,
+			PROTO_CMND_ERASEPAGE_SPM, 0x00, 0x12, 0, 0);
+	sim_expect_none();
+	test_regs();
+	printf("failed ok\n");
+}
+
+/*!
+ * A page of 0xff onto a programmed page is only erased, and from then on
+ * the page is known to be erased.
+ */
+static void test_blank(void) {
+	static uint8_t blank[SIM_PAGE_SZ];
+	uint32_t erases = sim.erases, writes = sim.writes, reads;
+	uint16_t i;
+
+	memset(blank, 0xff, sizeof(blank));
+	assert(!proto_blank_test(0x3000));
+	sim_write(700, PROTO_MEM_FLASH_PAGE, 0x3000, blank, sizeof(blank));
+	sim_send(701, (uint8_t[]){ PROTO_CMND_GET_SYNC }, 1);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(700, 1, PROTO_RSP_OK);
+	sim_expect(701, 1, PROTO_RSP_OK);
+	assert((sim.erases == erases + 1) && (sim.writes == writes));
+	for (i = 0; i < SIM_PAGE_SZ; i++)
+		assert(sim.flash[0x3000 + i] == 0xff);
+	assert(proto_blank_test(0x3000));
+
+	/* Writing it again reads nothing back */
+	reads = sim.flash_reads;
+	sim_write(705, PROTO_MEM_FLASH_PAGE, 0x3000, blank, sizeof(blank));
+	sim_send(706, (uint8_t[]){ PROTO_CMND_GET_SYNC }, 1);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(705, 1, PROTO_RSP_OK);
+	sim_expect(706, 1, PROTO_RSP_OK);
+	assert((sim.flash_reads == reads) && (sim.erases == erases + 1));
+
+	/* Erasing it again is skipped; erasing another page is not */
+	SIM_CMD_OK(702, PROTO_RSP_OK,
+			PROTO_CMND_ERASEPAGE_SPM, 0x00, 0x30, 0, 0);
+	assert(sim.erases == erases + 1);
+	SIM_CMD_OK(703, PROTO_RSP_OK,
+			PROTO_CMND_ERASEPAGE_SPM, 0x10, 0x31, 0, 0);
+	SIM_CMD_OK(704, PROTO_RSP_OK, PROTO_CMND_GET_SYNC);
+	assert(sim.erases == erases + 2);
+	for (i = 0; i < SIM_PAGE_SZ; i++)
+		assert(sim.flash[0x3100 + i] == 0xff);
+	assert(proto_blank_test(0x3100));
+	sim_expect_none();
+	printf("blank ok\n");
+}
+
+/*!
+ * A chip erase skips the pages already known to be erased, and leaves
+ * every page known to be.  A load afterwards then writes the pages that
+ * are not all 0xff without erasing or reading back any of them.
+ */
+static void test_chip_erase(void) {
+	static uint8_t image[3 * SIM_PAGE_SZ];
+	uint32_t erases = sim.erases, writes, reads, rx, known = 0, addr;
+	struct proto_stats_t st;
+	uint16_t i;
+
+	for (addr = 0; addr < SIM_FLASH_SZ; addr += SIM_PAGE_SZ)
+		known += proto_blank_test(addr);
+	assert(known);
+	sim_send(800, (uint8_t[]){ PROTO_CMND_CHIP_ERASE }, 1);
+	sim_pump(20 * SIM_CMD_ITERS);
+	sim_expect(800, 1, PROTO_RSP_OK);
+	assert(sim.erases - erases == (SIM_FLASH_SZ / SIM_PAGE_SZ) - known);
+	for (addr = 0; addr < SIM_FLASH_SZ; addr++)
+		assert(sim.flash[addr] == 0xff);
+	for (addr = 0; addr < SIM_FLASH_SZ; addr += SIM_PAGE_SZ)
+		assert(proto_blank_test(addr));
+
+	for (i = 0; i < sizeof(image); i++)
+		image[i] = i;
+	memset(&image[SIM_PAGE_SZ], 0xff, SIM_PAGE_SZ);
+	erases = sim.erases;
+	writes = sim.writes;
+	reads = sim.flash_reads;
+	rx = sim.rx;
+	proto_stats(&st, 1);
+	sim_write(801, PROTO_MEM_FLASH_PAGE, 0, image, sizeof(image));
+	sim_write(802, PROTO_MEM_SPM, 0x405, image, 10);
+	sim_send(803, (uint8_t[]){ PROTO_CMND_GET_SYNC }, 1);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(801, 1, PROTO_RSP_OK);
+	sim_expect(802, 1, PROTO_RSP_OK);
+	sim_expect(803, 1, PROTO_RSP_OK);
+	sim_expect_none();
+
+	proto_stats(&st, 0);
+	assert((sim.erases == erases) && (sim.writes == writes + 3));
+	assert(sim.flash_reads == reads);
+	assert(st.pages_skipped == 1);
+	assert(!memcmp(sim.flash, image, sizeof(image)));
+	assert(!memcmp(&sim.flash[0x405], image, 10));
+	assert((sim.flash[0x404] == 0xff) && (sim.flash[0x40f] == 0xff));
+	test_regs();
+	printf("chip erase ok (%u bytes to the target for the load)\n",
+			(unsigned)(sim.rx - rx));
+}
+
+int main(void) {
+	sim_init();
+	sim_set_device(1);
+
+	test_diff();
+	test_image();
+	test_unaligned();
+	test_eeprom();
+	test_overlap();
+	test_failed();
+	test_blank();
+	test_chip_erase();
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,186 @@
+/*!
+ * Frame parser (protocol/protocol.c): whatever comes before a good frame
+ * (bytes that are not a frame, a frame with a bad CRC, a frame that
+ * stops part way, a frame with a reserved sequence number) is dropped,
+ * and the good frame is still run as the command it carries.  This is
+ * tried both with the command queue empty and with it full.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "proto_sim.h"
+
+/*! Rounds of each kind of rubbish */
+#define TEST_ROUNDS		(20)
+
+/*!
+ * Send a good frame, and check it is run as READ_MEMORY of `sz`
+ * registers from `addr`: a wrong command byte or size, or arguments
+ * taken from the wrong place, all give a different answer.
+ */
+static void test_good(uint16_t seq, uint8_t addr, uint8_t sz) {
+	uint8_t* rsp;
+	uint8_t i;
+
+	sim_read(seq, PROTO_MEM_SRAM, addr, sz);
+	sim_pump(SIM_CMD_ITERS);
+	rsp = sim_expect(seq, 1 + sz, PROTO_RSP_MEMORY);
+	for (i = 0; i < sz; i++)
+		assert(rsp[1 + i] == (0xa0 + addr + i));
+	sim_expect_none();
+}
+
+/*!
+ * Check the parser is back where it started: nothing left over in the
+ * FIFO, nothing queued.
+ */
+static void test_idle(void) {
+	assert(!fifo16_stored(&proto_host_uart_rx));
+	assert(state.q_head == state.q_tail);
+	assert(state.offset == 0);
+	assert(state.tail == 0);
+}
+
+/*!
+ * Bytes that are not a frame, among them a false start.
+ */
+static void test_junk(void) {
+	static const uint8_t junk[] = { 0x09, 0x09, PROTO_DELIM_START, 0x01 };
+	uint8_t round;
+
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		sim_feed(junk, 1 + (round % sizeof(junk)));
+		sim_pump(10);
+		test_good(100 + round, round % 16, 1 + (round % 8));
+	}
+	test_idle();
+	printf("junk ok\n");
+}
+
+/*!
+ * Frames with a bad CRC.
+ */
+static void test_bad_crc(void) {
+	static const uint8_t body[] = { PROTO_CMND_GET_SYNC, 1, 2, 3 };
+	uint8_t frame[32];
+	uint32_t sz;
+	uint8_t round;
+
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		sz = sim_frame(frame, 200 + round, body,
+				1 + (round % sizeof(body)));
+		frame[sz - 1 - (round % 3)] ^= 0x10;
+		sim_feed(frame, sz);
+		sim_pump(10);
+		test_good(200 + round, round % 16, 1 + (round % 8));
+	}
+	test_idle();
+	printf("bad CRC ok\n");
+}
+
+/*!
+ * Frames that stop part way, in the header or the message, and are
+ * timed out.
+ */
+static void test_stall(void) {
+	static const uint8_t body[] = { PROTO_CMND_GET_SYNC, 1, 2, 3, 4, 5 };
+	uint8_t frame[32];
+	uint8_t round;
+
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		sim_frame(frame, 300 + round, body, sizeof(body));
+		sim_feed(frame, 2 + (round % 12));
+		sim_pump((PROTO_TIMEOUT_TICKS + 2) * SIM_TICK_ITERS);
+		sim_expect_none();
+		test_good(300 + round, round % 16, 1 + (round % 8));
+	}
+	test_idle();
+	printf("stall ok\n");
+}
+
+/*!
+ * Frames carrying the sequence number reserved for events.
+ */
+static void test_reserved(void) {
+	static const uint8_t body[] = { PROTO_CMND_GET_SYNC };
+	uint8_t frame[16];
+	uint8_t round;
+
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		sim_feed(frame, sim_frame(frame, PROTO_SEQ_EVENT, body,
+					sizeof(body)));
+		sim_pump(10);
+		test_good(400 + round, round % 16, 1 + (round % 8));
+	}
+	test_idle();
+	printf("reserved ok\n");
+}
+
+/*!
+ * The same, with commands queued: the responses are held up so that
+ * frames pile up behind them, and the rubbish lands between queued
+ * frames.
+ */
+static void test_queued(void) {
+	static const uint8_t junk[] = { 0x09, 0x09, PROTO_DELIM_START, 0x01 };
+	uint8_t body[16] = { PROTO_CMND_GET_SYNC };
+	uint8_t frame[32], pad[256];
+	uint16_t padded;
+	uint32_t sz;
+	uint8_t k;
+
+	/* Leave too little room for a response */
+	memset(pad, 0, sizeof(pad));
+	padded = fifo16_write(&proto_host_uart_tx, pad,
+			proto_tx_free() - 20);
+
+	for (k = 0; k < 7; k++) {
+		if (k == 3)
+			fifo16_write(&proto_host_uart_rx, junk, sizeof(junk));
+		sz = sim_frame(frame, 500 + k, body, 1 + k);
+		if (k == 5)
+			frame[9] ^= 1;
+		fifo16_write(&proto_host_uart_rx, frame, sz);
+		fifo16_dispatch(&proto_host_uart_rx);
+	}
+	assert((uint8_t)(state.q_tail - state.q_head) == PROTO_QUEUE_SZ);
+
+	/* Let the responses go */
+	fifo16_read(&proto_host_uart_tx, pad, padded);
+	sim_pump(SIM_CMD_ITERS);
+	for (k = 0; k < 7; k++)
+		if (k != 5)
+			sim_expect(500 + k, 1, PROTO_RSP_OK);
+	sim_expect_none();
+	test_idle();
+
+	/* And the parser carries on from there */
+	test_good(510, 4, 8);
+	printf("queued ok\n");
+}
+
+int main(void) {
+	sim_init();
+
+	test_junk();
+	test_bad_crc();
+	test_stall();
+	test_reserved();
+	test_queued();
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,158 @@
+/*!
+ * Streamed memory reads (protocol/protocol.c): READ_MEMORY responses far
+ * larger than the host transmit FIFO are passed on as the target sends
+ * them, whatever the speed of the host.  Reads of the data space take the
+ * register file from the registers, Z is put back afterwards, bad reads
+ * are refused before anything is sent, and a target that stops answering
+ * part way still gives a response of the size asked for.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "proto_sim.h"
+
+/*!
+ * Check Z holds what it held before the firmware borrowed it.
+ */
+static void test_z(void) {
+	assert((sim.regs[30] == 0xa0 + 30) && (sim.regs[31] == 0xa0 + 31));
+}
+
+/*!
+ * SRAM from within the register file, with a command queued behind.
+ */
+static void test_sram(void) {
+	uint8_t* rsp;
+	uint16_t i;
+
+	/* The data space view of the registers is not where they are read */
+	memset(sim.sram, 0xee, 32);
+	sim_read(1, PROTO_MEM_SRAM, 0x10, 300);
+	sim_send(2, (uint8_t[]){ PROTO_CMND_GET_SYNC }, 1);
+	sim_host_rate = 40;
+	sim_target_rate = 7;
+	sim_pump(2 * SIM_CMD_ITERS);
+
+	rsp = sim_expect(1, 301, PROTO_RSP_MEMORY);
+	for (i = 0; i < 300; i++) {
+		uint16_t addr = 0x10 + i;
+		assert(rsp[1 + i] == ((addr < 32)
+					? (0xa0 + addr) : sim.sram[addr]));
+	}
+	sim_expect(2, 1, PROTO_RSP_OK);
+	sim_expect_none();
+	test_z();
+	printf("sram ok\n");
+}
+
+/*!
+ * Nearly all of flash, to a host slower than the target.
+ */
+static void test_flash(void) {
+	uint8_t* rsp;
+	uint16_t i;
+
+	sim_read(3, PROTO_MEM_SPM, 1, 32767);
+	sim_host_rate = 13;
+	sim_target_rate = 9;
+	sim_pump(200000);
+
+	rsp = sim_expect(3, 32768, PROTO_RSP_MEMORY);
+	for (i = 0; i < 32767; i++)
+		assert(rsp[1 + i] == sim.flash[1 + i]);
+	sim_expect_none();
+	test_z();
+	printf("flash ok\n");
+}
+
+/*!
+ * Registers alone.
+ */
+static void test_regs(void) {
+	uint8_t* rsp;
+	uint8_t i;
+
+	sim_host_rate = 64;
+	sim_target_rate = 8;
+	sim_read(4, PROTO_MEM_SRAM, 2, 4);
+	sim_pump(SIM_CMD_ITERS);
+	rsp = sim_expect(4, 5, PROTO_RSP_MEMORY);
+	for (i = 0; i < 4; i++)
+		assert(rsp[1 + i] == 0xa2 + i);
+	sim_expect_none();
+	printf("regs ok\n");
+}
+
+/*!
+ * Reads refused: a memory type that cannot be read, and a range past the
+ * end of the data space.
+ */
+static void test_errors(void) {
+	uint32_t rx = sim.rx;
+
+	sim_read(5, PROTO_MEM_EEPROM, 0, 4);
+	sim_read(6, PROTO_MEM_SRAM, 0xfff8, 16);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(5, 1, PROTO_RSP_ILLEGAL_MEMORY_TYPE);
+	sim_expect(6, 1, PROTO_RSP_ILLEGAL_MEMORY_RANGE);
+	sim_expect_none();
+	assert(sim.rx == rx);
+	printf("errors ok\n");
+}
+
+/*!
+ * No target at all, then a target that falls silent part way through.
+ */
+static void test_lost(void) {
+	uint8_t* rsp;
+	uint16_t i;
+
+	sim.silent = 1;
+	sim_read(7, PROTO_MEM_SPM, 0, 16);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(7, 1, PROTO_RSP_DEBUGWIRE_SYNC_FAILED);
+	sim_expect_none();
+
+	/* The response has begun, so it is padded out */
+	sim.silent = 0;
+	/* Two bytes of set-up are answered first, then 50 of flash */
+	sim.die_after = 2 + 50;
+	sim_read(8, PROTO_MEM_SPM, 0, 200);
+	sim_send(9, (uint8_t[]){ PROTO_CMND_GET_SYNC }, 1);
+	sim_pump(SIM_CMD_ITERS);
+	rsp = sim_expect(8, 201, PROTO_RSP_MEMORY);
+	for (i = 0; i < 50; i++)
+		assert(rsp[1 + i] == sim.flash[i]);
+	for (i = 50; i < 200; i++)
+		assert(rsp[1 + i] == 0xff);
+	assert(sim.silent);
+	sim_expect(9, 1, PROTO_RSP_OK);
+	sim_expect_none();
+	printf("lost ok\n");
+}
+
+int main(void) {
+	sim_init();
+
+	test_sram();
+	test_flash();
+	test_regs();
+	test_errors();
+	test_lost();
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,86 @@
+/*!
+ * Sequence numbers (protocol/protocol.c): the number reserved for events
+ * is refused, a command sent again after its response went astray is
+ * answered again without being run twice, and anything else is run,
+ * whatever number it carries.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "proto_sim.h"
+
+int main(void) {
+	uint8_t first[5], again[5];
+	uint32_t gos;
+
+	sim_init();
+	sim_set_device(0);
+
+	/* The number reserved for events: dropped unanswered */
+	SIM_CMD_OK(1, PROTO_RSP_OK, PROTO_CMND_GET_SYNC);
+	sim_cmd(PROTO_SEQ_EVENT, (uint8_t[]){ PROTO_CMND_GET_SYNC }, 1);
+	sim_expect_none();
+
+	/* A lost GO response: answered again, the target not run again */
+	SIM_CMD_OK(2, PROTO_RSP_OK, PROTO_CMND_SET_BREAK, 1, 1, 0x40, 0, 0, 0, 0);
+	SIM_CMD_OK(3, PROTO_RSP_OK, PROTO_CMND_GO);
+	assert(sim_expect_break() == 0x40);
+	gos = sim.gos;
+	SIM_CMD_OK(3, PROTO_RSP_OK, PROTO_CMND_GO);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect_none();
+	assert(sim.gos == gos);
+	printf("repeated GO ok\n");
+
+	/* A longer response comes back the same */
+	sim_cmd(4, (uint8_t[]){ PROTO_CMND_READ_PC }, 1);
+	memcpy(first, sim_expect(4, 5, PROTO_RSP_PC), sizeof(first));
+	sim_cmd(4, (uint8_t[]){ PROTO_CMND_READ_PC }, 1);
+	memcpy(again, sim_expect(4, 5, PROTO_RSP_PC), sizeof(again));
+	assert(!memcmp(first, again, sizeof(first)));
+
+	/* A large response is not kept, and the read is made again */
+	sim_read(5, PROTO_MEM_FLASH_PAGE, 0x1000, 64);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(5, 65, PROTO_RSP_MEMORY);
+	sim_read(5, PROTO_MEM_FLASH_PAGE, 0x1000, 64);
+	sim_pump(SIM_CMD_ITERS);
+	sim_expect(5, 65, PROTO_RSP_MEMORY);
+	printf("repeated responses ok\n");
+
+	/* The same number on another command: run, not answered from before */
+	SIM_CMD_OK(6, PROTO_RSP_OK, PROTO_CMND_GET_SYNC);
+	sim_cmd(6, (uint8_t[]){ PROTO_CMND_READ_PC }, 1);
+	sim_expect(6, 5, PROTO_RSP_PC);
+
+	/* A new session may reuse numbers: nothing is answered from before */
+	SIM_CMD_OK(7, PROTO_RSP_OK, PROTO_CMND_SET_BREAK, 1, 2, 0x50, 0, 0, 0, 0);
+	SIM_CMD_OK(8, PROTO_RSP_OK, PROTO_CMND_GO);
+	assert(sim_expect_break() == 0x50);
+	sim_cmd(8, (uint8_t[]){ PROTO_CMND_GET_SIGN_ON }, 1);
+	sim_expect(8, 28, PROTO_RSP_SIGN_ON);
+	assert(last.seq == PROTO_SEQ_EVENT);
+	SIM_CMD_OK(9, PROTO_RSP_OK, PROTO_CMND_WRITE_PC, 0x40, 0, 0, 0);
+	gos = sim.gos;
+	SIM_CMD_OK(8, PROTO_RSP_OK, PROTO_CMND_GO);
+	assert(sim_expect_break() == 0x50);
+	assert(sim.gos > gos);
+	sim_expect_none();
+	printf("reused numbers ok\n");
+
+	printf("ok\n");
+	return 0;
+}
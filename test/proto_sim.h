@@ -0,0 +1,742 @@
+#ifndef _TEST_PROTO_SIM_H
+#define _TEST_PROTO_SIM_H
+
+/*!
+ * Host harness for the protocol layer.  protocol/protocol.c and
+ * protocol/debugwire.c are built into the test along with the FIFOs of
+ * main.c; at the far end of the host FIFOs sits a simulated host (the
+ * sim_send, sim_cmd and sim_expect calls), and at the far end of the
+ * target FIFOs a simulated debugWIRE target.  sim_pump plays the part of
+ * the main loop, and every SIM_TICK_ITERS rounds of it stand for one
+ * tick of the timer.
+ *
+ * The target is an ATmega328P-like part: 32 KiB of flash in 128-byte
+ * pages, the boot section at the top, and SRAM from 0x100.  It decodes
+ * the debugWIRE commands the firmware sends and checks that they are
+ * sent when the real part would take them: not while it answers, not
+ * while it runs, and not while a page erase or write is under way.  Run
+ * control executes a model program: from the PC onwards each word is a
+ * one-word instruction except BREAK, and the PC wraps from loop_end back
+ * to loop_start.  A GO stops at a BREAK or at the hardware breakpoint
+ * (if armed), or else leaves the target running until it is broken
+ * into.  With free_run set it always runs until broken into.
+ *
+ * Each test includes this header once, then defines main().
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <util/crc16.h>
+
+#include "util/fifo.h"
+
+/*
+ * FIFOs, as in main.c.
+ */
+FIFO_DEFINE(target_fifo_rx, 128);
+extern struct fifo_t proto_target_uart_rx __attribute__((alias ("target_fifo_rx")));
+FIFO_DEFINE(target_fifo_tx, 128);
+extern struct fifo_t proto_target_uart_tx __attribute__((alias ("target_fifo_tx")));
+FIFO16_DEFINE(host_fifo_rx, 512);
+extern struct fifo16_t proto_host_uart_rx __attribute__((alias ("host_fifo_rx")));
+FIFO16_DEFINE(host_fifo_tx, 256);
+extern struct fifo16_t proto_host_uart_tx __attribute__((alias ("host_fifo_tx")));
+
+#include "protocol/protocol.c"
+#include "protocol/debugwire.c"
+
+/*! Flash page size of the simulated part, in bytes */
+#define SIM_PAGE_SZ		(128)
+
+/*! Flash size of the simulated part, in bytes */
+#define SIM_FLASH_SZ		(0x8000)
+
+/*! Data space size of the simulated part (registers, I/O and SRAM) */
+#define SIM_SRAM_SZ		(0x900)
+
+/*! Start of the boot section, in words: SPM only works from there */
+#define SIM_BOOT_START		((SIM_FLASH_SZ / 2) - 128)
+
+/*! Ticks a page erase or write keeps the simulated part busy */
+#define SIM_SPM_TICKS		(2)
+
+/*! Main loop rounds per timer tick */
+#define SIM_TICK_ITERS		(20)
+
+/*! Main loop rounds sim_cmd allows for a command */
+#define SIM_CMD_ITERS		(3000)
+
+/*! The BREAK instruction */
+#define SIM_BREAK		(0x9598)
+
+/*! debugWIRE sync byte, sent by the target after a break or stop */
+#define SIM_SYNC		(0x55)
+
+/*! Size of the buffer holding everything the host has received */
+#define SIM_OUT_SZ		(70000)
+
+/*!
+ * Simulated target.
+ */
+static struct sim_target_t {
+	uint8_t regs[32];		/*!< Register file */
+	uint8_t sram[SIM_SRAM_SZ];	/*!< Data space */
+	uint8_t flash[SIM_FLASH_SZ];	/*!< Flash */
+	uint8_t page[SIM_PAGE_SZ];	/*!< SPM page buffer */
+
+	uint16_t pc;			/*!< PC, also the transfer pointer */
+	uint16_t bp;			/*!< Hardware breakpoint, transfer end */
+	uint8_t context;		/*!< Last context byte (0x40, 0x66...) */
+	uint8_t mode;			/*!< Transfer mode (0xc2) */
+	uint8_t spmcsr;			/*!< SPMCSR */
+	uint8_t cmd;			/*!< Command being decoded */
+	uint8_t arg[2];			/*!< Its argument */
+	uint8_t arg_n;			/*!< Argument bytes taken */
+	uint8_t args_left;		/*!< Argument bytes still to come */
+	int8_t in_reg;			/*!< Register an `in` from DWDR loads */
+	uint16_t write_left;		/*!< Transfer bytes still to come */
+	uint8_t write_mode;		/*!< Transfer mode of those bytes */
+	uint8_t running;		/*!< Running, until broken into */
+
+	uint8_t free_run;		/*!< GO runs until broken into */
+	uint16_t loop_start;		/*!< Model program loop, in words */
+	uint16_t loop_end;
+	uint8_t silent;			/*!< Ignores everything, says nothing */
+	int32_t die_after;		/*!< Bytes sent before falling silent */
+
+	uint8_t reply[8192];		/*!< Bytes still to send */
+	uint16_t reply_head, reply_tail;
+
+	int32_t spm_tick;		/*!< Tick of the last erase or write */
+	int32_t hw_bp;			/*!< Breakpoint armed at the last GO */
+	uint32_t rx;			/*!< Bytes received */
+	uint32_t gos;			/*!< GO commands taken */
+	uint32_t steps;			/*!< Single steps taken */
+	uint32_t erases;		/*!< Page erases */
+	uint32_t writes;		/*!< Page writes */
+	uint32_t fills;			/*!< Page buffer words loaded */
+	uint32_t flash_reads;		/*!< Flash bytes read */
+} sim;
+
+/*! Main loop rounds run */
+static uint32_t sim_iters;
+
+/*! Timer ticks given */
+static int32_t sim_ticks;
+
+/*! Bytes the host takes each round */
+static uint16_t sim_host_rate;
+
+/*! Bytes the target sends each round */
+static uint16_t sim_target_rate;
+
+/*! Everything the host has received, and how far it has been read */
+static uint8_t sim_out[SIM_OUT_SZ];
+static uint32_t sim_out_sz, sim_out_pos;
+
+/*!
+ * Return the CRC of `sz` bytes, as the frames carry it.
+ */
+static uint16_t sim_crc(const uint8_t* data, uint32_t sz) {
+	uint16_t crc = 0xffff;
+
+	while (sz--)
+		crc = _crc_ccitt_update(crc, *data++);
+	return crc;
+}
+
+/*!
+ * Return the flash word at word address `addr`.
+ */
+static uint16_t sim_word(uint16_t addr) {
+	return sim.flash[2 * addr] | (sim.flash[2 * addr + 1] << 8);
+}
+
+/*!
+ * Return the Z register.
+ */
+static uint16_t sim_z(void) {
+	return sim.regs[30] | (sim.regs[31] << 8);
+}
+
+static void sim_set_z(uint16_t z) {
+	sim.regs[30] = z;
+	sim.regs[31] = z >> 8;
+}
+
+/*!
+ * Queue a byte for the target to send.
+ */
+static void sim_emit(uint8_t byte) {
+	sim.reply[sim.reply_tail++] = byte;
+}
+
+/*!
+ * Advance the PC by one word of the model program.
+ */
+static void sim_advance(void) {
+	if (++sim.pc == sim.loop_end)
+		sim.pc = sim.loop_start;
+}
+
+/*!
+ * Execute an instruction sent with 0xd2 and 0x23.  Only those the
+ * firmware uses are known.
+ */
+static void sim_exec(uint16_t ins) {
+	uint8_t io = ((ins >> 5) & 0x30) | (ins & 0x0f);
+	uint8_t reg = (ins >> 4) & 0x1f;
+	uint16_t z = sim_z();
+	uint16_t page = z & ~(SIM_PAGE_SZ - 1);
+	uint16_t i;
+
+	if ((ins & 0xf800) == 0xb000) {
+		/* in reg, DWDR: the next byte sent lands in reg */
+		assert(io == 0x31);
+		sim.in_reg = reg;
+		return;
+	}
+	if ((ins & 0xf800) == 0xb800) {
+		/* out SPMCSR, reg */
+		assert(io == 0x37);
+		sim.spmcsr = sim.regs[reg];
+		return;
+	}
+	if (ins == 0x9632) {
+		/* adiw Z, 2 */
+		sim_set_z(z + 2);
+		return;
+	}
+	if (ins != 0x95e8) {
+		printf("FAIL: unknown instruction %04x\n", ins);
+		exit(1);
+	}
+
+	/* spm */
+	assert((sim.pc >= SIM_BOOT_START) && "spm outside the boot section");
+	switch (sim.spmcsr) {
+	case 0x01:
+		sim.page[z % SIM_PAGE_SZ] = sim.regs[0];
+		sim.page[z % SIM_PAGE_SZ + 1] = sim.regs[1];
+		sim.fills++;
+		break;
+	case 0x03:
+		memset(&sim.flash[page], 0xff, SIM_PAGE_SZ);
+		sim.erases++;
+		sim.spm_tick = sim_ticks;
+		break;
+	case 0x05:
+		for (i = 0; i < SIM_PAGE_SZ; i++)
+			sim.flash[page + i] &= sim.page[i];
+		memset(sim.page, 0xff, SIM_PAGE_SZ);
+		sim.writes++;
+		sim.spm_tick = sim_ticks;
+		break;
+	case 0x11:
+		/* Re-enable the RWW section */
+		break;
+	default:
+		printf("FAIL: unknown SPMCSR %02x\n", sim.spmcsr);
+		exit(1);
+	}
+	sim.spmcsr = 0;
+}
+
+/*!
+ * Start a transfer (0x20) in the mode set with 0xc2, from the PC to the
+ * breakpoint register.
+ */
+static void sim_transfer(void) {
+	uint16_t z = sim_z();
+
+	switch (sim.mode) {
+	case 0:
+		/* SRAM read, through Z */
+		for (; sim.pc < sim.bp; sim.pc += 2)
+			sim_emit(sim.sram[z++]);
+		sim_set_z(z);
+		break;
+	case 1:
+		/* Register read */
+		for (; sim.pc < sim.bp; sim.pc++)
+			sim_emit(sim.regs[sim.pc]);
+		break;
+	case 2:
+		/* Flash read, through Z */
+		for (; sim.pc < sim.bp; sim.pc += 2) {
+			sim_emit(sim.flash[z++]);
+			sim.flash_reads++;
+		}
+		sim_set_z(z);
+		break;
+	case 4:
+		/* SRAM write */
+		sim.write_mode = 4;
+		sim.write_left = (sim.bp - sim.pc) / 2;
+		break;
+	case 5:
+		/* Register write */
+		sim.write_mode = 5;
+		sim.write_left = sim.bp - sim.pc;
+		break;
+	default:
+		printf("FAIL: unknown transfer mode %02x\n", sim.mode);
+		exit(1);
+	}
+}
+
+/*!
+ * Run the model program from the PC (0x30).
+ */
+static void sim_go(void) {
+	uint32_t n;
+
+	sim.gos++;
+	sim.hw_bp = (sim.context & 1) ? sim.bp : -1;
+	assert((sim_word(sim.pc) != SIM_BREAK) && "run from a BREAK");
+	if (!sim.free_run) {
+		for (n = 0; n < 100000; n++) {
+			if ((sim.context & 1) && (sim.pc == sim.bp)) {
+				sim_emit(SIM_SYNC);
+				return;
+			}
+			if (sim_word(sim.pc) == SIM_BREAK) {
+				sim.pc++;
+				sim_emit(SIM_SYNC);
+				return;
+			}
+			sim_advance();
+		}
+	}
+	sim.running = 1;
+}
+
+/*!
+ * Take one byte sent to the target.
+ */
+static void sim_target_byte(uint8_t byte) {
+	sim.rx++;
+	assert((sim.reply_head == sim.reply_tail)
+			&& "byte sent while the target answers");
+	assert(!sim.running && "byte sent while the target runs");
+	assert(((sim_ticks - sim.spm_tick) >= SIM_SPM_TICKS)
+			&& "byte sent during a page erase or write");
+
+	if (sim.in_reg >= 0) {
+		sim.regs[sim.in_reg] = byte;
+		sim.in_reg = -1;
+		return;
+	}
+	if (sim.write_left) {
+		if (sim.write_mode == 5) {
+			sim.regs[sim.pc++] = byte;
+		} else {
+			uint16_t z = sim_z();
+			sim.sram[z++] = byte;
+			sim_set_z(z);
+			sim.pc += 2;
+		}
+		sim.write_left--;
+		return;
+	}
+	if (sim.args_left) {
+		sim.arg[sim.arg_n++] = byte;
+		if (--sim.args_left)
+			return;
+		if (sim.cmd == 0xd0)
+			sim.pc = (sim.arg[0] << 8) | sim.arg[1];
+		else if (sim.cmd == 0xd1)
+			sim.bp = (sim.arg[0] << 8) | sim.arg[1];
+		else if (sim.cmd == 0xc2)
+			sim.mode = sim.arg[0];
+		/* 0xd2 loads the instruction for 0x23 */
+		return;
+	}
+
+	sim.cmd = byte;
+	sim.arg_n = 0;
+	switch (byte) {
+	case 0xd0:
+	case 0xd1:
+	case 0xd2:
+		sim.args_left = 2;
+		break;
+	case 0xc2:
+		sim.args_left = 1;
+		break;
+	case 0x40:
+	case 0x41:
+	case 0x60:
+	case 0x61:
+	case 0x64:
+	case 0x66:
+		sim.context = byte;
+		break;
+	case 0x23:
+		sim_exec((sim.arg[0] << 8) | sim.arg[1]);
+		sim.pc++;
+		break;
+	case 0x20:
+		sim_transfer();
+		break;
+	case 0x30:
+		sim_go();
+		break;
+	case 0x31:
+		sim.steps++;
+		assert((sim_word(sim.pc) != SIM_BREAK) && "step onto a BREAK");
+		sim_advance();
+		sim_emit(SIM_SYNC);
+		break;
+	case 0x07:
+		sim.pc = 0;
+		sim_emit(SIM_SYNC);
+		break;
+	case 0xf0:
+		sim_emit((sim.pc + 1) >> 8);
+		sim_emit(sim.pc + 1);
+		break;
+	default:
+		printf("FAIL: unknown debugWIRE command %02x\n", byte);
+		exit(1);
+	}
+
+	if (sim.reply_tail > (sizeof(sim.reply) / 2)) {
+		memmove(sim.reply, &sim.reply[sim.reply_head],
+				sim.reply_tail - sim.reply_head);
+		sim.reply_tail -= sim.reply_head;
+		sim.reply_head = 0;
+	}
+}
+
+/*!
+ * Let the target take what was sent to it, then send up to `sz` bytes
+ * of its answer.
+ */
+static void sim_target_step(uint16_t sz) {
+	int16_t byte;
+
+	while ((byte = fifo_read_one(&proto_target_uart_tx)) >= 0)
+		if (!sim.silent)
+			sim_target_byte(byte);
+	while (sz-- && (sim.reply_head < sim.reply_tail) && !sim.silent) {
+		if (sim.die_after == 0) {
+			sim.silent = 1;
+			break;
+		}
+		if (sim.die_after > 0)
+			sim.die_after--;
+		assert(fifo_write_one(&proto_target_uart_rx,
+					sim.reply[sim.reply_head++]));
+	}
+	if (sim.silent) {
+		sim.reply_head = sim.reply_tail = 0;
+		sim.args_left = 0;
+		sim.write_left = 0;
+	}
+}
+
+void proto_target_baud(uint32_t rate) {
+}
+
+void proto_target_break(uint16_t us) {
+	int16_t byte;
+
+	/* The line is held low after whatever was sent before */
+	while ((byte = fifo_read_one(&proto_target_uart_tx)) >= 0)
+		if (!sim.silent)
+			sim_target_byte(byte);
+	if (sim.silent)
+		return;
+	/* A running target stops wherever it has got to */
+	if (sim.running)
+		sim.pc += 7;
+	sim.running = 0;
+	sim.args_left = 0;
+	sim.write_left = 0;
+	sim_emit(SIM_SYNC);
+}
+
+/*!
+ * Let the host take up to `sz` bytes sent to it.
+ */
+static void sim_host_take(uint16_t sz) {
+	uint16_t run;
+
+	while (sz && (run = fifo16_read(&proto_host_uart_tx,
+					&sim_out[sim_out_sz],
+					(sz < 64) ? sz : 64))) {
+		sim_out_sz += run;
+		sz -= run;
+		assert(sim_out_sz <= (SIM_OUT_SZ - 64));
+	}
+}
+
+/*!
+ * Run `iters` rounds of the main loop, with the target and host at
+ * either end.
+ */
+static void sim_pump(uint32_t iters) {
+	while (iters--) {
+		sim_target_step(sim_target_rate);
+		fifo_dispatch(&proto_target_uart_rx);
+		fifo16_dispatch(&proto_host_uart_rx);
+		proto_task();
+		sim_host_take(sim_host_rate);
+		fifo16_dispatch(&proto_host_uart_tx);
+		if ((++sim_iters % SIM_TICK_ITERS) == 0) {
+			sim_ticks++;
+			proto_tick();
+		}
+	}
+}
+
+/*!
+ * Start afresh: empty FIFOs, the protocol layer as after a USB
+ * connection, and the target stopped with its memories filled with
+ * patterns.
+ */
+static void sim_init(void) {
+	uint32_t i;
+
+	setvbuf(stdout, NULL, _IONBF, 0);
+	FIFO_INIT(target_fifo_rx);
+	FIFO_INIT(target_fifo_tx);
+	FIFO16_INIT(host_fifo_rx);
+	FIFO16_INIT(host_fifo_tx);
+	target_fifo_rx.config |= FIFO_CFG_COALESCE;
+	host_fifo_rx.config |= FIFO_CFG_COALESCE;
+	host_fifo_tx.config |= FIFO_CFG_COALESCE;
+	proto_init();
+	proto_reset();
+
+	memset(&sim, 0, sizeof(sim));
+	for (i = 0; i < sizeof(sim.regs); i++)
+		sim.regs[i] = 0xa0 + i;
+	for (i = 0; i < SIM_SRAM_SZ; i++)
+		sim.sram[i] = i * 3 + 1;
+	for (i = 0; i < SIM_FLASH_SZ; i++)
+		sim.flash[i] = (i * 7) ^ (i >> 8);
+	memset(sim.page, 0xff, sizeof(sim.page));
+	sim.in_reg = -1;
+	sim.loop_start = 0x100;
+	sim.loop_end = 0x180;
+	sim.die_after = -1;
+	sim.spm_tick = -100;
+	sim.hw_bp = -1;
+
+	sim_host_rate = 64;
+	sim_target_rate = 5;
+	sim_out_sz = sim_out_pos = 0;
+}
+
+/*!
+ * Build a frame carrying `sz` bytes of `body` in `frame`.  Returns its
+ * size.
+ */
+static uint32_t sim_frame(uint8_t* frame, uint16_t seq, const uint8_t* body,
+		uint32_t sz) {
+	uint16_t crc;
+
+	frame[0] = PROTO_DELIM_START;
+	frame[1] = seq;
+	frame[2] = seq >> 8;
+	frame[3] = sz;
+	frame[4] = sz >> 8;
+	frame[5] = sz >> 16;
+	frame[6] = sz >> 24;
+	frame[7] = PROTO_DELIM_TOKEN;
+	memcpy(&frame[8], body, sz);
+	crc = sim_crc(frame, sz + 8);
+	frame[sz + 8] = crc;
+	frame[sz + 9] = crc >> 8;
+	return sz + 10;
+}
+
+/*!
+ * Send `sz` raw bytes to the probe, running the main loop whenever they
+ * do not fit.
+ */
+static void sim_feed(const uint8_t* data, uint32_t sz) {
+	while (sz) {
+		uint16_t run = fifo16_write(&proto_host_uart_rx, data, sz);
+		fifo16_dispatch(&proto_host_uart_rx);
+		data += run;
+		sz -= run;
+		if (sz)
+			sim_pump(1);
+	}
+}
+
+/*!
+ * Send a command to the probe.
+ */
+static void sim_send(uint16_t seq, const uint8_t* body, uint32_t sz) {
+	static uint8_t frame[1024];
+
+	assert((sz + 10) <= sizeof(frame));
+	sim_feed(frame, sim_frame(frame, seq, body, sz));
+}
+
+/*!
+ * Send a command to the probe, and give it time to be answered.
+ */
+static void sim_cmd(uint16_t seq, const uint8_t* body, uint32_t sz) {
+	sim_send(seq, body, sz);
+	sim_pump(SIM_CMD_ITERS);
+}
+
+/*!
+ * Take the next frame the host has received.  Returns the size of its
+ * message, or -1 if there is no whole frame yet.
+ */
+static int32_t sim_reply(uint16_t* seq, uint8_t** body) {
+	uint8_t* frame = &sim_out[sim_out_pos];
+	uint32_t left = sim_out_sz - sim_out_pos;
+	uint32_t sz;
+
+	if (left < 10)
+		return -1;
+	assert((frame[0] == PROTO_DELIM_START)
+			&& (frame[7] == PROTO_DELIM_TOKEN));
+	sz = frame[3] | (frame[4] << 8) | ((uint32_t)frame[5] << 16);
+	if (left < (sz + 10))
+		return -1;
+	assert(sim_crc(frame, sz + 8)
+			== (frame[sz + 8] | (frame[sz + 9] << 8)));
+	*seq = frame[1] | (frame[2] << 8);
+	*body = &frame[8];
+	sim_out_pos += sz + 10;
+	return sz;
+}
+
+/*!
+ * Take the next frame, which must answer `seq` with `sz` bytes starting
+ * with `rsp`.  Returns its message.
+ */
+static uint8_t* sim_expect_at(const char* file, int line, uint16_t seq,
+		int32_t sz, uint8_t rsp) {
+	uint16_t got_seq = 0;
+	uint8_t* body = NULL;
+	int32_t got = sim_reply(&got_seq, &body);
+
+	if ((got != sz) || (got_seq != seq) || (body[0] != rsp)) {
+		printf("FAIL: %s:%d: got seq %04x, %d bytes, %02x; "
+				"expected seq %04x, %d bytes, %02x\n",
+				file, line, got_seq, got,
+				(got > 0) ? body[0] : 0, seq, sz, rsp);
+		exit(1);
+	}
+	return body;
+}
+
+#define sim_expect(seq, sz, rsp)	\
+	sim_expect_at(__FILE__, __LINE__, (seq), (sz), (rsp))
+
+/*!
+ * Take a break event, and return the PC it reports.
+ */
+static uint16_t sim_expect_break(void) {
+	uint8_t* evt = sim_expect(PROTO_SEQ_EVENT, 6, PROTO_EVT_BREAK);
+	return evt[1] | (evt[2] << 8);
+}
+
+/*!
+ * Check the host has received nothing more.
+ */
+#define sim_expect_none()	assert(sim_out_pos == sim_out_sz)
+
+/*!
+ * Send a command and check it is answered with `rsp` alone.
+ */
+static void sim_cmd_ok(uint16_t seq, const uint8_t* body, uint32_t sz,
+		uint8_t rsp) {
+	sim_cmd(seq, body, sz);
+	sim_expect(seq, 1, rsp);
+}
+
+/*!
+ * Send a command given byte by byte, and check it is answered with `rsp`
+ * alone.
+ */
+#define SIM_CMD_OK(seq, rsp, ...)					\
+	do {								\
+		const uint8_t _body[] = { __VA_ARGS__ };		\
+		sim_cmd_ok((seq), _body, sizeof(_body), (rsp));		\
+	} while (0)
+
+/*!
+ * Describe the simulated part to the probe.
+ */
+static void sim_set_device(uint16_t seq) {
+	uint8_t body[1 + PROTO_DEV_SZ];
+
+	memset(body, 0, sizeof(body));
+	body[0] = PROTO_CMND_SET_DEVICE_DESCRIPTOR;
+	body[1 + PROTO_DEV_SPMCR_ADDR] = 0x57;
+	body[1 + PROTO_DEV_DWDR_ADDR] = 0x51;
+	body[1 + PROTO_DEV_FLASH_PAGE_SZ] = SIM_PAGE_SZ;
+	body[1 + PROTO_DEV_FLASH_SZ + 1] = SIM_FLASH_SZ >> 8;
+	body[1 + PROTO_DEV_SRAM_START + 1] = 0x01;
+	sim_cmd_ok(seq, body, sizeof(body), PROTO_RSP_OK);
+}
+
+/*!
+ * Build a READ_MEMORY or WRITE_MEMORY command header in `body`.
+ */
+static void sim_mem_cmd(uint8_t* body, uint8_t op, uint8_t type,
+		uint32_t addr, uint32_t sz) {
+	body[0] = op;
+	body[1] = type;
+	body[2] = sz;
+	body[3] = sz >> 8;
+	body[4] = sz >> 16;
+	body[5] = sz >> 24;
+	body[6] = addr;
+	body[7] = addr >> 8;
+	body[8] = addr >> 16;
+	body[9] = addr >> 24;
+}
+
+/*!
+ * Send a memory read.
+ */
+static void sim_read(uint16_t seq, uint8_t type, uint32_t addr,
+		uint32_t sz) {
+	uint8_t body[10];
+
+	sim_mem_cmd(body, PROTO_CMND_READ_MEMORY, type, addr, sz);
+	sim_send(seq, body, sizeof(body));
+}
+
+/*!
+ * Send a memory write of `sz` bytes of `data`.
+ */
+static void sim_write(uint16_t seq, uint8_t type, uint32_t addr,
+		const uint8_t* data, uint32_t sz) {
+	static uint8_t body[10 + 512];
+
+	assert(sz <= (sizeof(body) - 10));
+	sim_mem_cmd(body, PROTO_CMND_WRITE_MEMORY, type, addr, sz);
+	memcpy(&body[10], data, sz);
+	sim_send(seq, body, 10 + sz);
+}
+
+#endif
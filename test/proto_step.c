@@ -0,0 +1,184 @@
+/*!
+ * Range stepping and running to an address (protocol/protocol.c): a
+ * single step given a range of words carries on, on the probe, until the
+ * PC leaves the range, a breakpoint is reached or the step limit runs
+ * out, and only the final stop is reported.  RUN_TO_ADDR stops at the
+ * address with the hardware breakpoint, leaving the flash alone for it.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "proto_sim.h"
+
+/*!
+ * Check the target reported a stop at word address `stop`, and nothing
+ * else.
+ */
+static void test_stop(const char* what, uint16_t stop) {
+	uint16_t pc = sim_expect_break();
+
+	if (pc != stop) {
+		printf("FAIL: %s stopped at %04x, expected %04x\n", what, pc, stop);
+		exit(1);
+	}
+	sim_expect_none();
+}
+
+/*!
+ * Step through the words from `start` up to `end`, and check the target
+ * stops at `stop`.
+ */
+static void test_range(uint16_t seq, uint16_t start, uint16_t end,
+		uint16_t stop) {
+	sim_send(seq, (uint8_t[]){ PROTO_CMND_SINGLE_STEP, 1, 0,
+			start, start >> 8, 0, 0, end, end >> 8, 0, 0 }, 11);
+	sim_pump(20 * SIM_CMD_ITERS);
+	sim_expect(seq, 1, PROTO_RSP_OK);
+	test_stop("range", stop);
+}
+
+/*!
+ * Run to word address `addr`, and check the target stops at `stop`.
+ */
+static void test_run_to(uint16_t seq, uint16_t addr, uint16_t stop) {
+	SIM_CMD_OK(seq, PROTO_RSP_OK, PROTO_CMND_RUN_TO_ADDR,
+			addr, addr >> 8, 0, 0);
+	test_stop("run to", stop);
+}
+
+/*!
+ * Set the PC to word address `addr`.
+ */
+static void test_pc(uint16_t seq, uint16_t addr) {
+	SIM_CMD_OK(seq, PROTO_RSP_OK, PROTO_CMND_WRITE_PC, addr, addr >> 8, 0, 0);
+}
+
+/*!
+ * A plain single step is still one step, and a line of 40 instructions
+ * takes one command.  The registers are taken once, at the end.
+ */
+static void test_line(void) {
+	struct proto_stats_t st;
+	uint32_t steps = sim.steps, rx;
+	uint8_t* rsp;
+	uint8_t i;
+
+	test_pc(2, 0x100);
+	proto_stats(&st, 1);
+	SIM_CMD_OK(3, PROTO_RSP_OK, PROTO_CMND_SINGLE_STEP, 1, 0);
+	test_stop("step", 0x101);
+	assert(sim.steps - steps == 1);
+
+	steps = sim.steps;
+	test_range(10, 0x100, 0x128, 0x128);
+	assert(sim.steps - steps == 0x27);
+	proto_stats(&st, 0);
+	assert(st.range_steps == 0x26);
+
+	rx = sim.rx;
+	sim_read(11, PROTO_MEM_SRAM, 0, 32);
+	sim_pump(SIM_CMD_ITERS);
+	rsp = sim_expect(11, 33, PROTO_RSP_MEMORY);
+	assert(sim.rx == rx);
+	for (i = 0; i < 32; i++)
+		assert(rsp[1 + i] == 0xa0 + i);
+	printf("line ok\n");
+}
+
+/*!
+ * What ends a range early: a breakpoint in it, or the step limit in an
+ * endless loop.
+ */
+static void test_stops(void) {
+	uint32_t steps;
+
+	test_pc(12, 0x100);
+	SIM_CMD_OK(13, PROTO_RSP_OK, PROTO_CMND_SET_BREAK,
+			PROTO_BP_TYPE_PROGRAM, 1, 0x10, 0x01, 0, 0, 0);
+	test_range(14, 0x100, 0x128, 0x110);
+
+	/* Round the loop to the breakpoint */
+	test_pc(15, 0x111);
+	test_range(16, 0x100, 0x180, 0x110);
+
+	/* Round and round the loop, with nothing to stop it */
+	test_pc(17, 0x111);
+	SIM_CMD_OK(18, PROTO_RSP_OK, PROTO_CMND_CLR_BREAK, 1, 0x10, 0x01, 0, 0);
+	steps = sim.steps;
+	sim_send(19, (uint8_t[]){ PROTO_CMND_SINGLE_STEP, 1, 0,
+			0x00, 0x01, 0, 0, 0x80, 0x01, 0, 0 }, 11);
+	sim_pump(20 * SIM_CMD_ITERS);
+	sim_expect(19, 1, PROTO_RSP_OK);
+	sim_expect_break();
+	sim_expect_none();
+	assert(sim.steps - steps == PROTO_RANGE_STEPS);
+	printf("stops ok\n");
+}
+
+/*!
+ * Running to an address takes the hardware breakpoint, so the flash is
+ * written only for the breakpoints the host set, and not at all once
+ * they are in.  From a breakpoint, the target is stepped off it first.
+ */
+static void test_run(void) {
+	uint32_t erases, steps;
+
+	SIM_CMD_OK(20, PROTO_RSP_OK, PROTO_CMND_SET_BREAK,
+			PROTO_BP_TYPE_PROGRAM, 1, 0x10, 0x01, 0, 0, 0);
+	test_pc(21, 0x128);
+	erases = sim.erases;
+	test_run_to(22, 0x170, 0x170);
+	assert((sim.hw_bp == 0x170) && (sim.erases - erases == 1));
+	assert(sim_word(0x110) == SIM_BREAK);
+
+	erases = sim.erases;
+	test_run_to(23, 0x105, 0x105);
+	assert((sim.hw_bp == 0x105) && (sim.erases == erases));
+
+	test_pc(24, 0x110);
+	steps = sim.steps;
+	test_run_to(25, 0x120, 0x120);
+	assert((sim.hw_bp == 0x120) && (sim.steps - steps == 1));
+	assert(sim_word(0x110) == SIM_BREAK);
+
+	/* Beyond the flash */
+	SIM_CMD_OK(26, PROTO_RSP_ILLEGAL_PARAMETER, PROTO_CMND_RUN_TO_ADDR,
+			0, 0x40, 0, 0);
+	sim_expect_none();
+	printf("run to ok\n");
+}
+
+int main(void) {
+	static uint8_t orig[SIM_FLASH_SZ];
+	uint8_t i;
+
+	sim_init();
+	memcpy(orig, sim.flash, sizeof(orig));
+	sim_set_device(1);
+
+	test_line();
+	test_stops();
+	test_run();
+
+	/* The host leaves everything as it was */
+	SIM_CMD_OK(27, PROTO_RSP_OK, PROTO_CMND_SIGN_OFF);
+	assert(!memcmp(sim.flash, orig, sizeof(orig)));
+	for (i = 0; i < sizeof(sim.regs); i++)
+		assert(sim.regs[i] == 0xa0 + i);
+
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef _TEST_UTIL_ATOMIC_H
+#define _TEST_UTIL_ATOMIC_H
+
+/*!
+ * Host stand-in for avr-libc's <util/atomic.h>, so that util/fifo.h
+ * builds for the tests.  The block masks signals, which is what the
+ * tests use in place of interrupts.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <signal.h>
+
+#define ATOMIC_RESTORESTATE	(0)
+
+/*! Mask all signals for the block, then put the mask back */
+#define ATOMIC_BLOCK(type)						\
+	for (sigset_t _all, _old, *_done = (sigfillset(&_all),		\
+			sigprocmask(SIG_BLOCK, &_all, &_old), NULL);	\
+			!_done;						\
+			_done = &_old, sigprocmask(SIG_SETMASK, &_old, NULL))
+
+#endif
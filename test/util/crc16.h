@@ -0,0 +1,33 @@
+#ifndef _TEST_UTIL_CRC16_H
+#define _TEST_UTIL_CRC16_H
+
+/*!
+ * Host stand-in for avr-libc's <util/crc16.h>: the C equivalent of its
+ * _crc_ccitt_update, as given in the avr-libc manual.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include <stdint.h>
+
+static inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data) {
+	data ^= crc & 0xff;
+	data ^= data << 4;
+	return ((((uint16_t)data << 8) | (crc >> 8))
+			^ (uint8_t)(data >> 4) ^ ((uint16_t)data << 3));
+}
+
+#endif
@@ -21,6 +21,8 @@
  */
 
 #include <stdint.h>
+#include <string.h>
+#include <util/atomic.h>
 
 /*!
  * Empty event.  Indicates that the buffer is now empty and the next read
@@ -52,157 +54,113 @@
 #define FIFO_EVT_OVERRUN	(1 << 4)
 
 /*!
- * FIFO Buffer interface.
+ * Low-water event.  Indicates that a read has brought the fill level down
+ * to the `lowat` mark (if set), so a producer that stopped for lack of
+ * room may resume.
  */
-struct fifo_t {
-	/*! FIFO producer event handler */
-	void (*producer_evth)(struct fifo_t* const fifo, uint8_t events);
-
-	/*! FIFO consumer event handler */
-	void (*consumer_evth)(struct fifo_t* const fifo, uint8_t events);
-
-	volatile uint8_t* buffer;	/*!< Buffer storage location */
-	uint8_t	total_sz;		/*!< Buffer total size */
-	volatile uint8_t stored_sz;	/*!< Buffer usage size */
-	volatile uint8_t read_ptr;	/*!< Read pointer location */
-	volatile uint8_t write_ptr;	/*!< Write pointer location */
-
-	uint8_t producer_evtm;		/*!< Producer event mask */
-	uint8_t consumer_evtm;		/*!< Consumer event mask */
-
-	void* producer_data;		/*!< Producer data pointer */
-	void* consumer_data;		/*!< Consumer data pointer */
-};
+#define FIFO_EVT_LOWAT		(1 << 5)
 
 /*!
- * Execute one or more FIFO events.
+ * Events raised by the consumer side of the buffer.
  */
-static void fifo_exec(struct fifo_t* const fifo, uint8_t events) {
-	if (fifo->producer_evth && (fifo->producer_evtm & events))
-		fifo->producer_evth(fifo, events);
-	if (fifo->consumer_evth && (fifo->consumer_evtm & events))
-		fifo->consumer_evth(fifo, events);
-}
+#define FIFO_EVT_CONSUMER	(FIFO_EVT_EMPTY | FIFO_EVT_UNDERRUN	\
+				| FIFO_EVT_LOWAT)
 
 /*!
- * Empty the buffer.
+ * Configuration flag: latch events and deliver them in one batch from
+ * fifo_dispatch, rather than calling the handlers on every operation.
  */
-static void fifo_empty(struct fifo_t* const fifo) {
-	fifo->stored_sz = 0;
-	fifo->read_ptr = 0;
-	fifo->write_ptr = 0;
-}
+#define FIFO_CFG_COALESCE	(1 << 0)
 
 /*!
- * Initialise the buffer
+ * Largest supported FIFO size.  Sizes must be a power of two so that
+ * pointers wrap with a mask rather than a (software) division, and so
+ * that the free-running 8-bit pointers stay consistent as they wrap.
  */
-static void fifo_init(struct fifo_t* const fifo,
-		volatile uint8_t* buffer, uint8_t sz) {
-	fifo_empty(fifo);
-	fifo->buffer = buffer;
-	fifo->total_sz = sz;
-}
+#define FIFO_MAX_SZ		(128)
 
 /*!
- * Read a byte from the buffer.  Returns the byte read, or -1 if no
- * data is available.
+ * Largest supported wide FIFO size.
  */
-static int16_t fifo_read_one(struct fifo_t* const fifo) {
-	if (!fifo->stored_sz) {
-		fifo_exec(fifo, FIFO_EVT_UNDERRUN);
-		return -1;
-	}
-
-	uint8_t byte = fifo->buffer[fifo->read_ptr];
-	fifo->stored_sz--;
-	fifo->read_ptr = (fifo->read_ptr + 1) % fifo->total_sz;
-	if (!fifo->stored_sz)
-		fifo_exec(fifo, FIFO_EVT_EMPTY);
-	return byte;
-}
+#define FIFO16_MAX_SZ		(32768u)
 
 /*!
- * Read a byte from the buffer without consuming it.
- * Returns the byte read, or -1 if no data is available.
+ * Declare a statically allocated FIFO `name` of `sz` bytes, along with
+ * its storage (`name_buffer`).  The size is checked at compile time.
+ * Attributes (e.g. aliases) may follow the macro.
  */
-static int16_t fifo_peek_one(struct fifo_t* const fifo) {
-	if (!fifo->stored_sz)
-		return -1;
-
-	return fifo->buffer[fifo->read_ptr];
-}
+#define FIFO_DEFINE(name, sz)						\
+	_Static_assert((((sz) & ((sz) - 1)) == 0)			\
+			&& ((sz) <= FIFO_MAX_SZ),			\
+			#name ": size must be a power of two <= 128");	\
+	static uint8_t name ## _buffer[sz];				\
+	static struct fifo_t name __attribute__((nocommon))
 
 /*!
- * Write a byte to the buffer.  Returns 1 on success,
- * 0 if no space available.
+ * Initialise a FIFO declared with FIFO_DEFINE.
  */
-static uint8_t fifo_write_one(struct fifo_t* const fifo, uint8_t byte) {
-	if (fifo->stored_sz >= fifo->total_sz) {
-		fifo_exec(fifo, FIFO_EVT_OVERRUN);
-		return 0;
-	}
+#define FIFO_INIT(name)							\
+	fifo_init(&(name), name ## _buffer, sizeof(name ## _buffer))
 
-	fifo->buffer[fifo->write_ptr] = byte;
-	fifo->stored_sz++;
-	fifo->write_ptr = (fifo->write_ptr + 1) % fifo->total_sz;
-
-	if (fifo->stored_sz)
-		fifo_exec(fifo, FIFO_EVT_NEW);
-
-	if (fifo->stored_sz == fifo->total_sz)
-		fifo_exec(fifo, FIFO_EVT_FULL);
-	return 1;
-}
+/*!
+ * Declare a statically allocated wide (16-bit index) FIFO.
+ */
+#define FIFO16_DEFINE(name, sz)						\
+	_Static_assert((((sz) & ((sz) - 1)) == 0)			\
+			&& ((sz) <= FIFO16_MAX_SZ),			\
+			#name ": size must be a power of two <= 32768");\
+	static uint8_t name ## _buffer[sz];				\
+	static struct fifo16_t name __attribute__((nocommon))
 
 /*!
- * Read bytes from the buffer
+ * Initialise a FIFO declared with FIFO16_DEFINE.
  */
-static uint8_t fifo_read(struct fifo_t* const fifo,
-		uint8_t* buffer, uint8_t sz) {
-	uint8_t count = 0;
-	int16_t byte = fifo_read_one(fifo);
-	while(sz && (byte >= 0)) {
-		*buffer = byte;
-		sz--;
-		buffer++;
-		count++;
-		byte = fifo_read_one(fifo);
-	}
-	return count;
-}
+#define FIFO16_INIT(name)						\
+	fifo16_init(&(name), name ## _buffer, sizeof(name ## _buffer))
 
 /*!
- * Read bytes from the buffer without consuming them.
+ * FIFO statistics, maintained when built with FIFO_STATS defined.  The
+ * producer updates `peak`, `overruns` and `bytes_in`; the consumer
+ * `underruns` and `bytes_out`.  Use fifo_stats to take a copy.
  */
-static uint8_t fifo_peek(struct fifo_t* const fifo,
-		uint8_t* buffer, uint8_t sz) {
-	uint8_t count = 0;
-	uint8_t ptr = fifo->read_ptr;
-	if (sz > fifo->stored_sz)
-		sz = fifo->stored_sz;
-
-	while(sz) {
-		*buffer = fifo->buffer[ptr];
-		sz--;
-		buffer++;
-		count++;
-		ptr = (ptr + 1) % fifo->total_sz;
-	}
-	return count;
-}
-
-/*!
- * Write bytes to the buffer
- */
-static uint8_t fifo_write(struct fifo_t* const fifo,
-		const uint8_t* buffer, uint8_t sz) {
-	uint8_t count = 0;
-	while(sz && fifo_write_one(fifo, *buffer)) {
-		buffer++;
-		sz--;
-		count++;
-	}
-	return count;
-}
+struct fifo_stats_t {
+	uint16_t peak;		/*!< Highest fill level seen */
+	uint16_t overruns;	/*!< Writes refused: buffer full */
+	uint16_t underruns;	/*!< Reads refused: buffer empty */
+	uint32_t bytes_in;	/*!< Bytes written */
+	uint32_t bytes_out;	/*!< Bytes read */
+};
+
+/*!
+ * Compiler barrier.  Keeps buffer accesses on the correct side of the
+ * pointer update that publishes or releases them.
+ */
+#define FIFO_BARRIER()	__asm__ __volatile__ ("" ::: "memory")
+
+/*
+ * Standard FIFO: 8-bit sizes and pointers, up to FIFO_MAX_SZ bytes.
+ * Pointer loads and stores are single instructions on AVR, so these may
+ * be shared between an ISR and the main loop.
+ */
+#define FIFO_T			fifo_t
+#define FIFO_FN(name)		fifo_ ## name
+#define FIFO_IDX_T		uint8_t
+#include "util/fifo_impl.h"
+#undef FIFO_T
+#undef FIFO_FN
+#undef FIFO_IDX_T
+
+/*
+ * Wide FIFO: 16-bit sizes and pointers, for buffers holding whole
+ * protocol frames.  16-bit pointer accesses are not atomic on AVR, so
+ * both ends of a wide FIFO must run in the same context.
+ */
+#define FIFO_T			fifo16_t
+#define FIFO_FN(name)		fifo16_ ## name
+#define FIFO_IDX_T		uint16_t
+#include "util/fifo_impl.h"
+#undef FIFO_T
+#undef FIFO_FN
+#undef FIFO_IDX_T
 
 #endif
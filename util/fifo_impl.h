@@ -0,0 +1,465 @@
+/*!
+ * Ring FIFO buffer implementation, instantiated by util/fifo.h once per
+ * index width.  Not to be included directly.  Expects:
+ *
+ * - FIFO_T: structure tag to declare (e.g. fifo_t)
+ * - FIFO_FN(name): function name for the instance (e.g. fifo_##name)
+ * - FIFO_IDX_T: integer type for sizes and pointers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see COPYING); if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*!
+ * FIFO Buffer interface.
+ *
+ * The buffer is safe for one producer and one consumer running in
+ * different contexts (e.g. an ISR and the main loop) without disabling
+ * interrupts: only the producer writes `write_ptr` and only the consumer
+ * writes `read_ptr`.  Both pointers run freely and are masked on use, so
+ * the fill level is their difference and there is no shared counter.
+ */
+struct FIFO_T {
+	/*! FIFO producer event handler */
+	void (*producer_evth)(struct FIFO_T* const fifo, uint8_t events);
+
+	/*! FIFO consumer event handler */
+	void (*consumer_evth)(struct FIFO_T* const fifo, uint8_t events);
+
+	volatile uint8_t* buffer;	/*!< Buffer storage location */
+	FIFO_IDX_T total_sz;		/*!< Buffer total size (power of 2) */
+	volatile FIFO_IDX_T read_ptr;	/*!< Read pointer, consumer owned */
+	volatile FIFO_IDX_T write_ptr;	/*!< Write pointer, producer owned */
+	FIFO_IDX_T lowat;		/*!< Low-water mark, 0 to disable */
+
+	uint8_t producer_evtm;		/*!< Producer event mask */
+	uint8_t consumer_evtm;		/*!< Consumer event mask */
+
+	uint8_t config;			/*!< Configuration flags */
+	volatile uint8_t producer_pend;	/*!< Latched producer-side events */
+	volatile uint8_t consumer_pend;	/*!< Latched consumer-side events */
+
+#ifdef FIFO_STATS
+	struct fifo_stats_t stats;	/*!< Usage statistics */
+#endif
+
+	void* producer_data;		/*!< Producer data pointer */
+	void* consumer_data;		/*!< Consumer data pointer */
+};
+
+/*!
+ * Deliver one or more FIFO events to the handlers.
+ */
+static void FIFO_FN(deliver)(struct FIFO_T* const fifo, uint8_t events) {
+	if (fifo->producer_evth && (fifo->producer_evtm & events))
+		fifo->producer_evth(fifo, events);
+	if (fifo->consumer_evth && (fifo->consumer_evtm & events))
+		fifo->consumer_evth(fifo, events);
+}
+
+/*!
+ * Account for bytes written and any overrun.
+ */
+static void FIFO_FN(stat_in)(struct FIFO_T* const fifo,
+		FIFO_IDX_T sz, uint8_t events) {
+#ifdef FIFO_STATS
+	FIFO_IDX_T fill = fifo->write_ptr - fifo->read_ptr;
+	if (fill > fifo->stats.peak)
+		fifo->stats.peak = fill;
+	if (events & FIFO_EVT_OVERRUN)
+		fifo->stats.overruns++;
+	fifo->stats.bytes_in += sz;
+#endif
+}
+
+/*!
+ * Account for bytes read and any underrun.
+ */
+static void FIFO_FN(stat_out)(struct FIFO_T* const fifo,
+		FIFO_IDX_T sz, uint8_t events) {
+#ifdef FIFO_STATS
+	if (events & FIFO_EVT_UNDERRUN)
+		fifo->stats.underruns++;
+	fifo->stats.bytes_out += sz;
+#endif
+}
+
+/*!
+ * Copy the statistics into `stats`, zeroing them if `reset` is set.
+ * Returns 0 if the statistics are not compiled in.
+ */
+static uint8_t FIFO_FN(stats)(struct FIFO_T* const fifo,
+		struct fifo_stats_t* const stats, uint8_t reset) {
+#ifdef FIFO_STATS
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		*stats = fifo->stats;
+		if (reset)
+			memset(&(fifo->stats), 0, sizeof(fifo->stats));
+	}
+	return 1;
+#else
+	memset(stats, 0, sizeof(*stats));
+	return 0;
+#endif
+}
+
+/*!
+ * Execute one or more FIFO events.  With FIFO_CFG_COALESCE set, the
+ * events are latched for fifo_dispatch instead.  Producer and consumer
+ * latch into separate bytes, so neither side needs interrupts disabled.
+ */
+static void FIFO_FN(exec)(struct FIFO_T* const fifo, uint8_t events) {
+	if (fifo->config & FIFO_CFG_COALESCE) {
+		if (events & FIFO_EVT_CONSUMER)
+			fifo->consumer_pend |= events;
+		else
+			fifo->producer_pend |= events;
+		return;
+	}
+	FIFO_FN(deliver)(fifo, events);
+}
+
+/*!
+ * Deliver events latched since the last call, once each, as a single
+ * handler call.  EMPTY and FULL are edge events: they report that the
+ * buffer became empty (full) since the last dispatch, not that it still
+ * is.  Call from the main loop for FIFOs with FIFO_CFG_COALESCE set.
+ */
+static void FIFO_FN(dispatch)(struct FIFO_T* const fifo) {
+	uint8_t events;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		events = fifo->producer_pend | fifo->consumer_pend;
+		fifo->producer_pend = 0;
+		fifo->consumer_pend = 0;
+	}
+	if (events)
+		FIFO_FN(deliver)(fifo, events);
+}
+
+/*!
+ * Empty the buffer.  Must not race with the producer or consumer.
+ */
+static void FIFO_FN(empty)(struct FIFO_T* const fifo) {
+	fifo->read_ptr = 0;
+	fifo->write_ptr = 0;
+	fifo->producer_pend = 0;
+	fifo->consumer_pend = 0;
+}
+
+/*!
+ * Wrap a pointer (or pointer plus offset) to the buffer size.
+ */
+static FIFO_IDX_T FIFO_FN(wrap)(const struct FIFO_T* const fifo,
+		FIFO_IDX_T ptr) {
+	return ptr & (fifo->total_sz - 1);
+}
+
+/*!
+ * Return the number of bytes stored.  From the consumer this is a lower
+ * bound, from the producer an upper bound; either is safe to act on.
+ */
+static FIFO_IDX_T FIFO_FN(stored)(const struct FIFO_T* const fifo) {
+	return fifo->write_ptr - fifo->read_ptr;
+}
+
+/*!
+ * Initialise the buffer.  `sz` must be a power of two no larger than
+ * the maximum for the index width; prefer FIFO_DEFINE/FIFO_INIT (or the
+ * FIFO16_ equivalents) which check this.
+ */
+static void FIFO_FN(init)(struct FIFO_T* const fifo,
+		volatile uint8_t* buffer, FIFO_IDX_T sz) {
+	FIFO_FN(empty)(fifo);
+	fifo->buffer = buffer;
+	fifo->total_sz = sz;
+}
+
+/*!
+ * Advance the read pointer by `sz` bytes, returning the events this
+ * generates without executing them.  LOWAT is raised when the fill level
+ * drops from above the low-water mark to at or below it.
+ */
+static uint8_t FIFO_FN(release)(struct FIFO_T* const fifo,
+		FIFO_IDX_T sz) {
+	FIFO_IDX_T ptr = fifo->read_ptr + sz;
+	FIFO_IDX_T fill;
+	uint8_t events = 0;
+
+	FIFO_BARRIER();
+	fifo->read_ptr = ptr;
+	FIFO_FN(stat_out)(fifo, sz, 0);
+
+	fill = fifo->write_ptr - ptr;
+	if (!fill)
+		events |= FIFO_EVT_EMPTY;
+	if (fifo->lowat && (fill <= fifo->lowat)
+			&& ((FIFO_IDX_T)(fill + sz) > fifo->lowat))
+		events |= FIFO_EVT_LOWAT;
+	return events;
+}
+
+/*!
+ * Read a byte from the buffer.  Returns the byte read, or -1 if no
+ * data is available.
+ */
+static int16_t FIFO_FN(read_one)(struct FIFO_T* const fifo) {
+	FIFO_IDX_T ptr = fifo->read_ptr;
+	if (fifo->write_ptr == ptr) {
+		FIFO_FN(stat_out)(fifo, 0, FIFO_EVT_UNDERRUN);
+		FIFO_FN(exec)(fifo, FIFO_EVT_UNDERRUN);
+		return -1;
+	}
+
+	uint8_t byte = fifo->buffer[FIFO_FN(wrap)(fifo, ptr)];
+	uint8_t events = FIFO_FN(release)(fifo, 1);
+	if (events)
+		FIFO_FN(exec)(fifo, events);
+	return byte;
+}
+
+/*!
+ * Read a byte from the buffer without consuming it.
+ * Returns the byte read, or -1 if no data is available.
+ */
+static int16_t FIFO_FN(peek_one)(struct FIFO_T* const fifo) {
+	FIFO_IDX_T ptr = fifo->read_ptr;
+	if (fifo->write_ptr == ptr)
+		return -1;
+
+	return fifo->buffer[FIFO_FN(wrap)(fifo, ptr)];
+}
+
+/*!
+ * Write a byte to the buffer.  Returns 1 on success,
+ * 0 if no space available.
+ */
+static uint8_t FIFO_FN(write_one)(struct FIFO_T* const fifo, uint8_t byte) {
+	FIFO_IDX_T ptr = fifo->write_ptr;
+	if ((FIFO_IDX_T)(ptr - fifo->read_ptr) >= fifo->total_sz) {
+		FIFO_FN(stat_in)(fifo, 0, FIFO_EVT_OVERRUN);
+		FIFO_FN(exec)(fifo, FIFO_EVT_OVERRUN);
+		return 0;
+	}
+
+	fifo->buffer[FIFO_FN(wrap)(fifo, ptr)] = byte;
+	fifo->write_ptr = ++ptr;
+	FIFO_FN(stat_in)(fifo, 1, 0);
+
+	if ((FIFO_IDX_T)(ptr - fifo->read_ptr) == fifo->total_sz)
+		FIFO_FN(exec)(fifo, FIFO_EVT_NEW | FIFO_EVT_FULL);
+	else
+		FIFO_FN(exec)(fifo, FIFO_EVT_NEW);
+	return 1;
+}
+
+/*!
+ * Return the largest contiguous span of stored data starting `offset`
+ * bytes past the read pointer, without consuming anything.  A pointer to
+ * the start of the span is written to `span` and the length of the span
+ * is returned (0 if no more than `offset` bytes are stored).  This lets
+ * the consumer examine data in place ahead of releasing it.  Consumer
+ * side only.
+ */
+static FIFO_IDX_T FIFO_FN(peek_reserve)(struct FIFO_T* const fifo,
+		FIFO_IDX_T offset, uint8_t** span) {
+	FIFO_IDX_T ptr = fifo->read_ptr;
+	FIFO_IDX_T sz = fifo->write_ptr - ptr;
+	FIFO_IDX_T run;
+
+	FIFO_BARRIER();
+	if (sz <= offset)
+		return 0;
+	sz -= offset;
+	ptr = FIFO_FN(wrap)(fifo, ptr + offset);
+	run = fifo->total_sz - ptr;
+	*span = (uint8_t*)&fifo->buffer[ptr];
+	return (sz < run) ? sz : run;
+}
+
+/*!
+ * Reserve the largest contiguous span of stored data, starting at the
+ * read pointer.  A pointer to the start of the span is written to `span`
+ * and the length of the span is returned (0 if the buffer is empty).
+ *
+ * The data may be used in place, then released with fifo_read_commit.
+ * Where the stored data wraps around the end of the buffer, a second
+ * reserve after the commit returns the remainder.  Consumer side only.
+ */
+static FIFO_IDX_T FIFO_FN(read_reserve)(struct FIFO_T* const fifo,
+		uint8_t** span) {
+	return FIFO_FN(peek_reserve)(fifo, 0, span);
+}
+
+/*!
+ * Release `sz` bytes previously reserved with fifo_read_reserve.  Events
+ * are dispatched once for the whole span.
+ */
+static void FIFO_FN(read_commit)(struct FIFO_T* const fifo,
+		FIFO_IDX_T sz) {
+	if (!sz)
+		return;
+
+	uint8_t events = FIFO_FN(release)(fifo, sz);
+	if (events)
+		FIFO_FN(exec)(fifo, events);
+}
+
+/*!
+ * Return the largest contiguous span of free space starting `offset`
+ * bytes past the write pointer, without publishing anything.  A pointer
+ * to the start of the span is written to `span` and the length of the
+ * span is returned (0 if no more than `offset` bytes are free).  This
+ * lets the producer fill data in out of order (e.g. a header once the
+ * length is known) and publish it all at once with fifo_write_commit.
+ * Producer side only.
+ */
+static FIFO_IDX_T FIFO_FN(poke_reserve)(struct FIFO_T* const fifo,
+		FIFO_IDX_T offset, uint8_t** span) {
+	FIFO_IDX_T ptr = fifo->write_ptr;
+	FIFO_IDX_T sz = fifo->total_sz - (FIFO_IDX_T)(ptr - fifo->read_ptr);
+	FIFO_IDX_T run;
+
+	FIFO_BARRIER();
+	if (sz <= offset)
+		return 0;
+	sz -= offset;
+	ptr = FIFO_FN(wrap)(fifo, ptr + offset);
+	run = fifo->total_sz - ptr;
+	*span = (uint8_t*)&fifo->buffer[ptr];
+	return (sz < run) ? sz : run;
+}
+
+/*!
+ * Reserve the largest contiguous span of free space, starting at the
+ * write pointer.  A pointer to the start of the span is written to `span`
+ * and the length of the span is returned (0 if the buffer is full).
+ *
+ * The span may be filled in place, then published with fifo_write_commit.
+ * Producer side only.
+ */
+static FIFO_IDX_T FIFO_FN(write_reserve)(struct FIFO_T* const fifo,
+		uint8_t** span) {
+	return FIFO_FN(poke_reserve)(fifo, 0, span);
+}
+
+/*!
+ * Advance the write pointer by `sz` bytes, returning the events this
+ * generates without executing them.
+ */
+static uint8_t FIFO_FN(publish)(struct FIFO_T* const fifo,
+		FIFO_IDX_T sz) {
+	FIFO_IDX_T ptr = fifo->write_ptr + sz;
+	FIFO_BARRIER();
+	fifo->write_ptr = ptr;
+	FIFO_FN(stat_in)(fifo, sz, 0);
+
+	if ((FIFO_IDX_T)(ptr - fifo->read_ptr) == fifo->total_sz)
+		return FIFO_EVT_NEW | FIFO_EVT_FULL;
+	return FIFO_EVT_NEW;
+}
+
+/*!
+ * Publish `sz` bytes previously written into a span reserved with
+ * fifo_write_reserve.  Events are dispatched once for the whole span.
+ */
+static void FIFO_FN(write_commit)(struct FIFO_T* const fifo,
+		FIFO_IDX_T sz) {
+	if (!sz)
+		return;
+
+	FIFO_FN(exec)(fifo, FIFO_FN(publish)(fifo, sz));
+}
+
+/*!
+ * Read bytes from the buffer.  Events are executed once at the end.
+ */
+static FIFO_IDX_T FIFO_FN(read)(struct FIFO_T* const fifo,
+		uint8_t* buffer, FIFO_IDX_T sz) {
+	FIFO_IDX_T count = 0;
+	uint8_t events = 0;
+	while (sz) {
+		uint8_t* span;
+		FIFO_IDX_T run = FIFO_FN(read_reserve)(fifo, &span);
+		if (!run) {
+			FIFO_FN(stat_out)(fifo, 0, FIFO_EVT_UNDERRUN);
+			events |= FIFO_EVT_UNDERRUN;
+			break;
+		}
+		if (run > sz)
+			run = sz;
+
+		memcpy(buffer, span, run);
+		events |= FIFO_FN(release)(fifo, run);
+		buffer += run;
+		sz -= run;
+		count += run;
+	}
+	if (events)
+		FIFO_FN(exec)(fifo, events);
+	return count;
+}
+
+/*!
+ * Read bytes from the buffer without consuming them.
+ */
+static FIFO_IDX_T FIFO_FN(peek)(struct FIFO_T* const fifo,
+		uint8_t* buffer, FIFO_IDX_T sz) {
+	FIFO_IDX_T ptr = fifo->read_ptr;
+	FIFO_IDX_T stored = fifo->write_ptr - ptr;
+	FIFO_IDX_T run;
+
+	FIFO_BARRIER();
+	ptr = FIFO_FN(wrap)(fifo, ptr);
+	run = fifo->total_sz - ptr;
+	if (sz > stored)
+		sz = stored;
+
+	if (sz <= run) {
+		memcpy(buffer, (const uint8_t*)&fifo->buffer[ptr], sz);
+	} else {
+		memcpy(buffer, (const uint8_t*)&fifo->buffer[ptr], run);
+		memcpy(buffer + run, (const uint8_t*)fifo->buffer, sz - run);
+	}
+	return sz;
+}
+
+/*!
+ * Write bytes to the buffer.  Events are executed once at the end.
+ */
+static FIFO_IDX_T FIFO_FN(write)(struct FIFO_T* const fifo,
+		const uint8_t* buffer, FIFO_IDX_T sz) {
+	FIFO_IDX_T count = 0;
+	uint8_t events = 0;
+	while (sz) {
+		uint8_t* span;
+		FIFO_IDX_T run = FIFO_FN(write_reserve)(fifo, &span);
+		if (!run) {
+			FIFO_FN(stat_in)(fifo, 0, FIFO_EVT_OVERRUN);
+			events |= FIFO_EVT_OVERRUN;
+			break;
+		}
+		if (run > sz)
+			run = sz;
+
+		memcpy(span, buffer, run);
+		events |= FIFO_FN(publish)(fifo, run);
+		buffer += run;
+		sz -= run;
+		count += run;
+	}
+	if (events)
+		FIFO_FN(exec)(fifo, events);
+	return count;
+}